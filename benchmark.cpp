@@ -0,0 +1,135 @@
+/*
+    benchmark.cpp
+    author: Telo PHILIPPE
+
+    Implementation of the benchmark camera path and results.
+*/
+
+#define _USE_MATH_DEFINES
+
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+void orbitCamera(Camera& camera, int depth, int frame, int frameCount) {
+    float size = static_cast<float>(1 << depth);
+    glm::vec3 targetPosition = glm::vec3(size, size, size) * 0.5f;
+    camera.setTarget(targetPosition);
+
+    // Slightly above the equator, far enough for the whole volume to stay in view
+    float angle = 2.0f * static_cast<float>(M_PI) * frame / std::max(frameCount, 1);
+    glm::vec3 cameraOffset = glm::normalize(glm::vec3(std::cos(angle), 0.35f, std::sin(angle))) * size;
+    camera.setPosition(targetPosition + cameraOffset);
+}
+
+void BenchmarkResults::addFrame(double cpuTime, double gpuTime, double prepassTime, const TraversalStats* stats) {
+    m_cpuTimes.push_back(cpuTime);
+    if (gpuTime >= 0) m_gpuTimes.push_back(gpuTime);
+    if (prepassTime >= 0) m_prepassTimes.push_back(prepassTime);
+    if (stats) m_stats.add(*stats);
+}
+
+// Nearest-rank percentile of sorted times, in milliseconds
+static double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1] * 1000.0;
+}
+
+static void writeTimes(std::ostream& out, const std::vector<double>& times) {
+    if (times.empty()) {
+        out << "null";
+        return;
+    }
+    std::vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (double t : sorted) total += t;
+
+    out << "{ \"mean\": " << total / sorted.size() * 1000.0
+        << ", \"min\": " << sorted.front() * 1000.0
+        << ", \"p50\": " << percentile(sorted, 50)
+        << ", \"p90\": " << percentile(sorted, 90)
+        << ", \"p95\": " << percentile(sorted, 95)
+        << ", \"p99\": " << percentile(sorted, 99)
+        << ", \"max\": " << sorted.back() * 1000.0 << " }";
+}
+
+static std::string quote(const std::string& s) {
+    std::string quoted = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20) quoted += c;
+    }
+    return quoted + "\"";
+}
+
+bool BenchmarkResults::write(const std::string& filename, const BenchmarkInfo& info) const {
+    std::ofstream file(filename.c_str());
+    if (!file.good()) {
+        std::cerr << "ERROR: Cannot write file '" << filename << "'" << std::endl;
+        return false;
+    }
+
+    const char* boolean[] = { "false", "true" };
+
+    file << "{\n";
+    file << "  \"scene\": { \"name\": " << quote(info.scene) << ", \"depth\": " << info.depth
+         << ", \"nodeBlocks\": " << info.nodeBlocks << ", \"nodeFormat\": " << quote(info.nodeFormat) << ", \"poolBytes\": " << info.poolBytes
+         << ", \"paletteColors\": " << info.paletteColors << ", \"attributeCount\": " << info.attributeCount << ", \"bricks\": " << boolean[info.bricks] << ", \"dag\": " << boolean[info.dag] << " },\n";
+    file << "  \"renderer\": " << quote(info.renderer) << ",\n";
+    file << "  \"device\": " << quote(info.device) << ",\n";
+    file << "  \"width\": " << info.width << ",\n";
+    file << "  \"height\": " << info.height << ",\n";
+    file << "  \"settings\": { \"skipEmpty\": " << boolean[info.settings.skipEmpty]
+         << ", \"resumeLookups\": " << boolean[info.settings.resumeLookups]
+         << ", \"levelOfDetail\": " << boolean[info.settings.levelOfDetail]
+         << ", \"conePrepass\": " << boolean[info.settings.conePrepass]
+         << ", \"temporalReprojection\": " << boolean[info.settings.temporalReprojection] << " },\n";
+    file << "  \"frames\": " << m_cpuTimes.size() << ",\n";
+    file << "  \"cpuTimeMs\": ";
+    writeTimes(file, m_cpuTimes);
+    file << ",\n  \"gpuTimeMs\": ";
+    writeTimes(file, m_gpuTimes);
+    file << ",\n  \"prepassTimeMs\": ";
+    writeTimes(file, m_prepassTimes);
+    file << ",\n";
+
+    if (m_stats.rays > 0) {
+        double totalTime = 0;
+        for (double t : m_cpuTimes) totalTime += t;
+        file << "  \"traversal\": { \"raysPerSecond\": " << m_stats.rays / totalTime
+             << ", \"stepsPerRay\": " << m_stats.stepsPerRay()
+             << ", \"fetchesPerRay\": " << m_stats.fetchesPerRay() << " },\n";
+    }
+
+    file << "  \"frameTimesMs\": [";
+    for (size_t i = 0; i < m_cpuTimes.size(); i++) {
+        file << (i ? ",\n    " : "\n    ") << "{ \"cpu\": " << m_cpuTimes[i] * 1000.0;
+        if (i < m_gpuTimes.size()) file << ", \"gpu\": " << m_gpuTimes[i] * 1000.0;
+        if (i < m_prepassTimes.size()) file << ", \"prepass\": " << m_prepassTimes[i] * 1000.0;
+        file << " }";
+    }
+    file << "\n  ]\n}\n";
+    return file.good();
+}
+
+void BenchmarkResults::printSummary() const {
+    if (m_cpuTimes.empty()) return;
+    std::vector<double> sorted = m_cpuTimes;
+    std::sort(sorted.begin(), sorted.end());
+    std::cout << m_cpuTimes.size() << " frames, CPU p50 " << percentile(sorted, 50) << " ms, p99 " << percentile(sorted, 99) << " ms";
+    if (!m_gpuTimes.empty()) {
+        sorted = m_gpuTimes;
+        std::sort(sorted.begin(), sorted.end());
+        std::cout << ", GPU p50 " << percentile(sorted, 50) << " ms, p99 " << percentile(sorted, 99) << " ms";
+    }
+    if (!m_prepassTimes.empty()) {
+        sorted = m_prepassTimes;
+        std::sort(sorted.begin(), sorted.end());
+        std::cout << ", prepass p50 " << percentile(sorted, 50) << " ms";
+    }
+    std::cout << std::endl;
+}
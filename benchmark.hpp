@@ -0,0 +1,59 @@
+/*
+    benchmark.hpp
+    author: Telo PHILIPPE
+
+    Headless benchmark runs: a procedural camera orbit, and per-frame timings written
+    out as JSON with their percentiles, so runs can be compared from one commit to the next.
+*/
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include "gl_includes.hpp"
+#include "camera.hpp"
+#include "cpu_raycaster.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Places the camera on frame `frame` of a `frameCount` frames orbit around a volume of
+// 2^depth voxels, one full turn over the run
+void orbitCamera(Camera& camera, int depth, int frame, int frameCount);
+
+// What was rendered, copied as is in the results
+struct BenchmarkInfo {
+    std::string scene;
+    std::string renderer;       // "gpu" or "cpu"
+    std::string device;         // GL_RENDERER, or the CPU thread count and instruction set
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+    size_t nodeBlocks = 0;
+    std::string nodeFormat;
+    size_t poolBytes = 0;   // Uploaded, level of detail entries included
+    size_t paletteColors = 0;   // 0 when leaves hold their colour
+    size_t attributeCount = 0;  // Leaf values of the attribute stream, 0 without one
+    bool bricks = false;        // The bottom levels are bitmask bricks
+    bool dag = false;
+    TraceSettings settings;
+};
+
+class BenchmarkResults {
+public:
+    // Times are in seconds, negative when not measured. gpuTime is the main GPU pass alone,
+    // prepassTime the reprojection and cone prepasses on either renderer.
+    void addFrame(double cpuTime, double gpuTime, double prepassTime, const TraversalStats* stats = nullptr);
+
+    bool write(const std::string& filename, const BenchmarkInfo& info) const;
+
+    void printSummary() const;
+
+private:
+    std::vector<double> m_cpuTimes;
+    std::vector<double> m_gpuTimes;
+    std::vector<double> m_prepassTimes;
+    TraversalStats m_stats;
+};
+
+#endif  // BENCHMARK_HPP
@@ -18,9 +18,9 @@ class Camera {
     inline float getFar() const { return m_far; }
     inline void setFar(const float n) { m_far = n; }
     inline void setPosition(const glm::vec3 &p) { m_pos = p; }
-    inline glm::vec3 getPosition() { return m_pos; }
+    inline glm::vec3 getPosition() const { return m_pos; }
     inline void setTarget(const glm::vec3 &t) { m_target = t; }
-    inline glm::vec3 getTarget() { return m_target; }
+    inline glm::vec3 getTarget() const { return m_target; }
 
     inline glm::mat4 computeViewMatrix() const {
         return glm::lookAt(m_pos, m_target, glm::vec3(0, 1, 0));
@@ -0,0 +1,99 @@
+/*
+    cpu_packet.cpp
+    author: Telo PHILIPPE
+
+    Instruction set detection and selection of the packet traversal kernel.
+*/
+
+#include "cpu_packet.hpp"
+
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define PACKET_X86_MSVC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PACKET_X86_GNU
+#endif
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::SSE4: return "sse4";
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+bool parseSimdLevel(const std::string& name, SimdLevel& level) {
+    const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE4, SimdLevel::AVX2, SimdLevel::AVX512 };
+    for (SimdLevel l : levels) {
+        if (name == simdLevelName(l)) {
+            level = l;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Instruction sets the processor and the operating system both support
+static bool cpuSupports(SimdLevel level) {
+#if defined(PACKET_X86_GNU)
+    __builtin_cpu_init();
+    switch (level) {
+    case SimdLevel::SSE4: return __builtin_cpu_supports("sse4.1");
+    case SimdLevel::AVX2: return __builtin_cpu_supports("avx2");
+    case SimdLevel::AVX512: return __builtin_cpu_supports("avx512f");
+    default: return true;
+    }
+#elif defined(PACKET_X86_MSVC)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    // Register state the OS saves on context switches: YMM for AVX, ZMM and masks for AVX-512
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool ymm = (xcr0 & 0x6) == 0x6;
+    const bool zmm = (xcr0 & 0xE6) == 0xE6;
+    int leaf7[4] = {};
+    if (maxLeaf >= 7) __cpuidex(leaf7, 7, 0);
+    switch (level) {
+    case SimdLevel::SSE4: return sse41;
+    case SimdLevel::AVX2: return ymm && (leaf7[1] & (1 << 5)) != 0;
+    case SimdLevel::AVX512: return zmm && (leaf7[1] & (1 << 16)) != 0;
+    default: return true;
+    }
+#else
+    return level == SimdLevel::Scalar;
+#endif
+}
+
+static PacketKernel kernel(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::SSE4: return packetKernelSSE4();
+    case SimdLevel::AVX2: return packetKernelAVX2();
+    case SimdLevel::AVX512: return packetKernelAVX512();
+    default: return nullptr;
+    }
+}
+
+PacketTracer packetTracer(SimdLevel level) {
+    // Packets as square as possible, for coherent rays
+    const PacketTracer tracers[] = {
+        { SimdLevel::AVX512, 4, 4, nullptr },
+        { SimdLevel::AVX2, 4, 2, nullptr },
+        { SimdLevel::SSE4, 2, 2, nullptr },
+    };
+    for (PacketTracer tracer : tracers) {
+        if (tracer.level > level || !cpuSupports(tracer.level)) continue;
+        tracer.trace = kernel(tracer.level);
+        if (tracer.trace) return tracer;
+    }
+    return PacketTracer { SimdLevel::Scalar, 1, 1, nullptr };
+}
+
+SimdLevel detectSimdLevel() {
+    return packetTracer(SimdLevel::AVX512).level;
+}
@@ -0,0 +1,79 @@
+/*
+    cpu_packet.hpp
+    author: Telo PHILIPPE
+
+    Packet traversal for the CPU renderer: the primary rays of a small block of pixels are
+    traced together, one per SIMD lane, running voxelTraversal and the octree descent of
+    sampleOctree with masked lanes. Results are identical to the scalar ray caster.
+
+    Each instruction set has its own translation unit compiled with the matching flags
+    (cpu_packet_sse4.cpp, cpu_packet_avx2.cpp, cpu_packet_avx512.cpp); the widest one the
+    processor supports is picked at run time, the scalar path being the fallback.
+*/
+
+#ifndef CPU_PACKET_HPP
+#define CPU_PACKET_HPP
+
+#include "gl_includes.hpp"
+#include "cpu_raycaster.hpp"
+#include "node_pool.hpp"
+
+#include <string>
+
+enum class SimdLevel {
+    Scalar,
+    SSE4,       // 4 lanes
+    AVX2,       // 8 lanes
+    AVX512,     // 16 lanes
+};
+
+const char* simdLevelName(SimdLevel level);
+
+// Parses the names returned by simdLevelName, returns false if name is none of them
+bool parseSimdLevel(const std::string& name, SimdLevel& level);
+
+// Widest instruction set supported by both the processor and the build
+SimdLevel detectSimdLevel();
+
+const int max_packet_lanes = 16;
+
+// Primary rays of a packet, all starting from the camera
+struct RayPacket {
+    glm::vec3 origin;
+    float dirX[max_packet_lanes];
+    float dirY[max_packet_lanes];
+    float dirZ[max_packet_lanes];
+    float tMin[max_packet_lanes];       // Distance along dir before which nothing can be hit
+    unsigned int lanes;     // Bit i set if lane i holds a ray
+};
+
+// Outputs of voxelTraversal for each lane of a packet
+struct PacketHits {
+    float t[max_packet_lanes];          // -1 if nothing is hit
+    GLuint color[max_packet_lanes];     // Packed rgb of the voxel hit
+    int mapX[max_packet_lanes];
+    int mapY[max_packet_lanes];
+    int mapZ[max_packet_lanes];
+    float through[max_packet_lanes];   // Coverage of the hit, see voxelTraversal
+};
+
+// Traces a packet like voxelTraversal traces each of its rays, adding steps and fetches to stats
+typedef void (*PacketKernel)(const NodePool& pool, const TraceSettings& settings, float footprint,
+                             const RayPacket& packet, PacketHits& hits, TraversalStats& stats);
+
+struct PacketTracer {
+    SimdLevel level;
+    int width;      // Pixels of a packet, lanes in row-major order
+    int height;
+    PacketKernel trace;     // Null for the scalar path
+};
+
+// Kernel of the widest instruction set not above level that the processor supports
+PacketTracer packetTracer(SimdLevel level);
+
+// Per instruction set kernels, null when the build does not include them
+PacketKernel packetKernelSSE4();
+PacketKernel packetKernelAVX2();
+PacketKernel packetKernelAVX512();
+
+#endif  // CPU_PACKET_HPP
@@ -0,0 +1,109 @@
+/*
+    cpu_packet_avx2.cpp
+    author: Telo PHILIPPE
+
+    8-lane packet traversal, built with AVX2 enabled.
+*/
+
+#include "cpu_packet.hpp"
+
+#if defined(__AVX2__)
+#define PACKET_AVX2
+
+#include <immintrin.h>
+
+#include "cpu_packet_kernel.hpp"
+
+namespace {
+
+struct AVX2 {
+    static const int width = 8;
+    typedef __m256 F;
+    typedef __m256i I;
+    typedef __m256i M;
+
+    static F set(float a) { return _mm256_set1_ps(a); }
+    static I seti(int a) { return _mm256_set1_epi32(a); }
+    static F loadf(const float* p) { return _mm256_loadu_ps(p); }
+    static void storef(float* p, F a) { _mm256_storeu_ps(p, a); }
+    static void storei(int* p, I a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a); }
+    static M fromBits(unsigned int bits) {
+        const I lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits)), lanes), lanes);
+    }
+    static unsigned int bits(M m) { return static_cast<unsigned int>(_mm256_movemask_ps(_mm256_castsi256_ps(m))); }
+
+    static F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+    static F abs(F a) { return _mm256_castsi256_ps(_mm256_and_si256(_mm256_castps_si256(a), _mm256_set1_epi32(0x7FFFFFFF))); }
+    static F floor(F a) { return _mm256_floor_ps(a); }
+    static F cvt(I a) { return _mm256_cvtepi32_ps(a); }
+    static I cvtt(F a) { return _mm256_cvttps_epi32(a); }
+
+    static M lt(F a, F b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+    static M le(F a, F b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+    static M ilt(I a, I b) { return _mm256_cmpgt_epi32(b, a); }
+    static M igt(I a, I b) { return _mm256_cmpgt_epi32(a, b); }
+    static M ieq(I a, I b) { return _mm256_cmpeq_epi32(a, b); }
+    static M mand(M a, M b) { return _mm256_and_si256(a, b); }
+    static M mor(M a, M b) { return _mm256_or_si256(a, b); }
+    static M mandnot(M a, M b) { return _mm256_andnot_si256(b, a); }
+    static M mnot(M a) { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+    static bool any(M m) { return !_mm256_testz_si256(m, m); }
+    static int count(M m) {
+        unsigned int b = bits(m);
+        int n = 0;
+        for (; b; b &= b - 1) n++;
+        return n;
+    }
+
+    static F sel(M m, F a, F b) { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(m)); }
+    static I seli(M m, I a, I b) { return _mm256_blendv_epi8(b, a, m); }
+    // Same operand order as std::min and std::max, so NaNs propagate alike
+    static F fmin(F a, F b) { return _mm256_min_ps(b, a); }
+    static F fmax(F a, F b) { return _mm256_max_ps(b, a); }
+    static I imin(I a, I b) { return _mm256_min_epi32(a, b); }
+    static I imax(I a, I b) { return _mm256_max_epi32(a, b); }
+
+    static I iadd(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I isub(I a, I b) { return _mm256_sub_epi32(a, b); }
+    static I iand(I a, I b) { return _mm256_and_si256(a, b); }
+    static I iandnot(I a, I b) { return _mm256_andnot_si256(b, a); }
+    static I ior(I a, I b) { return _mm256_or_si256(a, b); }
+    static I ixor(I a, I b) { return _mm256_xor_si256(a, b); }
+    static I srl(I a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static I sll(I a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+    static I srlv(I a, I n) { return _mm256_srlv_epi32(a, n); }
+
+    static I gather(const GLuint* base, I index, M m) {
+        return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(base), index, m, 4);
+    }
+
+    static F pow2(I a) { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(a, _mm256_set1_epi32(127)), 23)); }
+    static I bitLength(I a) { return _mm256_max_epi32(_mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(_mm256_cvtepi32_ps(a)), 23), _mm256_set1_epi32(126)), _mm256_setzero_si256()); }
+    static int hmin(I a) {
+        __m128i m = _mm_min_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+        m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(m);
+    }
+};
+
+void traceAVX2(const NodePool& pool, const TraceSettings& settings, float footprint, const RayPacket& packet, PacketHits& hits, TraversalStats& stats) {
+    tracePacket<AVX2>(pool, settings, footprint, packet, hits, stats);
+}
+
+}  // namespace
+
+#endif
+
+PacketKernel packetKernelAVX2() {
+#ifdef PACKET_AVX2
+    return traceAVX2;
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,101 @@
+/*
+    cpu_packet_avx512.cpp
+    author: Telo PHILIPPE
+
+    16-lane packet traversal, built with AVX-512F enabled.
+*/
+
+#include "cpu_packet.hpp"
+
+#if defined(__AVX512F__)
+#define PACKET_AVX512
+
+#include <immintrin.h>
+
+#include "cpu_packet_kernel.hpp"
+
+namespace {
+
+struct AVX512 {
+    static const int width = 16;
+    typedef __m512 F;
+    typedef __m512i I;
+    typedef __mmask16 M;
+
+    static F set(float a) { return _mm512_set1_ps(a); }
+    static I seti(int a) { return _mm512_set1_epi32(a); }
+    static F loadf(const float* p) { return _mm512_loadu_ps(p); }
+    static void storef(float* p, F a) { _mm512_storeu_ps(p, a); }
+    static void storei(int* p, I a) { _mm512_storeu_si512(p, a); }
+    static M fromBits(unsigned int bits) { return static_cast<M>(bits); }
+    static unsigned int bits(M m) { return m; }
+
+    static F add(F a, F b) { return _mm512_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm512_div_ps(a, b); }
+    static F sqrt(F a) { return _mm512_sqrt_ps(a); }
+    static F abs(F a) { return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_set1_epi32(0x7FFFFFFF))); }
+    static F floor(F a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    static F cvt(I a) { return _mm512_cvtepi32_ps(a); }
+    static I cvtt(F a) { return _mm512_cvttps_epi32(a); }
+
+    static M lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static M le(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static M ilt(I a, I b) { return _mm512_cmplt_epi32_mask(a, b); }
+    static M igt(I a, I b) { return _mm512_cmpgt_epi32_mask(a, b); }
+    static M ieq(I a, I b) { return _mm512_cmpeq_epi32_mask(a, b); }
+    static M mand(M a, M b) { return a & b; }
+    static M mor(M a, M b) { return a | b; }
+    static M mandnot(M a, M b) { return a & ~b; }
+    static M mnot(M a) { return static_cast<M>(~a); }
+    static bool any(M m) { return m != 0; }
+    static int count(M m) {
+        unsigned int b = m;
+        int n = 0;
+        for (; b; b &= b - 1) n++;
+        return n;
+    }
+
+    static F sel(M m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+    static I seli(M m, I a, I b) { return _mm512_mask_blend_epi32(m, b, a); }
+    // Same operand order as std::min and std::max, so NaNs propagate alike
+    static F fmin(F a, F b) { return _mm512_min_ps(b, a); }
+    static F fmax(F a, F b) { return _mm512_max_ps(b, a); }
+    static I imin(I a, I b) { return _mm512_min_epi32(a, b); }
+    static I imax(I a, I b) { return _mm512_max_epi32(a, b); }
+
+    static I iadd(I a, I b) { return _mm512_add_epi32(a, b); }
+    static I isub(I a, I b) { return _mm512_sub_epi32(a, b); }
+    static I iand(I a, I b) { return _mm512_and_si512(a, b); }
+    static I iandnot(I a, I b) { return _mm512_andnot_si512(b, a); }
+    static I ior(I a, I b) { return _mm512_or_si512(a, b); }
+    static I ixor(I a, I b) { return _mm512_xor_si512(a, b); }
+    static I srl(I a, int n) { return _mm512_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static I sll(I a, int n) { return _mm512_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+    static I srlv(I a, I n) { return _mm512_srlv_epi32(a, n); }
+
+    static I gather(const GLuint* base, I index, M m) {
+        return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m, index, base, 4);
+    }
+
+    static F pow2(I a) { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(a, _mm512_set1_epi32(127)), 23)); }
+    static I bitLength(I a) { return _mm512_max_epi32(_mm512_sub_epi32(_mm512_srli_epi32(_mm512_castps_si512(_mm512_cvtepi32_ps(a)), 23), _mm512_set1_epi32(126)), _mm512_setzero_si512()); }
+    static int hmin(I a) { return _mm512_reduce_min_epi32(a); }
+};
+
+void traceAVX512(const NodePool& pool, const TraceSettings& settings, float footprint, const RayPacket& packet, PacketHits& hits, TraversalStats& stats) {
+    tracePacket<AVX512>(pool, settings, footprint, packet, hits, stats);
+}
+
+}  // namespace
+
+#endif
+
+PacketKernel packetKernelAVX512() {
+#ifdef PACKET_AVX512
+    return traceAVX512;
+#else
+    return nullptr;
+#endif
+}
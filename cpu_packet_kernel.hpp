@@ -0,0 +1,428 @@
+/*
+    cpu_packet_kernel.hpp
+    author: Telo PHILIPPE
+
+    Packet version of voxelTraversal, written against a small set of vector operations S
+    provided by each instruction set translation unit. Every lane performs exactly the
+    operations of the scalar code, in the same order, so hits, colours and counters match.
+
+    Only include this from the cpu_packet_*.cpp files: it is compiled with their
+    instruction set flags, so it must not call inline functions shared with the rest of the
+    program (glm, std::), which the linker could pick in place of the portable ones.
+*/
+
+#ifndef CPU_PACKET_KERNEL_HPP
+#define CPU_PACKET_KERNEL_HPP
+
+#include "cpu_packet.hpp"
+
+// S provides, for vectors of S::width lanes:
+//   F (float), I (int), M (mask) types
+//   set, seti, loadf, storef, storei, fromBits and bits (lane masks as integers)
+//   add, sub, mul, div, sqrt, abs, floor, cvt (int to float), cvtt (float to int, truncating)
+//   lt, le (floats), ilt, igt, ieq (ints), mand, mor, mandnot (a & ~b), mnot, any, count
+//   sel, seli (m ? a : b), fmin, fmax (std::min and std::max semantics), imin, imax
+//   iadd, isub, iand, iandnot (a & ~b), ior, ixor, srl, sll (uniform counts), srlv (per lane
+//   counts, below 32)
+//   gather (masked lanes read base[index], others get 0), pow2 (2^i as a float),
+//   bitLength (bits needed to write non-negative i), hmin (smallest lane)
+
+// Bits set in each lane of 8-bit masks
+template <class S>
+typename S::I bitCount8(typename S::I m) {
+    m = S::isub(m, S::iand(S::srl(m, 1), S::seti(0x55)));
+    m = S::iadd(S::iand(m, S::seti(0x33)), S::iand(S::srl(m, 2), S::seti(0x33)));
+    return S::iand(S::iadd(m, S::srl(m, 4)), S::seti(0x0F));
+}
+
+// Bits set in each lane of 32-bit masks
+template <class S>
+typename S::I bitCount32(typename S::I m) {
+    m = S::isub(m, S::iand(S::srl(m, 1), S::seti(0x55555555)));
+    m = S::iadd(S::iand(m, S::seti(0x33333333)), S::iand(S::srl(m, 2), S::seti(0x33333333)));
+    m = S::iand(S::iadd(m, S::srl(m, 4)), S::seti(0x0F0F0F0F));
+    m = S::iadd(m, S::srl(m, 8));
+    m = S::iadd(m, S::srl(m, 16));
+    return S::iand(m, S::seti(0x3F));
+}
+
+// counter plus one on the lanes of m
+template <class S>
+typename S::I countLanes(typename S::I counter, typename S::M m) {
+    return S::iadd(counter, S::seli(m, S::seti(1), S::seti(0)));
+}
+
+// packedLeaf, entry being the entry holding leaf
+template <class S>
+typename S::I unpackLeaf(typename S::I entry, typename S::I leaf, int shift) {
+    if (shift == 0) return entry;
+    const int slotBits = 32 >> shift;
+    const typename S::I slot = S::iand(leaf, S::seti((1 << shift) - 1));
+    entry = S::srlv(entry, slotBits == 8 ? S::sll(slot, 3) : S::sll(slot, 4));
+    return S::ior(S::iand(entry, S::seti((1 << slotBits) - 1)), S::seti(value_flag));
+}
+
+// childEntry for block pools, on the reading lanes
+template <class S>
+typename S::I blockChildEntry(const NodePool& pool, typename S::I node, typename S::I child, typename S::M reading, typename S::I& next, typename S::I& fetches) {
+    typedef typename S::I I;
+    typedef typename S::M M;
+
+    const I mask = S::seti(address_mask);
+    const I cell = S::gather(pool.data, S::iadd(S::sll(node, 3), child), reading);
+    const I tag = S::iandnot(cell, mask);
+    const M isNear = S::mand(reading, S::ieq(tag, S::seti(address_flag)));
+    const M isFar = S::mand(reading, S::ieq(tag, S::seti(far_flag)));
+    next = S::iadd(node, S::isub(S::iand(cell, mask), S::seti(address_bias)));
+    if (S::any(isFar)) {
+        next = S::seli(isFar, S::gather(pool.far, S::iand(cell, mask), isFar), next);
+        fetches = countLanes<S>(fetches, isFar);
+    }
+    return S::seli(isFar, S::seti(address_flag), S::seli(isNear, S::seti(address_flag), cell));
+}
+
+// childEntry for compact pools, on the reading lanes
+template <class S>
+typename S::I compactChildEntry(const NodePool& pool, typename S::I node, typename S::I child, typename S::M reading, typename S::I& next, typename S::I& fetches) {
+    typedef typename S::I I;
+    typedef typename S::M M;
+
+    const GLuint* data = pool.data;
+    const I izero = S::seti(0);
+    const I masks = S::gather(data, node, reading);
+    const I children = S::gather(data, S::iadd(node, S::seti(1)), reading);
+    const I bit = S::cvtt(S::pow2(child));
+    const I below = S::isub(bit, S::seti(1));
+    const I leaves = S::iand(S::srl(masks, 8), S::seti(0xFF));
+    const I interior = S::iandnot(S::iand(masks, S::seti(0xFF)), leaves);
+    const M isLeaf = S::mandnot(reading, S::ieq(S::iand(leaves, bit), izero));
+    const M isInterior = S::mandnot(reading, S::ieq(S::iand(interior, bit), izero));
+
+    // Descriptors are compact_descriptor_size = 3 entries long
+    const I interiorBefore = bitCount8<S>(S::iand(interior, below));
+    const I interiorCount = bitCount8<S>(interior);
+    next = S::iadd(children, S::iadd(S::sll(interiorBefore, 1), interiorBefore));
+    const I leaf = bitCount8<S>(S::iand(leaves, below));
+    const I leafEntries = S::iadd(children, S::iadd(S::sll(interiorCount, 1), interiorCount));
+    // Palette indices are packed 1 << shift per entry (compactLeafShift), 8 or 16 bits each
+    const int shift = pool.paletteSize == 0 ? 0 : (pool.paletteSize <= compact_byte_palette_size ? 2 : 1);
+    const I color = unpackLeaf<S>(S::gather(data, S::iadd(leafEntries, S::srl(leaf, shift)), isLeaf), leaf, shift);
+    fetches = countLanes<S>(fetches, isLeaf);
+    return S::seli(isLeaf, color, S::seli(isInterior, S::seti(address_flag), izero));
+}
+
+// brickEntry for voxel (x, y, z) of brick, on the reading lanes. level is set to the level the
+// lookup stops at.
+template <class S>
+typename S::I brickEntry(const NodePool& pool, typename S::I brick, typename S::I x, typename S::I y, typename S::I z, typename S::M reading,
+                         typename S::I& level, typename S::I& fetches) {
+    typedef typename S::I I;
+    typedef typename S::M M;
+
+    const I izero = S::seti(0);
+    const I ione = S::seti(1);
+    I m = izero;
+    for (int c = brick_levels - 1; c >= 0; c--) {
+        const I child = S::ior(S::ior(S::iand(S::srl(x, c), ione), S::sll(S::iand(S::srl(y, c), ione), 1)), S::sll(S::iand(S::srl(z, c), ione), 2));
+        m = S::ior(S::sll(m, 3), child);
+    }
+    const I base = S::sll(brick, 3);
+    const I w = S::srl(m, 5);
+    const I bit = S::iand(m, S::seti(31));
+    const I mask = S::gather(pool.data, S::iadd(base, w), reading);
+    fetches = countLanes<S>(fetches, reading);
+
+    const I shifted = S::srlv(mask, bit);
+    const I byte = S::srlv(mask, S::iand(bit, S::seti(24)));
+    const M solid = S::mandnot(reading, S::ieq(S::iand(shifted, ione), izero));
+    const M byteEmpty = S::mand(S::mandnot(reading, solid), S::ieq(S::iand(byte, S::seti(0xFF)), izero));
+    const I partner = S::gather(pool.data, S::iadd(base, S::ixor(w, ione)), byteEmpty);
+    fetches = countLanes<S>(fetches, byteEmpty);
+    const M octantEmpty = S::mand(byteEmpty, S::ieq(S::ior(mask, partner), izero));
+    level = S::isub(S::seti(pool.depth - 1), S::iadd(S::seli(byteEmpty, ione, izero), S::seli(octantEmpty, ione, izero)));
+
+    // Solid voxels before the octant, then before the voxel within it
+    const M odd = S::mandnot(solid, S::ieq(S::iand(w, ione), izero));
+    const I prefixes = S::gather(pool.data, S::iadd(base, S::iadd(S::seti(brick_mask_words), S::srl(w, 2))), solid);
+    const I lower = S::gather(pool.data, S::isub(S::iadd(base, w), ione), odd);
+    fetches = countLanes<S>(countLanes<S>(countLanes<S>(fetches, solid), solid), odd);
+    const M upperHalf = S::mnot(S::ieq(S::iand(w, S::seti(2)), izero));
+    I leaf = S::iand(S::seli(upperHalf, S::srl(prefixes, 16), prefixes), S::seti(0xFFFF));
+    leaf = S::iadd(leaf, S::iadd(bitCount32<S>(lower), S::isub(bitCount32<S>(mask), bitCount32<S>(shifted))));
+
+    const int shift = pool.paletteSize == 0 ? 0 : (pool.paletteSize <= compact_byte_palette_size ? 2 : 1);
+    const I entry = S::gather(pool.data, S::iadd(S::iadd(base, S::seti(brick_header_size)), S::srl(leaf, shift)), solid);
+    return S::seli(solid, unpackLeaf<S>(entry, leaf, shift), izero);
+}
+
+template <class S>
+void tracePacket(const NodePool& pool, const TraceSettings& settings, float footprint,
+                 const RayPacket& packet, PacketHits& hits, TraversalStats& stats) {
+    typedef typename S::F F;
+    typedef typename S::I I;
+    typedef typename S::M M;
+
+    const int depth = pool.depth;
+    const int mapSize = 1 << depth;
+
+    const F zero = S::set(0.0f);
+    const F one = S::set(1.0f);
+    const I izero = S::seti(0);
+    const I ione = S::seti(1);
+    const I isize = S::seti(mapSize);
+    const I valueMask = S::seti(value_mask);
+    const bool compact = pool.format == NodeFormat::Compact;
+    const bool ranked = pool.ranks != nullptr;
+    const int bricks = pool.bricks && depth >= brick_levels ? depth - brick_levels : -1;
+    const bool filtered = compact || pool.lod || ranked;
+
+    M active = S::fromBits(packet.lanes);
+
+    const F origX = S::set(packet.origin.x);
+    const F origY = S::set(packet.origin.y);
+    const F origZ = S::set(packet.origin.z);
+    const F dirX = S::loadf(packet.dirX);
+    const F dirY = S::loadf(packet.dirY);
+    const F dirZ = S::loadf(packet.dirZ);
+
+    // projectToCube
+    const F size = S::set(static_cast<float>(mapSize));
+    F tx = S::fmax(S::fmin(S::div(S::sub(zero, origX), dirX), S::div(S::sub(size, origX), dirX)), zero);
+    F ty = S::fmax(S::fmin(S::div(S::sub(zero, origY), dirY), S::div(S::sub(size, origY), dirY)), zero);
+    F tz = S::fmax(S::fmin(S::div(S::sub(zero, origZ), dirZ), S::div(S::sub(size, origZ), dirZ)), zero);
+    const F t1 = S::fmax(S::sub(S::fmax(S::fmax(tx, S::fmax(ty, tz)), S::loadf(packet.tMin)), S::set(0.001f)), zero);
+
+    const F originX = S::add(origX, S::mul(t1, dirX));
+    const F originY = S::add(origY, S::mul(t1, dirY));
+    const F originZ = S::add(origZ, S::mul(t1, dirZ));
+
+    I mapX = S::cvtt(S::floor(originX));
+    I mapY = S::cvtt(S::floor(originY));
+    I mapZ = S::cvtt(S::floor(originZ));
+
+    const F deltaDX = S::abs(S::div(one, dirX));
+    const F deltaDY = S::abs(S::div(one, dirY));
+    const F deltaDZ = S::abs(S::div(one, dirZ));
+
+    const M negX = S::lt(dirX, zero);
+    const M negY = S::lt(dirY, zero);
+    const M negZ = S::lt(dirZ, zero);
+    const M posX = S::mnot(negX);
+    const M posY = S::mnot(negY);
+    const M posZ = S::mnot(negZ);
+    const I stepX = S::seli(negX, S::seti(-1), ione);
+    const I stepY = S::seli(negY, S::seti(-1), ione);
+    const I stepZ = S::seli(negZ, S::seti(-1), ione);
+
+    F sideDistX = S::sel(negX, S::mul(S::sub(originX, S::cvt(mapX)), deltaDX), S::mul(S::sub(S::add(S::cvt(mapX), one), originX), deltaDX));
+    F sideDistY = S::sel(negY, S::mul(S::sub(originY, S::cvt(mapY)), deltaDY), S::mul(S::sub(S::add(S::cvt(mapY), one), originY), deltaDY));
+    F sideDistZ = S::sel(negZ, S::mul(S::sub(originZ, S::cvt(mapZ)), deltaDZ), S::mul(S::sub(S::add(S::cvt(mapZ), one), originZ), deltaDZ));
+
+    I side = izero;
+    M skipped = S::fromBits(0);
+    F through = one;
+    F perpWallDist = S::set(-1.0f);
+    I hitColor = izero;
+
+    // One OctreePath per lane
+    I pathNodes[max_octree_depth];
+    I pathRanks[max_octree_depth];
+    for (int l = 0; l < max_octree_depth; l++) pathNodes[l] = pathRanks[l] = izero;
+    I pathLevels = izero;
+    I pathX = izero;
+    I pathY = izero;
+    I pathZ = izero;
+
+    // Counted per lane, summed once the packet is done
+    I steps = izero;
+    I fetches = izero;
+
+    for (int i = 0; i < 3 * mapSize + 3; i++) {
+        M leaving = S::mor(S::mor(S::mand(S::mnot(S::ilt(mapX, isize)), posX), S::mand(S::mnot(S::ilt(mapY, isize)), posY)), S::mand(S::mnot(S::ilt(mapZ, isize)), posZ));
+        leaving = S::mor(leaving, S::mor(S::mor(S::mand(S::ilt(mapX, izero), negX), S::mand(S::ilt(mapY, izero), negY)), S::mand(S::ilt(mapZ, izero), negZ)));
+        active = S::mandnot(active, leaving);
+        if (!S::any(active)) break;
+
+        // DDA step, except for lanes already standing in the next voxel after a skip
+        const M moving = S::mandnot(active, skipped);
+        const M alongX = S::mand(S::lt(sideDistX, sideDistY), S::lt(sideDistX, sideDistZ));
+        const M alongY = S::mand(S::lt(sideDistY, sideDistX), S::lt(sideDistY, sideDistZ));
+        const M alongZ = S::mnot(S::mor(alongX, alongY));
+        const M moveX = S::mand(moving, alongX);
+        const M moveY = S::mand(moving, alongY);
+        const M moveZ = S::mand(moving, alongZ);
+        sideDistX = S::sel(moveX, S::add(sideDistX, deltaDX), sideDistX);
+        sideDistY = S::sel(moveY, S::add(sideDistY, deltaDY), sideDistY);
+        sideDistZ = S::sel(moveZ, S::add(sideDistZ, deltaDZ), sideDistZ);
+        mapX = S::seli(moveX, S::iadd(mapX, stepX), mapX);
+        mapY = S::seli(moveY, S::iadd(mapY, stepY), mapY);
+        mapZ = S::seli(moveZ, S::iadd(mapZ, stepZ), mapZ);
+        side = S::seli(moveX, izero, S::seli(moveY, ione, S::seli(moveZ, S::seti(2), side)));
+        skipped = S::fromBits(0);
+
+        if (!settings.resumeLookups) pathLevels = izero;
+
+        F lodSize = zero;
+        if (footprint > 0) {
+            const F half = S::set(0.5f);
+            F vx = S::sub(S::add(S::cvt(mapX), half), origX);
+            F vy = S::sub(S::add(S::cvt(mapY), half), origY);
+            F vz = S::sub(S::add(S::cvt(mapZ), half), origZ);
+            lodSize = S::mul(S::set(footprint), S::sqrt(S::add(S::add(S::mul(vx, vx), S::mul(vy, vy)), S::mul(vz, vz))));
+        }
+
+        // sampleOctree, descending all lanes together from the shallowest resumed level
+        const M inside = S::mand(active, S::mand(S::mand(S::mand(S::mnot(S::ilt(mapX, izero)), S::mnot(S::ilt(mapY, izero))), S::mand(S::mnot(S::ilt(mapZ, izero)), S::ilt(mapX, isize))), S::mand(S::ilt(mapY, isize), S::ilt(mapZ, isize))));
+
+        const I diff = S::ior(S::ior(S::ixor(mapX, pathX), S::ixor(mapY, pathY)), S::ixor(mapZ, pathZ));
+        const I start = S::seli(S::igt(pathLevels, izero), S::imin(S::isub(S::seti(depth), S::bitLength(diff)), S::isub(pathLevels, ione)), izero);
+        pathX = S::seli(inside, mapX, pathX);
+        pathY = S::seli(inside, mapY, pathY);
+        pathZ = S::seli(inside, mapZ, pathZ);
+
+        const int firstLevel = S::hmin(S::seli(inside, start, S::seti(depth)));
+
+        I level = izero;
+        I color = izero;
+        I occupancy = S::seti(255);
+        I node = izero;
+        I rank = izero;
+        M walking = inside;
+        for (int l = firstLevel; l < depth && S::any(walking); l++) {
+            const I il = S::seti(l);
+            const M resuming = S::mand(walking, S::ieq(start, il));
+            node = S::seli(resuming, pathNodes[l], node);
+            rank = S::seli(resuming, pathRanks[l], rank);
+            const M reading = S::mandnot(walking, S::igt(start, il));
+            if (!S::any(reading)) continue;
+            pathNodes[l] = S::seli(reading, node, pathNodes[l]);
+            pathRanks[l] = S::seli(reading, rank, pathRanks[l]);
+            pathLevels = S::seli(reading, S::seti(l + 1), pathLevels);
+
+            if (l == bricks) {
+                I brickLevel;
+                const I cell = brickEntry<S>(pool, node, mapX, mapY, mapZ, reading, brickLevel, fetches);
+                const M isValue = S::mandnot(reading, S::ieq(cell, izero));
+                const I value = S::iand(cell, valueMask);
+                color = S::seli(isValue, pool.palette ? S::gather(pool.palette, value, isValue) : value, color);
+                level = S::seli(reading, brickLevel, level);
+                walking = S::mandnot(walking, reading);
+                continue;
+            }
+
+            const int c = depth - l - 1;
+            const I child = S::ior(S::ior(S::iand(S::srl(mapX, c), ione), S::sll(S::iand(S::srl(mapY, c), ione), 1)), S::sll(S::iand(S::srl(mapZ, c), ione), 2));
+            I next;
+            const I cell = compact ? compactChildEntry<S>(pool, node, child, reading, next, fetches)
+                                   : blockChildEntry<S>(pool, node, child, reading, next, fetches);
+            fetches = countLanes<S>(fetches, reading);
+            if (ranked) {
+                rank = S::iadd(rank, S::gather(pool.ranks, S::iadd(S::sll(node, 3), child), reading));
+                fetches = countLanes<S>(fetches, reading);
+            }
+
+            const I tag = S::iandnot(cell, valueMask);
+            const M isValue = S::mand(reading, S::ieq(tag, S::seti(value_flag)));
+            const M isAddress = S::mand(reading, S::ieq(cell, S::seti(address_flag)));
+            M stop = S::mandnot(reading, isAddress);
+            I value = S::iand(cell, valueMask);
+            if (ranked) {
+                value = S::iand(S::gather(pool.attributes, rank, isValue), valueMask);
+                fetches = countLanes<S>(fetches, isValue);
+            }
+            color = S::seli(isValue, pool.palette ? S::gather(pool.palette, value, isValue) : value, color);
+            node = S::seli(isAddress, next, node);
+
+            if (filtered) {
+                const M coarse = S::mand(isAddress, S::le(S::set(static_cast<float>(1 << c)), lodSize));
+                if (S::any(coarse)) {
+                    I entry;
+                    if (ranked) {
+                        // Colour of the first leaf of the node, see lodEntry
+                        entry = S::iand(S::gather(pool.attributes, rank, coarse), valueMask);
+                        if (pool.palette) entry = S::gather(pool.palette, entry, coarse);
+                    } else {
+                        entry = compact ? S::gather(pool.data, S::iadd(node, S::seti(2)), coarse) : S::gather(pool.lod, node, coarse);
+                    }
+                    fetches = countLanes<S>(fetches, coarse);
+                    color = S::seli(coarse, S::iand(entry, valueMask), color);
+                    if (!ranked) occupancy = S::seli(coarse, S::srl(entry, lod_occupancy_shift), occupancy);
+                    stop = S::mor(stop, coarse);
+                }
+            }
+            level = S::seli(stop, il, level);
+            walking = S::mandnot(walking, stop);
+        }
+        level = S::seli(walking, S::seti(depth), level);
+
+        steps = countLanes<S>(steps, active);
+        through = S::sel(active, S::div(S::cvt(occupancy), S::set(255.0f)), through);
+
+        const M hit = S::mandnot(active, S::ieq(color, izero));
+        if (S::any(hit)) {
+            const F wallX = S::add(S::div(S::add(S::sub(S::cvt(mapX), originX), S::sel(negX, one, zero)), dirX), t1);
+            const F wallY = S::add(S::div(S::add(S::sub(S::cvt(mapY), originY), S::sel(negY, one, zero)), dirY), t1);
+            const F wallZ = S::add(S::div(S::add(S::sub(S::cvt(mapZ), originZ), S::sel(negZ, one, zero)), dirZ), t1);
+            const F wall = S::sel(S::ieq(side, izero), wallX, S::sel(S::ieq(side, ione), wallY, wallZ));
+            perpWallDist = S::sel(hit, wall, perpWallDist);
+            hitColor = S::seli(hit, color, hitColor);
+            active = S::mandnot(active, hit);
+        }
+
+        // The lookup stopped on an empty child at level + 1: jump over the whole cell
+        if (!settings.skipEmpty) continue;
+        const I cellSize = S::cvtt(S::pow2(S::isub(S::seti(depth - 1), level)));
+        const M skip = S::mand(S::mand(active, inside), S::igt(cellSize, ione));
+        if (!S::any(skip)) continue;
+
+        const I cellMask = S::isub(cellSize, ione);
+        const I cellMinX = S::iandnot(mapX, cellMask);
+        const I cellMinY = S::iandnot(mapY, cellMask);
+        const I cellMinZ = S::iandnot(mapZ, cellMask);
+
+        const F exitX = S::div(S::sub(S::cvt(S::seli(posX, S::iadd(cellMinX, cellSize), cellMinX)), originX), dirX);
+        const F exitY = S::div(S::sub(S::cvt(S::seli(posY, S::iadd(cellMinY, cellSize), cellMinY)), originY), dirY);
+        const F exitZ = S::div(S::sub(S::cvt(S::seli(posZ, S::iadd(cellMinZ, cellSize), cellMinZ)), originZ), dirZ);
+
+        const M exitsX = S::mand(S::lt(exitX, exitY), S::lt(exitX, exitZ));
+        const M exitsY = S::mand(S::lt(exitY, exitX), S::lt(exitY, exitZ));
+        const M exitsZ = S::mnot(S::mor(exitsX, exitsY));
+        const F exitT = S::sel(exitsX, exitX, S::sel(exitsY, exitY, exitZ));
+
+        // Voxel where the ray leaves the cell, kept inside it on the axes it does not cross
+        const I exitMapX = S::imin(S::imax(S::cvtt(S::floor(S::add(originX, S::mul(exitT, dirX)))), cellMinX), S::iadd(cellMinX, cellMask));
+        const I exitMapY = S::imin(S::imax(S::cvtt(S::floor(S::add(originY, S::mul(exitT, dirY)))), cellMinY), S::iadd(cellMinY, cellMask));
+        const I exitMapZ = S::imin(S::imax(S::cvtt(S::floor(S::add(originZ, S::mul(exitT, dirZ)))), cellMinZ), S::iadd(cellMinZ, cellMask));
+        const I crossX = S::seli(posX, S::iadd(cellMinX, cellSize), S::isub(cellMinX, ione));
+        const I crossY = S::seli(posY, S::iadd(cellMinY, cellSize), S::isub(cellMinY, ione));
+        const I crossZ = S::seli(posZ, S::iadd(cellMinZ, cellSize), S::isub(cellMinZ, ione));
+
+        mapX = S::seli(skip, S::seli(exitsX, crossX, exitMapX), mapX);
+        mapY = S::seli(skip, S::seli(exitsY, crossY, exitMapY), mapY);
+        mapZ = S::seli(skip, S::seli(exitsZ, crossZ, exitMapZ), mapZ);
+        side = S::seli(skip, S::seli(exitsX, izero, S::seli(exitsY, ione, S::seti(2))), side);
+
+        sideDistX = S::sel(skip, S::div(S::sub(S::add(S::cvt(mapX), S::sel(posX, one, zero)), originX), dirX), sideDistX);
+        sideDistY = S::sel(skip, S::div(S::sub(S::add(S::cvt(mapY), S::sel(posY, one, zero)), originY), dirY), sideDistY);
+        sideDistZ = S::sel(skip, S::div(S::sub(S::add(S::cvt(mapZ), S::sel(posZ, one, zero)), originZ), dirZ), sideDistZ);
+        skipped = skip;
+    }
+
+    S::storef(hits.t, perpWallDist);
+    S::storei(reinterpret_cast<int*>(hits.color), hitColor);
+    S::storei(hits.mapX, mapX);
+    S::storei(hits.mapY, mapY);
+    S::storei(hits.mapZ, mapZ);
+    S::storef(hits.through, through);
+
+    int laneSteps[max_packet_lanes];
+    int laneFetches[max_packet_lanes];
+    S::storei(laneSteps, steps);
+    S::storei(laneFetches, fetches);
+    for (int lane = 0; lane < S::width; lane++) {
+        stats.steps += laneSteps[lane];
+        stats.fetches += laneFetches[lane];
+    }
+}
+
+#endif  // CPU_PACKET_KERNEL_HPP
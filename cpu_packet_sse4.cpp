@@ -0,0 +1,117 @@
+/*
+    cpu_packet_sse4.cpp
+    author: Telo PHILIPPE
+
+    4-lane packet traversal, built with SSE4.1 enabled.
+*/
+
+#include "cpu_packet.hpp"
+
+#if defined(__SSE4_1__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#define PACKET_SSE4
+
+#include <smmintrin.h>
+
+#include "cpu_packet_kernel.hpp"
+
+namespace {
+
+struct SSE4 {
+    static const int width = 4;
+    typedef __m128 F;
+    typedef __m128i I;
+    typedef __m128i M;
+
+    static F set(float a) { return _mm_set1_ps(a); }
+    static I seti(int a) { return _mm_set1_epi32(a); }
+    static F loadf(const float* p) { return _mm_loadu_ps(p); }
+    static void storef(float* p, F a) { _mm_storeu_ps(p, a); }
+    static void storei(int* p, I a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a); }
+    static M fromBits(unsigned int bits) {
+        const I lanes = _mm_setr_epi32(1, 2, 4, 8);
+        return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(bits)), lanes), lanes);
+    }
+    static unsigned int bits(M m) { return static_cast<unsigned int>(_mm_movemask_ps(_mm_castsi128_ps(m))); }
+
+    static F add(F a, F b) { return _mm_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm_div_ps(a, b); }
+    static F sqrt(F a) { return _mm_sqrt_ps(a); }
+    static F abs(F a) { return _mm_castsi128_ps(_mm_and_si128(_mm_castps_si128(a), _mm_set1_epi32(0x7FFFFFFF))); }
+    static F floor(F a) { return _mm_floor_ps(a); }
+    static F cvt(I a) { return _mm_cvtepi32_ps(a); }
+    static I cvtt(F a) { return _mm_cvttps_epi32(a); }
+
+    static M lt(F a, F b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+    static M le(F a, F b) { return _mm_castps_si128(_mm_cmple_ps(a, b)); }
+    static M ilt(I a, I b) { return _mm_cmplt_epi32(a, b); }
+    static M igt(I a, I b) { return _mm_cmpgt_epi32(a, b); }
+    static M ieq(I a, I b) { return _mm_cmpeq_epi32(a, b); }
+    static M mand(M a, M b) { return _mm_and_si128(a, b); }
+    static M mor(M a, M b) { return _mm_or_si128(a, b); }
+    static M mandnot(M a, M b) { return _mm_andnot_si128(b, a); }
+    static M mnot(M a) { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+    static bool any(M m) { return bits(m) != 0; }
+    static int count(M m) {
+        static const int counts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+        return counts[bits(m)];
+    }
+
+    static F sel(M m, F a, F b) { return _mm_blendv_ps(b, a, _mm_castsi128_ps(m)); }
+    static I seli(M m, I a, I b) { return _mm_blendv_epi8(b, a, m); }
+    // Same operand order as std::min and std::max, so NaNs propagate alike
+    static F fmin(F a, F b) { return _mm_min_ps(b, a); }
+    static F fmax(F a, F b) { return _mm_max_ps(b, a); }
+    static I imin(I a, I b) { return _mm_min_epi32(a, b); }
+    static I imax(I a, I b) { return _mm_max_epi32(a, b); }
+
+    static I iadd(I a, I b) { return _mm_add_epi32(a, b); }
+    static I isub(I a, I b) { return _mm_sub_epi32(a, b); }
+    static I iand(I a, I b) { return _mm_and_si128(a, b); }
+    static I iandnot(I a, I b) { return _mm_andnot_si128(b, a); }
+    static I ior(I a, I b) { return _mm_or_si128(a, b); }
+    static I ixor(I a, I b) { return _mm_xor_si128(a, b); }
+    static I srl(I a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static I sll(I a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+    // No variable shifts before AVX2: each count is applied to the whole vector, its lane kept
+    static I srlv(I a, I n) {
+        I r = _mm_srl_epi32(a, _mm_cvtsi32_si128(_mm_cvtsi128_si32(n)));
+        r = _mm_blend_epi16(r, _mm_srl_epi32(a, _mm_cvtsi32_si128(_mm_extract_epi32(n, 1))), 0x0C);
+        r = _mm_blend_epi16(r, _mm_srl_epi32(a, _mm_cvtsi32_si128(_mm_extract_epi32(n, 2))), 0x30);
+        return _mm_blend_epi16(r, _mm_srl_epi32(a, _mm_cvtsi32_si128(_mm_extract_epi32(n, 3))), 0xC0);
+    }
+
+    // No gather instruction before AVX2
+    static I gather(const GLuint* base, I index, M m) {
+        int indices[width], values[width];
+        storei(indices, index);
+        const unsigned int active = bits(m);
+        for (int i = 0; i < width; i++) values[i] = (active >> i & 1) ? static_cast<int>(base[indices[i]]) : 0;
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+    }
+
+    static F pow2(I a) { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(a, _mm_set1_epi32(127)), 23)); }
+    static I bitLength(I a) { return _mm_max_epi32(_mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(_mm_cvtepi32_ps(a)), 23), _mm_set1_epi32(126)), _mm_setzero_si128()); }
+    static int hmin(I a) {
+        a = _mm_min_epi32(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+        a = _mm_min_epi32(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(a);
+    }
+};
+
+void traceSSE4(const NodePool& pool, const TraceSettings& settings, float footprint, const RayPacket& packet, PacketHits& hits, TraversalStats& stats) {
+    tracePacket<SSE4>(pool, settings, footprint, packet, hits, stats);
+}
+
+}  // namespace
+
+#endif
+
+PacketKernel packetKernelSSE4() {
+#ifdef PACKET_SSE4
+    return traceSSE4;
+#else
+    return nullptr;
+#endif
+}
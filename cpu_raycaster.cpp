@@ -0,0 +1,428 @@
+/*
+    cpu_raycaster.cpp
+    author: Telo PHILIPPE
+
+    Implementation of the CPU reference ray caster. Keep in sync with
+    resources/fragmentShader.glsl.
+*/
+
+#include "cpu_raycaster.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+static const glm::vec3 lightDir = glm::normalize(glm::vec3(1, 2, -0.5));
+
+float projectToCube(const NodePool& pool, glm::vec3 ro, glm::vec3 rd) {
+    const float mapSize = static_cast<float>(1 << pool.depth);
+
+    float tx1 = (0 - ro.x) / rd.x;
+    float tx2 = (mapSize - ro.x) / rd.x;
+
+    float ty1 = (0 - ro.y) / rd.y;
+    float ty2 = (mapSize - ro.y) / rd.y;
+
+    float tz1 = (0 - ro.z) / rd.z;
+    float tz2 = (mapSize - ro.z) / rd.z;
+
+    float tx = std::max(std::min(tx1, tx2), 0.0f);
+    float ty = std::max(std::min(ty1, ty2), 0.0f);
+    float tz = std::max(std::min(tz1, tz2), 0.0f);
+
+    float t = std::max(tx, std::max(ty, tz));
+
+    return t;
+}
+
+float lodFootprint(const TraceSettings& settings, const Camera& camera, int imageHeight) {
+    if (!settings.levelOfDetail || imageHeight <= 0) return 0.0f;
+    return 2.0f * std::tan(glm::radians(camera.getFov()) * 0.5f) / imageHeight;
+}
+
+float voxelTraversal(const NodePool& pool, const TraceSettings& settings, float footprint, glm::vec3 orig, glm::vec3 direction, float tMin, glm::vec3& normal, Voxel& vox, int& mapX, int& mapY, int& mapZ, float& through, TraversalStats* stats) {
+    const int mapSize = 1 << pool.depth;
+
+    through = 1;
+    glm::vec3 origin = orig;
+
+    float t1 = std::max(std::max(projectToCube(pool, origin, direction), tMin) - 0.001f, 0.0f);
+    origin += t1 * direction;
+
+    mapX = static_cast<int>(std::floor(origin.x));
+    mapY = static_cast<int>(std::floor(origin.y));
+    mapZ = static_cast<int>(std::floor(origin.z));
+
+    float sideDistX;
+    float sideDistY;
+    float sideDistZ;
+
+    float deltaDX = std::abs(1 / direction.x);
+    float deltaDY = std::abs(1 / direction.y);
+    float deltaDZ = std::abs(1 / direction.z);
+    float perpWallDist = -1;
+
+    int stepX;
+    int stepY;
+    int stepZ;
+
+    int side = 0;
+
+    if (direction.x < 0) {
+        stepX = -1;
+        sideDistX = (origin.x - mapX) * deltaDX;
+    } else {
+        stepX = 1;
+        sideDistX = (mapX + 1.0f - origin.x) * deltaDX;
+    }
+    if (direction.y < 0) {
+        stepY = -1;
+        sideDistY = (origin.y - mapY) * deltaDY;
+    } else {
+        stepY = 1;
+        sideDistY = (mapY + 1.0f - origin.y) * deltaDY;
+    }
+    if (direction.z < 0) {
+        stepZ = -1;
+        sideDistZ = (origin.z - mapZ) * deltaDZ;
+    } else {
+        stepZ = 1;
+        sideDistZ = (mapZ + 1.0f - origin.z) * deltaDZ;
+    }
+
+    int step = 1;
+    bool skipped = false;
+
+    OctreePath path;
+    uint64_t fetches = 0;
+
+    // Every iteration moves forward on at least one axis, so this bound is never reached inside the volume
+    for (int i = 0; i < 3 * mapSize + 3; i++) {
+        if ((mapX >= mapSize && stepX > 0) || (mapY >= mapSize && stepY > 0) || (mapZ >= mapSize && stepZ > 0)) break;
+        if ((mapX < 0 && stepX < 0) || (mapY < 0 && stepY < 0) || (mapZ < 0 && stepZ < 0)) break;
+
+        // After a skip the ray already stands in the next voxel
+        if (!skipped) {
+            if (sideDistX < sideDistY && sideDistX < sideDistZ) {
+                sideDistX += deltaDX;
+                mapX += stepX * step;
+                side = 0;
+            } else if (sideDistY < sideDistX && sideDistY < sideDistZ) {
+                sideDistY += deltaDY;
+                mapY += stepY * step;
+                side = 1;
+            } else {
+                sideDistZ += deltaDZ;
+                mapZ += stepZ * step;
+                side = 2;
+            }
+        }
+        skipped = false;
+
+        if (!settings.resumeLookups) path.levels = 0;
+
+        // Width of a pixel at the distance of the voxel
+        float lodSize = footprint > 0 ? footprint * glm::length(glm::vec3(mapX, mapY, mapZ) + 0.5f - orig) : 0.0f;
+
+        int depth;
+        Voxel block = sampleOctree(pool, path, mapX, mapY, mapZ, lodSize, depth, through, fetches);
+        if (stats) stats->steps++;
+        if (glm::length(block.color) > 0) {
+            if (side == 0) {
+                perpWallDist = (mapX - origin.x + (1 - stepX * step) / 2) / direction.x + t1;
+                normal = glm::vec3(1, 0, 0) * static_cast<float>(-stepX);
+            } else if (side == 1) {
+                perpWallDist = (mapY - origin.y + (1 - stepY * step) / 2) / direction.y + t1;
+                normal = glm::vec3(0, 1, 0) * static_cast<float>(-stepY);
+            } else {
+                perpWallDist = (mapZ - origin.z + (1 - stepZ * step) / 2) / direction.z + t1;
+                normal = glm::vec3(0, 0, 1) * static_cast<float>(-stepZ);
+            }
+            vox = block;
+            break;
+        }
+
+        // The lookup stopped on an empty child at level depth + 1: jump over the whole cell
+        int cellSize = 1 << (pool.depth - depth - 1);
+        if (settings.skipEmpty && cellSize > 1 && mapX >= 0 && mapY >= 0 && mapZ >= 0 && mapX < mapSize && mapY < mapSize && mapZ < mapSize) {
+            glm::ivec3 cellMin = glm::ivec3(mapX, mapY, mapZ) & ~(cellSize - 1);
+
+            float exitX = ((stepX > 0 ? cellMin.x + cellSize : cellMin.x) - origin.x) / direction.x;
+            float exitY = ((stepY > 0 ? cellMin.y + cellSize : cellMin.y) - origin.y) / direction.y;
+            float exitZ = ((stepZ > 0 ? cellMin.z + cellSize : cellMin.z) - origin.z) / direction.z;
+
+            float exitT;
+            if (exitX < exitY && exitX < exitZ) {
+                exitT = exitX;
+                side = 0;
+            } else if (exitY < exitX && exitY < exitZ) {
+                exitT = exitY;
+                side = 1;
+            } else {
+                exitT = exitZ;
+                side = 2;
+            }
+
+            // Voxel where the ray leaves the cell, kept inside it on the axes it does not cross
+            glm::vec3 exitPos = origin + exitT * direction;
+            glm::ivec3 cellMax = cellMin + (cellSize - 1);
+            mapX = side == 0 ? (stepX > 0 ? cellMin.x + cellSize : cellMin.x - 1) : glm::clamp(static_cast<int>(std::floor(exitPos.x)), cellMin.x, cellMax.x);
+            mapY = side == 1 ? (stepY > 0 ? cellMin.y + cellSize : cellMin.y - 1) : glm::clamp(static_cast<int>(std::floor(exitPos.y)), cellMin.y, cellMax.y);
+            mapZ = side == 2 ? (stepZ > 0 ? cellMin.z + cellSize : cellMin.z - 1) : glm::clamp(static_cast<int>(std::floor(exitPos.z)), cellMin.z, cellMax.z);
+
+            sideDistX = (mapX + (stepX > 0 ? 1.0f : 0.0f) - origin.x) / direction.x;
+            sideDistY = (mapY + (stepY > 0 ? 1.0f : 0.0f) - origin.y) / direction.y;
+            sideDistZ = (mapZ + (stepZ > 0 ? 1.0f : 0.0f) - origin.z) / direction.z;
+            skipped = true;
+        }
+    }
+    if (stats) stats->fetches += fetches;
+    return perpWallDist;
+}
+
+void primaryRay(const glm::mat4& invViewMat, const glm::mat4& invProjMat, glm::vec2 screenPos, glm::vec3& rayOrigin, glm::vec3& rayDir) {
+    glm::vec4 clip = glm::vec4(screenPos, -1.0f, 1.0f);
+    glm::vec4 eye = glm::vec4(glm::vec2(invProjMat * clip), -1.0f, 0.0f);
+    rayDir = glm::vec3(invViewMat * eye);
+    rayOrigin = glm::vec3(invViewMat[3]);
+}
+
+glm::vec3 shadeRay(const NodePool& pool, glm::vec3 rayOrigin, glm::vec3 rayDir, const glm::vec3& cameraPosition, float t, const Voxel& vox, int mapX, int mapY, int mapZ, float through) {
+    glm::vec3 color = rayDir;
+    if (t > 0) {
+        glm::vec3 vertexPos = rayOrigin + rayDir * t;
+        glm::vec3 surfaceNormal = glm::normalize(glm::vec3(mapX, mapY, mapZ) - glm::vec3(static_cast<float>(1 << (pool.depth - 1))));
+
+        // Phong shading
+        glm::vec3 ambient = 0.1f * vox.color;
+        glm::vec3 diffuse = std::max(glm::dot(surfaceNormal, lightDir), 0.0f) * vox.color;
+
+        glm::vec3 viewDir = glm::normalize(cameraPosition - vertexPos);
+        glm::vec3 halfwayDir = glm::normalize(lightDir + viewDir);
+        glm::vec3 specular = std::pow(std::max(glm::dot(surfaceNormal, halfwayDir), 0.0f), 32.0f) * glm::vec3(1.0f);
+
+        // A level of detail node covers only part of the pixel, the background shows through the rest
+        color = glm::mix(rayDir, ambient + diffuse + specular, through);
+    }
+    color = glm::min(color, glm::vec3(1.0f));
+    return color;
+}
+
+glm::vec3 shadePixel(const NodePool& pool, const TraceSettings& settings, float footprint, const glm::mat4& invViewMat, const glm::mat4& invProjMat, const glm::vec3& cameraPosition, glm::vec2 screenPos, float startDistance, TraversalStats* stats, float* hitT) {
+    glm::vec3 rayOrigin, rayDir;
+    primaryRay(invViewMat, invProjMat, screenPos, rayOrigin, rayDir);
+    float tMin = startDistance / glm::length(rayDir);
+
+    Voxel vox;
+    int mapX, mapY, mapZ;
+    glm::vec3 normal;
+    float through;
+
+    if (stats) stats->rays++;
+    float t = voxelTraversal(pool, settings, footprint, rayOrigin, rayDir, tMin, normal, vox, mapX, mapY, mapZ, through, stats);
+    if (hitT) *hitT = t;
+    return shadeRay(pool, rayOrigin, rayDir, cameraPosition, t, vox, mapX, mapY, mapZ, through);
+}
+
+// True if the cell of the given level containing voxel (x, y, z) may hold a solid voxel
+static bool cellOccupied(const NodePool& pool, int x, int y, int z, int level, float lodSize) {
+    GLuint node = 0;
+    uint64_t fetches = 0;
+    for (int d = 0; d < level; d++) {
+        if (d == brickLevel(pool)) return brickCellOccupied(pool, node, x, y, z, level - d, fetches);
+        int c = pool.depth - d - 1;
+        int child = ((x >> c) & 1) | (((y >> c) & 1) << 1) | (((z >> c) & 1) << 2);
+
+        GLuint next;
+        GLuint cell = childEntry(pool, node, child, next, fetches);
+
+        if ((cell & ~value_mask) == (GLuint)value_flag) {
+            return true;
+        } else if (cell == (GLuint)address_flag) {
+            node = next;
+            // Rays would stop on this node and take it as a whole
+            if (hasLevelOfDetail(pool) && static_cast<float>(1 << c) <= lodSize) return true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool regionEmpty(const NodePool& pool, glm::vec3 lo, glm::vec3 hi, float lodSize) {
+    const int mapSize = 1 << pool.depth;
+    glm::ivec3 voxelMin = glm::max(glm::ivec3(glm::floor(lo)), glm::ivec3(0));
+    glm::ivec3 voxelMax = glm::min(glm::ivec3(glm::floor(hi)), glm::ivec3(mapSize - 1));
+    if (voxelMin.x > voxelMax.x || voxelMin.y > voxelMax.y || voxelMin.z > voxelMax.z) return true;
+
+    // Cells at least as wide as the box, so that it overlaps at most 2 of them along each axis
+    glm::ivec3 extent = voxelMax - voxelMin;
+    int widest = std::max(extent.x, std::max(extent.y, extent.z));
+    int bits = 0;
+    while (widest >> bits) bits++;
+
+    glm::ivec3 cellMin = voxelMin >> bits;
+    glm::ivec3 cellMax = voxelMax >> bits;
+    for (int z = cellMin.z; z <= cellMax.z; z++) {
+        for (int y = cellMin.y; y <= cellMax.y; y++) {
+            for (int x = cellMin.x; x <= cellMax.x; x++) {
+                if (cellOccupied(pool, x << bits, y << bits, z << bits, pool.depth - bits, lodSize)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+float coneTrace(const NodePool& pool, float footprint, glm::vec3 orig, glm::vec3 axis, float spread) {
+    const float mapSize = static_cast<float>(1 << pool.depth);
+
+    // Nothing can be hit beyond the farthest corner of the volume
+    const float farthest = glm::length(glm::max(glm::abs(orig), glm::abs(orig - mapSize)));
+
+    // Every ray of the cone is within s * spread of the axis at a distance s, so the segment
+    // [s, s + stepSize] of all of them lies in the box around the axis grown by that radius.
+    // The step doubles while boxes are empty and halves down to the cone width when they are not.
+    float s = 0;
+    float stepSize = 1;
+    for (int i = 0; i < 64 && s < farthest; i++) {
+        float next = s + stepSize;
+        float radius = next * spread + 0.01f;
+        glm::vec3 a = orig + s * axis;
+        glm::vec3 b = orig + next * axis;
+        glm::vec3 lo = glm::min(a, b) - radius;
+        glm::vec3 hi = glm::max(a, b) + radius;
+
+        // Largest lodSize of the voxels in the box, so that rays never stop on coarser nodes
+        float lodSize = footprint > 0 ? footprint * (glm::length(glm::max(glm::abs(lo - orig), glm::abs(hi - orig))) + 1.0f) : 0.0f;
+
+        if (regionEmpty(pool, lo, hi, lodSize)) {
+            s = next;
+            stepSize *= 2;
+        } else if (stepSize <= std::max(1.0f, s * spread)) {
+            break;
+        } else {
+            stepSize *= 0.5f;
+        }
+    }
+    return std::min(s, farthest);
+}
+
+float tileConeDistance(const NodePool& pool, float footprint, const glm::mat4& invViewMat, const glm::mat4& invProjMat, int width, int height, int tileX, int tileY) {
+    // Pixel centres at the corners of the tile. Sets of rays within a given angle of the axis
+    // cross the image plane in ellipses, so the rays farthest from the axis go through corners.
+    glm::vec2 first = glm::vec2(tileX, tileY) * static_cast<float>(prepass_tile_size) + 0.5f;
+    glm::vec2 last = first + static_cast<float>(prepass_tile_size - 1);
+    glm::vec2 size(width, height);
+
+    glm::vec3 orig, dir;
+    primaryRay(invViewMat, invProjMat, (first + last) * 0.5f / size * 2.0f - 1.0f, orig, dir);
+    glm::vec3 axis = glm::normalize(dir);
+
+    float spread = 0;
+    for (int corner = 0; corner < 4; corner++) {
+        glm::vec2 pixel((corner & 1) ? last.x : first.x, (corner & 2) ? last.y : first.y);
+        primaryRay(invViewMat, invProjMat, pixel / size * 2.0f - 1.0f, orig, dir);
+        spread = std::max(spread, glm::length(glm::normalize(dir) - axis));
+    }
+    return coneTrace(pool, footprint, orig, axis, spread);
+}
+
+HitReprojection::HitReprojection(const glm::mat4& prevInvViewMat, const glm::mat4& prevInvProjMat, const glm::mat4& viewProjMat,
+                                 const glm::vec3& cameraPosition, int width, int height) : size(width, height) {
+    glm::vec3 orig, dir00, dir10, dir01;
+    primaryRay(prevInvViewMat, prevInvProjMat, 0.5f / size * 2.0f - 1.0f, orig, dir00);
+    primaryRay(prevInvViewMat, prevInvProjMat, glm::vec2(1.5f, 0.5f) / size * 2.0f - 1.0f, orig, dir10);
+    primaryRay(prevInvViewMat, prevInvProjMat, glm::vec2(0.5f, 1.5f) / size * 2.0f - 1.0f, orig, dir01);
+    origin = orig - cameraPosition;
+    dir = dir00;
+    dirX = dir10 - dir00;
+    dirY = dir01 - dir00;
+    clipOrigin = viewProjMat * glm::vec4(orig, 1.0f);
+    clip = viewProjMat * glm::vec4(dir, 0.0f);
+    clipX = viewProjMat * glm::vec4(dirX, 0.0f);
+    clipY = viewProjMat * glm::vec4(dirY, 0.0f);
+}
+
+bool HitReprojection::reproject(int x, int y, float t, int& targetX, int& targetY, float& distance) const {
+    if (t <= 0) return false;
+    glm::vec2 p(x, y);
+    glm::vec4 projected = clipOrigin + t * (clip + p.x * clipX + p.y * clipY);
+    if (projected.w <= 0) return false;
+    glm::vec2 pixel = (glm::vec2(projected) / projected.w * 0.5f + 0.5f) * size;
+    if (pixel.x < 0 || pixel.y < 0 || pixel.x >= size.x || pixel.y >= size.y) return false;
+    targetX = static_cast<int>(pixel.x);
+    targetY = static_cast<int>(pixel.y);
+    distance = glm::length(origin + t * (dir + p.x * dirX + p.y * dirY));
+    return true;
+}
+
+float reprojectedDistance(const std::vector<float>& closestHits, int width, int height, float footprint, int x, int y) {
+    // The surface seen by the ray lies between the hits of the neighbouring pixels. If one of them has
+    // none, it was hidden or out of view in the previous frame, or the ray may pass an edge.
+    if (x == 0 || y == 0 || x == width - 1 || y == height - 1) return 0.0f;
+    float closest = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            float hit = closestHits[static_cast<size_t>(y + dy) * width + x + dx];
+            if (std::isinf(hit)) return 0.0f;
+            closest = dx == -1 && dy == -1 ? hit : std::min(closest, hit);
+        }
+    }
+    // Nodes rays stop on for the level of detail are up to footprint * distance wide
+    return std::max(closest - reprojection_margin - 2.0f * footprint * closest, 0.0f);
+}
+
+void Image::setPixel(int x, int y, glm::vec3 color) {
+    // Same conversion as a write to a normalized 8-bit framebuffer
+    glm::vec3 c = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+    unsigned char* p = &pixels[(static_cast<size_t>(y) * width + x) * 4];
+    p[0] = static_cast<unsigned char>(c.r);
+    p[1] = static_cast<unsigned char>(c.g);
+    p[2] = static_cast<unsigned char>(c.b);
+    p[3] = 255;
+}
+
+void renderReference(const NodePool& pool, const TraceSettings& settings, const Camera& camera, Image& image, TraversalStats* stats) {
+    const glm::mat4 invViewMat = glm::inverse(camera.computeViewMatrix());
+    const glm::mat4 invProjMat = glm::inverse(camera.computeProjectionMatrix());
+    const glm::vec3 cameraPosition = camera.getPosition();
+    const float footprint = lodFootprint(settings, camera, image.height);
+
+    const int tilesX = (image.width + prepass_tile_size - 1) / prepass_tile_size;
+    const int tilesY = (image.height + prepass_tile_size - 1) / prepass_tile_size;
+    std::vector<float> coneDistances(static_cast<size_t>(tilesX) * tilesY, 0.0f);
+    if (settings.conePrepass) {
+        for (int y = 0; y < tilesY; y++) {
+            for (int x = 0; x < tilesX; x++) {
+                coneDistances[y * tilesX + x] = tileConeDistance(pool, footprint, invViewMat, invProjMat, image.width, image.height, x, y);
+            }
+        }
+    }
+
+    for (int y = 0; y < image.height; y++) {
+        for (int x = 0; x < image.width; x++) {
+            // Pixel centres, as interpolated by the fullscreen quad
+            glm::vec2 screenPos((x + 0.5f) / image.width * 2.0f - 1.0f, (y + 0.5f) / image.height * 2.0f - 1.0f);
+            float coneDistance = coneDistances[(y / prepass_tile_size) * tilesX + x / prepass_tile_size];
+            image.setPixel(x, y, shadePixel(pool, settings, footprint, invViewMat, invProjMat, cameraPosition, screenPos, coneDistance, stats));
+        }
+    }
+}
+
+bool writeImage(const std::string& filename, const Image& image) {
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    if (!file.good()) {
+        std::cerr << "ERROR: Cannot write file '" << filename << "'" << std::endl;
+        return false;
+    }
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+    for (int y = image.height - 1; y >= 0; y--) {
+        for (int x = 0; x < image.width; x++) {
+            file.write(reinterpret_cast<const char*>(&image.pixels[(static_cast<size_t>(y) * image.width + x) * 4]), 3);
+        }
+    }
+    return file.good();
+}
@@ -0,0 +1,130 @@
+/*
+    cpu_raycaster.hpp
+    author: Telo PHILIPPE
+
+    CPU reference of the ray caster in resources/fragmentShader.glsl, working on the
+    flattened node pool. Every function mirrors its GLSL counterpart, so images rendered
+    here match the GPU ones and can be produced without an OpenGL context.
+*/
+
+#ifndef CPU_RAYCASTER_HPP
+#define CPU_RAYCASTER_HPP
+
+#include "gl_includes.hpp"
+#include "camera.hpp"
+#include "node_pool.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Traversal options, each mirroring a uniform of the shader
+struct TraceSettings {
+    bool skipEmpty = true;      // u_skipEmpty: jump over whole empty octree cells
+    bool resumeLookups = true;  // u_resumeLookups: start lookups from the deepest common ancestor
+    bool levelOfDetail = true;  // u_lodFootprint > 0: stop at nodes smaller than a pixel
+    bool conePrepass = true;    // u_conePrepass: start rays where the cone of their tile meets the octree
+    bool temporalReprojection = false;  // u_reprojection: start rays just before the hits of the previous frame
+};
+
+// Work counters, accumulated over the rays traced with them
+struct TraversalStats {
+    uint64_t rays = 0;
+    uint64_t steps = 0;     // Voxels or empty cells visited
+    uint64_t fetches = 0;   // Node pool and level of detail entries read
+
+    void add(const TraversalStats& other) {
+        rays += other.rays;
+        steps += other.steps;
+        fetches += other.fetches;
+    }
+
+    double stepsPerRay() const { return rays ? static_cast<double>(steps) / rays : 0.0; }
+    double fetchesPerRay() const { return rays ? static_cast<double>(fetches) / rays : 0.0; }
+};
+
+float projectToCube(const NodePool& pool, glm::vec3 ro, glm::vec3 rd);
+
+// Value of u_lodFootprint: height of a pixel of an image of the given height seen at a distance
+// of one voxel, 0 when the level of detail is disabled
+float lodFootprint(const TraceSettings& settings, const Camera& camera, int imageHeight);
+
+// Returns the distance to the first solid voxel along the ray, -1 if none is hit. The ray is known
+// not to hit anything before tMin. Nodes narrower than footprint times their distance to orig are
+// not subdivided: through is set to the occupancy of the node hit, 1 for a voxel.
+float voxelTraversal(const NodePool& pool, const TraceSettings& settings, float footprint, glm::vec3 orig, glm::vec3 direction, float tMin, glm::vec3& normal, Voxel& vox, int& mapX, int& mapY, int& mapZ, float& through, TraversalStats* stats = nullptr);
+
+// Ray through screenPos (in [-1, 1]^2), as set up by main() in the shader
+void primaryRay(const glm::mat4& invViewMat, const glm::mat4& invProjMat, glm::vec2 screenPos, glm::vec3& rayOrigin, glm::vec3& rayDir);
+
+// Colour of a ray given the result of voxelTraversal, as shaded by main() in the shader
+glm::vec3 shadeRay(const NodePool& pool, glm::vec3 rayOrigin, glm::vec3 rayDir, const glm::vec3& cameraPosition, float t, const Voxel& vox, int mapX, int mapY, int mapZ, float through);
+
+// Colour of the pixel at screenPos (in [-1, 1]^2), as computed by main() in the shader, its ray
+// starting startDistance away from the camera. The result of voxelTraversal goes to hitT if given.
+glm::vec3 shadePixel(const NodePool& pool, const TraceSettings& settings, float footprint, const glm::mat4& invViewMat, const glm::mat4& invProjMat, const glm::vec3& cameraPosition, glm::vec2 screenPos, float startDistance, TraversalStats* stats = nullptr, float* hitT = nullptr);
+
+// Side of the pixel tiles covered by one cone of the prepass (PREPASS_TILE in the shader)
+const int prepass_tile_size = 8;
+
+// Same as regionEmpty in the shader: true if no solid voxel overlaps the box [lo, hi], nodes no
+// wider than lodSize counting as solid
+bool regionEmpty(const NodePool& pool, glm::vec3 lo, glm::vec3 hi, float lodSize);
+
+// Same as coneTrace in the shader: distance from orig along axis before which no ray of the cone
+// can hit a voxel, the directions of its rays being at most spread away from axis (all unit vectors)
+float coneTrace(const NodePool& pool, float footprint, glm::vec3 orig, glm::vec3 axis, float spread);
+
+// Same as the prepass of the shader: coneTrace for the rays of the pixels of tile (tileX, tileY),
+// of prepass_tile_size pixels, in an image of width x height
+float tileConeDistance(const NodePool& pool, float footprint, const glm::mat4& invViewMat, const glm::mat4& invProjMat, int width, int height, int tileX, int tileY);
+
+// Voxels that rays start before the reprojected hits, for the staircase of voxel faces
+// (REPROJECTION_MARGIN in the shader)
+const float reprojection_margin = 1.0f;
+
+// Same as the reprojection pass of the shader, from the camera of the previous frame to the current one.
+// Ray directions are affine in the pixel coordinates, and so is the clip space position of a hit at a
+// given t, so the matrix products are done once per frame.
+struct HitReprojection {
+    HitReprojection(const glm::mat4& prevInvViewMat, const glm::mat4& prevInvProjMat, const glm::mat4& viewProjMat,
+                    const glm::vec3& cameraPosition, int width, int height);
+
+    // Finds the pixel that the hit of pixel (x, y) in the previous frame falls in, and its distance
+    // from the camera. t is the result of voxelTraversal for that pixel. Returns false if nothing
+    // was hit or the hit is out of view.
+    bool reproject(int x, int y, float t, int& targetX, int& targetY, float& distance) const;
+
+    glm::vec3 origin;       // Previous camera, relative to the current one
+    glm::vec3 dir, dirX, dirY;      // Previous ray direction at pixel (0, 0) and its change per pixel
+    glm::vec4 clipOrigin, clip, clipX, clipY;   // Same in clip space
+    glm::vec2 size;
+};
+
+// Same as reprojectedDistance in the shader: distance from the camera before which the ray of pixel
+// (x, y) is expected to hit nothing, given the closest reprojected hit distance of each pixel
+// (infinity where none fell), 0 to trace the whole ray
+float reprojectedDistance(const std::vector<float>& closestHits, int width, int height, float footprint, int x, int y);
+
+// RGBA8 image, rows stored bottom to top like an OpenGL framebuffer
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        pixels.assign(static_cast<size_t>(w) * h * 4, 0);
+    }
+
+    void setPixel(int x, int y, glm::vec3 color);
+};
+
+// Renders the view of camera on a single thread, as a first frame with nothing to reproject
+void renderReference(const NodePool& pool, const TraceSettings& settings, const Camera& camera, Image& image, TraversalStats* stats = nullptr);
+
+// Writes a binary PPM file
+bool writeImage(const std::string& filename, const Image& image);
+
+#endif  // CPU_RAYCASTER_HPP
@@ -0,0 +1,162 @@
+/*
+    cpu_renderer.cpp
+    author: Telo PHILIPPE
+
+    Implementation of the tiled CPU renderer.
+*/
+
+#include "cpu_renderer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <mutex>
+
+CPURenderer::CPURenderer(unsigned int threadCount) : m_threads(threadCount) {}
+
+// Traces the pixels [x0, x1) x [y0, y1) in packets of tracer.width x tracer.height, lanes past
+// the edges left empty. The result of voxelTraversal of each pixel goes to hitTs if not null.
+static void tracePackets(const PacketTracer& tracer, const NodePool& pool, const TraceSettings& settings, float footprint,
+                         const glm::mat4& invViewMat, const glm::mat4& invProjMat, const glm::vec3& cameraPosition,
+                         const std::vector<float>& startDistances, float* hitTs, Image& image, int x0, int y0, int x1, int y1, TraversalStats& stats) {
+    RayPacket packet;
+    PacketHits hits;
+    glm::vec3 rayDirs[max_packet_lanes];
+    for (int py = y0; py < y1; py += tracer.height) {
+        for (int px = x0; px < x1; px += tracer.width) {
+            packet.lanes = 0;
+            for (int lane = 0; lane < tracer.width * tracer.height; lane++) {
+                int x = px + lane % tracer.width;
+                int y = py + lane / tracer.width;
+                rayDirs[lane] = glm::vec3(0.0f, 0.0f, -1.0f);
+                packet.tMin[lane] = 0.0f;
+                if (x < x1 && y < y1) {
+                    glm::vec2 screenPos((x + 0.5f) / image.width * 2.0f - 1.0f, (y + 0.5f) / image.height * 2.0f - 1.0f);
+                    primaryRay(invViewMat, invProjMat, screenPos, packet.origin, rayDirs[lane]);
+                    packet.tMin[lane] = startDistances[static_cast<size_t>(y) * image.width + x] / glm::length(rayDirs[lane]);
+                    packet.lanes |= 1u << lane;
+                }
+                packet.dirX[lane] = rayDirs[lane].x;
+                packet.dirY[lane] = rayDirs[lane].y;
+                packet.dirZ[lane] = rayDirs[lane].z;
+            }
+
+            tracer.trace(pool, settings, footprint, packet, hits, stats);
+
+            for (int lane = 0; lane < tracer.width * tracer.height; lane++) {
+                if (!(packet.lanes >> lane & 1)) continue;
+                GLuint rgb = hits.color[lane];
+                Voxel vox { glm::vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, glm::vec3(0.0f) };
+                glm::vec3 color = shadeRay(pool, packet.origin, rayDirs[lane], cameraPosition, hits.t[lane], vox, hits.mapX[lane], hits.mapY[lane], hits.mapZ[lane], hits.through[lane]);
+                int x = px + lane % tracer.width;
+                int y = py + lane / tracer.width;
+                image.setPixel(x, y, color);
+                if (hitTs) hitTs[static_cast<size_t>(y) * image.width + x] = hits.t[lane];
+                stats.rays++;
+            }
+        }
+    }
+}
+
+void CPURenderer::render(const NodePool& pool, const Camera& camera, Image& image) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const glm::mat4 invViewMat = glm::inverse(camera.computeViewMatrix());
+    const glm::mat4 invProjMat = glm::inverse(camera.computeProjectionMatrix());
+    const glm::vec3 cameraPosition = camera.getPosition();
+    const float footprint = lodFootprint(settings, camera, image.height);
+    // Packet kernels gather with 32-bit signed indices
+    const bool packetReach = pool.size <= static_cast<size_t>(std::numeric_limits<int>::max());
+    const PacketTracer tracer = packetTracer(packetReach ? simd : SimdLevel::Scalar);
+
+    const size_t pixelCount = static_cast<size_t>(image.width) * image.height;
+    if (!settings.temporalReprojection) m_hits.clear();
+    bool reproject = !m_hits.empty() && m_hitsWidth == image.width && m_hitsHeight == image.height;
+
+    // Reprojection: hits of the previous frame moved to the pixels they fall in now. Done on the
+    // calling thread, as tasks would have to merge the closest hits of each pixel.
+    m_closestHits.assign(reproject ? pixelCount : 0, std::numeric_limits<float>::infinity());
+    if (reproject) {
+        const HitReprojection reprojection(m_prevInvViewMat, m_prevInvProjMat, camera.computeProjectionMatrix() * camera.computeViewMatrix(),
+                                           glm::vec3(invViewMat[3]), image.width, image.height);
+        for (int y = 0; y < image.height; y++) {
+            for (int x = 0; x < image.width; x++) {
+                int targetX, targetY;
+                float distance;
+                if (reprojection.reproject(x, y, m_hits[static_cast<size_t>(y) * image.width + x], targetX, targetY, distance)) {
+                    float& closest = m_closestHits[static_cast<size_t>(targetY) * image.width + targetX];
+                    closest = std::min(closest, distance);
+                }
+            }
+        }
+    }
+
+    // Prepass: one cone per tile of prepass_tile_size pixels, a row of them per task
+    const int coneTilesX = (image.width + prepass_tile_size - 1) / prepass_tile_size;
+    const int coneTilesY = (image.height + prepass_tile_size - 1) / prepass_tile_size;
+    m_coneDistances.assign(static_cast<size_t>(coneTilesX) * coneTilesY, 0.0f);
+    if (settings.conePrepass) {
+        m_threads.run(coneTilesY, [&](size_t y) {
+            for (int x = 0; x < coneTilesX; x++) {
+                m_coneDistances[y * coneTilesX + x] = tileConeDistance(pool, footprint, invViewMat, invProjMat, image.width, image.height, x, static_cast<int>(y));
+            }
+        });
+    }
+
+    // Start of each ray: the farther of the two bounds
+    m_startDistances.resize(pixelCount);
+    std::vector<size_t> reprojectedRows(image.height, 0);
+    m_threads.run(image.height, [&](size_t y) {
+        for (int x = 0; x < image.width; x++) {
+            float startDistance = m_coneDistances[(y / prepass_tile_size) * coneTilesX + x / prepass_tile_size];
+            if (reproject) {
+                float distance = reprojectedDistance(m_closestHits, image.width, image.height, footprint, x, static_cast<int>(y));
+                if (distance > 0) reprojectedRows[y]++;
+                startDistance = std::max(startDistance, distance);
+            }
+            m_startDistances[y * image.width + x] = startDistance;
+        }
+    });
+    m_pixels = pixelCount;
+    m_reprojectedPixels = 0;
+    for (size_t count : reprojectedRows) m_reprojectedPixels += count;
+    m_prepassTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (settings.temporalReprojection) m_hits.resize(pixelCount);
+    float* hitTs = settings.temporalReprojection ? m_hits.data() : nullptr;
+
+    const int tilesX = (image.width + tileSize - 1) / tileSize;
+    const int tilesY = (image.height + tileSize - 1) / tileSize;
+
+    TraversalStats frameStats;
+    std::mutex statsMutex;
+
+    m_threads.run(static_cast<size_t>(tilesX) * tilesY, [&](size_t tile) {
+        int x0 = static_cast<int>(tile % tilesX) * tileSize;
+        int y0 = static_cast<int>(tile / tilesX) * tileSize;
+        int x1 = std::min(x0 + tileSize, image.width);
+        int y1 = std::min(y0 + tileSize, image.height);
+        TraversalStats tileStats;
+        if (!tracer.trace) {
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    glm::vec2 screenPos((x + 0.5f) / image.width * 2.0f - 1.0f, (y + 0.5f) / image.height * 2.0f - 1.0f);
+                    size_t pixel = static_cast<size_t>(y) * image.width + x;
+                    image.setPixel(x, y, shadePixel(pool, settings, footprint, invViewMat, invProjMat, cameraPosition, screenPos, m_startDistances[pixel], &tileStats, hitTs ? hitTs + pixel : nullptr));
+                }
+            }
+        } else {
+            tracePackets(tracer, pool, settings, footprint, invViewMat, invProjMat, cameraPosition, m_startDistances, hitTs, image, x0, y0, x1, y1, tileStats);
+        }
+        std::lock_guard<std::mutex> lock(statsMutex);
+        frameStats.add(tileStats);
+    });
+
+    m_hitsWidth = image.width;
+    m_hitsHeight = image.height;
+    m_prevInvViewMat = invViewMat;
+    m_prevInvProjMat = invProjMat;
+
+    m_frameTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m_stats = frameStats;
+}
@@ -0,0 +1,65 @@
+/*
+    cpu_renderer.hpp
+    author: Telo PHILIPPE
+
+    Multithreaded CPU renderer: the image is split in square tiles traced in parallel on
+    a work-stealing thread pool, each pixel shaded by the CPU reference ray caster. Tiles are
+    traced in packets of neighbouring pixels with the widest SIMD kernel available.
+    Successive frames form a sequence: the hits of one are reprojected to start the rays of the next.
+*/
+
+#ifndef CPU_RENDERER_HPP
+#define CPU_RENDERER_HPP
+
+#include "gl_includes.hpp"
+#include "camera.hpp"
+#include "cpu_packet.hpp"
+#include "cpu_raycaster.hpp"
+#include "node_pool.hpp"
+#include "thread_pool.hpp"
+
+#include <vector>
+
+class CPURenderer {
+public:
+    explicit CPURenderer(unsigned int threadCount);
+
+    void render(const NodePool& pool, const Camera& camera, Image& image);
+
+    // Forgets the hits of the last frame, so that the next one is not reprojected. Call it when
+    // the voxels change.
+    void invalidateHits() { m_hits.clear(); }
+
+    // Statistics of the last frame, frameTime including prepassTime (reprojection and cone prepass)
+    double frameTime() const { return m_frameTime; }
+    double prepassTime() const { return m_prepassTime; }
+    double reprojectedFraction() const { return m_pixels ? static_cast<double>(m_reprojectedPixels) / m_pixels : 0.0; }
+    double raysPerSecond() const { return m_frameTime > 0 ? m_stats.rays / m_frameTime : 0; }
+    const TraversalStats& stats() const { return m_stats; }
+    unsigned int threadCount() const { return m_threads.size(); }
+
+    int tileSize = 16;
+    TraceSettings settings;
+    SimdLevel simd = detectSimdLevel();     // Widest kernel allowed, Scalar to trace one ray at a time
+
+private:
+    ThreadPool m_threads;
+    double m_frameTime = 0;
+    double m_prepassTime = 0;
+    size_t m_pixels = 0;
+    size_t m_reprojectedPixels = 0;     // Pixels whose ray started at a reprojected hit
+    std::vector<float> m_coneDistances;     // Output of the prepass, one per tile of prepass_tile_size pixels
+    std::vector<float> m_closestHits;       // Closest hit reprojected in each pixel, infinity if none
+    std::vector<float> m_startDistances;    // Per pixel, from the camera
+    TraversalStats m_stats;
+
+    // Previous frame, for the reprojection: voxelTraversal result of each pixel and its camera.
+    // m_hits is empty when the last frame was rendered without reprojection.
+    std::vector<float> m_hits;
+    int m_hitsWidth = 0;
+    int m_hitsHeight = 0;
+    glm::mat4 m_prevInvViewMat;
+    glm::mat4 m_prevInvProjMat;
+};
+
+#endif  // CPU_RENDERER_HPP
@@ -5,6 +5,11 @@
 #include "shader.hpp"
 #include "voxel_array.hpp"
 #include "octree.hpp"
+#include "cpu_raycaster.hpp"
+#include "cpu_renderer.hpp"
+#include "cpu_packet.hpp"
+#include "benchmark.hpp"
+#include "profiler.hpp"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -12,6 +17,8 @@
 
 #include "gl_includes.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
@@ -24,6 +31,8 @@ void reloadShaders();
 
 // Window parameters
 GLFWwindow *g_window {};
+int g_windowWidth = 1024;
+int g_windowHeight = 768;
 
 // GPU objects
 GLuint g_program {};  // A GPU program contains at least a vertex shader and a fragment shader
@@ -37,6 +46,60 @@ float g_fps = 0.0f;
 bool g_reloadShaders = false;
 
 std::shared_ptr<VoxelArray> g_voxelArray {};
+std::shared_ptr<Octree> g_octree {};
+
+// Command line options
+bool g_useDAG = false;
+NodeFormat g_nodeFormat = NodeFormat::Blocks;
+int g_paletteBits = 0;
+bool g_attributeStream = false;
+bool g_bricks = false;
+int g_sceneDepth = 7;
+std::string g_loadFile {};
+std::string g_saveFile {};
+std::string g_cpuReferenceFile {};
+std::string g_cpuRenderFile {};
+unsigned int g_threadCount = workerCount();
+std::string g_benchmarkFile {};
+int g_benchmarkFrames = 120;
+std::string g_traceFile = "trace.json";
+bool g_traceOnExit = false;
+
+// Traversal options shared by the shader and the CPU renderers
+TraceSettings g_traceSettings {};
+
+// CPU rendering path, shown by blitting its framebuffer to the window
+std::unique_ptr<CPURenderer> g_cpuRenderer {};
+bool g_useCPURenderer = false;
+float g_cpuResolutionScale = 0.5f;
+SimdLevel g_simdLevel = detectSimdLevel();
+Image g_cpuImage {};
+GLuint g_cpuTexture {};
+GLuint g_cpuFramebuffer {};
+
+// Cone prepass target, one texel per tile of prepass_tile_size pixels
+GLuint g_coneTexture {};
+GLuint g_coneFramebuffer {};
+int g_coneTexWidth = 0;
+int g_coneTexHeight = 0;
+
+// Temporal reprojection images, at the resolution of the viewport: hits of the last main pass, and
+// their closest distance in each pixel once reprojected
+GLuint g_hitTexture {};
+GLuint g_reprojTexture {};
+int g_hitTexWidth = 0;
+int g_hitTexHeight = 0;
+bool g_hitsValid = false;   // g_hitTexture holds the hits of the previous frame, seen from these matrices
+size_t g_hitsEditCount = 0; // g_octree->editCount() when the hits were traced
+glm::mat4 g_prevInvViewMat {};
+glm::mat4 g_prevInvProjMat {};
+
+// Profiling: GPU time of the passes and frame time graphs
+GPUTimer g_passTimer("fullscreen pass");
+GPUTimer g_prepassTimer("prepasses");
+TimeHistory g_frameTimes {};
+TimeHistory g_gpuTimes {};
+TimeHistory g_prepassTimes {};
 
 // Executed each time the window is resized. Adjust the aspect ratio and the rendering viewport to the current window.
 void windowSizeCallback(GLFWwindow *window, int width, int height) {
@@ -56,6 +119,9 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
         if(key == GLFW_KEY_R) {
             g_reloadShaders = true;
         }
+        if(key == GLFW_KEY_C) {
+            g_useCPURenderer = !g_useCPURenderer;
+        }
         if ((key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q)) {
             glfwSetWindowShouldClose(window, true);  // Closes the application if the escape key is pressed
         }
@@ -93,10 +159,11 @@ void initGLFW() {
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, g_benchmarkFile.empty() ? GL_TRUE : GL_FALSE);  // Benchmarks render off-screen
 
     // Create the window
     g_window = glfwCreateWindow(
-        1024, 768,
+        g_windowWidth, g_windowHeight,
         "Voxel octrees rendering", nullptr, nullptr);
     if (!g_window) {
         std::cerr << "ERROR: Failed to open window" << std::endl;
@@ -147,9 +214,51 @@ void initGPUprogram() {
 }
 
 
+// Drops the hits of the previous frame, on the GPU and in the CPU renderer, once the voxels changed
+void invalidateHits() {
+    g_hitsValid = false;
+    if (g_cpuRenderer) g_cpuRenderer->invalidateHits();
+    g_hitsEditCount = g_octree ? g_octree->editCount() : 0;
+}
+
+// Generates or loads the octree, without touching OpenGL
+void loadScene() {
+    PROFILE_ZONE("loadScene");
+    if (!g_loadFile.empty()) {
+        g_octree = Octree::load(g_loadFile);
+        if (!g_octree) {
+            std::exit(EXIT_FAILURE);
+        }
+        std::cout << "Loaded " << g_loadFile << " (depth " << g_octree->treeDepth << ", " << g_octree->blockPool().size / 8 << " node blocks)" << std::endl;
+        g_attributeStream = g_octree->hasAttributeStream();
+        g_bricks = g_octree->hasBricks();
+    } else {
+        g_voxelArray = std::make_shared<VoxelArray>(g_sceneDepth, g_useDAG, VoxelStorage::Implicit, g_paletteBits);
+        g_octree = g_voxelArray->octree;
+        g_octree->setAttributeStream(g_attributeStream);
+        if (g_attributeStream) {
+            std::cout << "Attribute stream: " << g_octree->blockPool().size / 8 << " geometry blocks, " << g_octree->blockPool().attributeCount << " leaf values" << std::endl;
+        }
+        g_octree->setBricks(g_bricks);
+        if (g_octree->blockPool().bricks) {
+            std::cout << "Leaf bricks: " << g_octree->blockPool().size / 8 << " node blocks" << std::endl;
+        }
+    }
+
+    if (!g_saveFile.empty()) {
+        if (g_octree->save(g_saveFile)) {
+            std::cout << "Saved " << g_saveFile << std::endl;
+        }
+    }
+    g_octree->setNodeFormat(g_nodeFormat);
+    invalidateHits();
+}
+
 void initCPUgeometry() {
     g_mesh = Mesh::genPlane();
-    g_voxelArray = std::make_shared<VoxelArray>(7);
+    loadScene();
+    PROFILE_ZONE("uploadOctree");
+    g_octree->generateTexture();
 }
 
 void initCamera() {
@@ -176,7 +285,15 @@ void init() {
 }
 
 void clear() {
+    g_passTimer.release();
+    g_prepassTimer.release();
+    if (g_coneTexture) glDeleteTextures(1, &g_coneTexture);
+    if (g_coneFramebuffer) glDeleteFramebuffers(1, &g_coneFramebuffer);
+    if (g_hitTexture) glDeleteTextures(1, &g_hitTexture);
+    if (g_reprojTexture) glDeleteTextures(1, &g_reprojTexture);
     glDeleteProgram(g_program);
+    if (g_cpuTexture) glDeleteTextures(1, &g_cpuTexture);
+    if (g_cpuFramebuffer) glDeleteFramebuffers(1, &g_cpuFramebuffer);
 
     glfwDestroyWindow(g_window);
     glfwTerminate();
@@ -188,6 +305,7 @@ void clear() {
 }
 
 void renderUI() {
+    PROFILE_ZONE("renderUI");
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -198,6 +316,63 @@ void renderUI() {
 
     ImGui::Text("FPS: %.1f", g_fps);
 
+    char overlay[32];
+    snprintf(overlay, sizeof(overlay), "%.2f ms", g_frameTimes.last());
+    ImGui::PlotLines("Frame", g_frameTimes.values, TimeHistory::size, g_frameTimes.offset, overlay, 0.0f, g_frameTimes.max(), ImVec2(0, 50));
+    if (!g_useCPURenderer) {
+        snprintf(overlay, sizeof(overlay), "%.2f ms", g_gpuTimes.last());
+        ImGui::PlotLines("GPU pass", g_gpuTimes.values, TimeHistory::size, g_gpuTimes.offset, overlay, 0.0f, g_gpuTimes.max(), ImVec2(0, 50));
+        if (g_traceSettings.conePrepass || g_traceSettings.temporalReprojection) {
+            snprintf(overlay, sizeof(overlay), "%.2f ms", g_prepassTimes.last());
+            ImGui::PlotLines("Prepasses", g_prepassTimes.values, TimeHistory::size, g_prepassTimes.offset, overlay, 0.0f, g_prepassTimes.max(), ImVec2(0, 50));
+        }
+    }
+    if (ImGui::Button("Save trace")) {
+        if (writeChromeTrace(g_traceFile)) {
+            std::cout << "Saved " << g_traceFile << std::endl;
+        }
+    }
+
+    ImGui::Checkbox("Empty space skipping", &g_traceSettings.skipEmpty);
+    ImGui::Checkbox("Resume lookups from common ancestor", &g_traceSettings.resumeLookups);
+    ImGui::Checkbox("Level of detail", &g_traceSettings.levelOfDetail);
+    ImGui::Checkbox("Cone prepass", &g_traceSettings.conePrepass);
+    ImGui::Checkbox("Temporal reprojection", &g_traceSettings.temporalReprojection);
+    bool compactNodes = g_nodeFormat == NodeFormat::Compact;
+    if (ImGui::Checkbox("Compact nodes", &compactNodes)) {
+        g_nodeFormat = compactNodes ? NodeFormat::Compact : NodeFormat::Blocks;
+        g_octree->setNodeFormat(g_nodeFormat);
+    }
+    if (ImGui::Checkbox("Attribute stream", &g_attributeStream)) {
+        g_octree->setAttributeStream(g_attributeStream);
+        g_attributeStream = g_octree->hasAttributeStream();
+    }
+    if (ImGui::Checkbox("Leaf bricks", &g_bricks)) {
+        g_octree->setBricks(g_bricks);
+        g_bricks = g_octree->hasBricks();
+    }
+    ImGui::Text("Node pool: %.2f MiB", poolBytes(g_octree->nodePool()) / (1024.0 * 1024.0));
+
+    ImGui::Checkbox("CPU renderer (C)", &g_useCPURenderer);
+    if (g_useCPURenderer && g_cpuRenderer) {
+        ImGui::SliderFloat("Resolution scale", &g_cpuResolutionScale, 0.1f, 1.0f);
+        ImGui::Text("%d x %d, %u threads", g_cpuImage.width, g_cpuImage.height, g_cpuRenderer->threadCount());
+        const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE4, SimdLevel::AVX2, SimdLevel::AVX512 };
+        if (ImGui::BeginCombo("SIMD", simdLevelName(g_simdLevel))) {
+            for (SimdLevel level : levels) {
+                // Levels the processor lacks fall back to narrower kernels
+                if (packetTracer(level).level != level) continue;
+                if (ImGui::Selectable(simdLevelName(level), level == g_simdLevel)) g_simdLevel = level;
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::Text("Mrays/s: %.2f", g_cpuRenderer->raysPerSecond() * 1e-6);
+        ImGui::Text("Prepass: %.2f ms, main pass: %.2f ms", g_cpuRenderer->prepassTime() * 1e3, (g_cpuRenderer->frameTime() - g_cpuRenderer->prepassTime()) * 1e3);
+        ImGui::Text("Reprojected: %.1f%% of pixels", g_cpuRenderer->reprojectedFraction() * 100.0);
+        ImGui::Text("Steps/ray: %.1f", g_cpuRenderer->stats().stepsPerRay());
+        ImGui::Text("Fetches/ray: %.1f", g_cpuRenderer->stats().fetchesPerRay());
+    }
+
     ImGui::End();
 
     // End drawing here
@@ -206,15 +381,125 @@ void renderUI() {
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
-// The main rendering call
-void render() {
+// Traces the frame on the CPU and blits the result to the window
+void renderCPU() {
+    PROFILE_ZONE("renderCPU");
+    if (!g_cpuRenderer) {
+        g_cpuRenderer.reset(new CPURenderer(g_threadCount));
+        glGenTextures(1, &g_cpuTexture);
+        glGenFramebuffers(1, &g_cpuFramebuffer);
+    }
 
-    if(g_reloadShaders) {
-        reloadShaders();
-        g_reloadShaders = false;
+    int width, height;
+    glfwGetFramebufferSize(g_window, &width, &height);
+    int imageWidth = std::max(1, static_cast<int>(width * g_cpuResolutionScale));
+    int imageHeight = std::max(1, static_cast<int>(height * g_cpuResolutionScale));
+    bool resized = imageWidth != g_cpuImage.width || imageHeight != g_cpuImage.height;
+    if (resized) {
+        g_cpuImage.resize(imageWidth, imageHeight);
     }
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);  // Erase the color and z buffers.
+    g_cpuRenderer->settings = g_traceSettings;
+    g_cpuRenderer->simd = g_simdLevel;
+    g_cpuRenderer->render(g_octree->nodePool(), g_camera, g_cpuImage);
+
+    glBindTexture(GL_TEXTURE_2D, g_cpuTexture);
+    if (resized) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, imageWidth, imageHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, g_cpuImage.pixels.data());
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, imageWidth, imageHeight, GL_RGBA, GL_UNSIGNED_BYTE, g_cpuImage.pixels.data());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_cpuFramebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, g_cpuTexture, 0);
+    glBlitFramebuffer(0, 0, imageWidth, imageHeight, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+// Traces the cones of the tiles of the viewport into g_coneTexture, and binds it for the main pass
+void renderPrepass(const GLint viewport[4]) {
+    int width = (viewport[2] + prepass_tile_size - 1) / prepass_tile_size;
+    int height = (viewport[3] + prepass_tile_size - 1) / prepass_tile_size;
+    if (!g_coneTexture) {
+        glGenTextures(1, &g_coneTexture);
+        glGenFramebuffers(1, &g_coneFramebuffer);
+    }
+    if (width != g_coneTexWidth || height != g_coneTexHeight) {
+        g_coneTexWidth = width;
+        g_coneTexHeight = height;
+        glBindTexture(GL_TEXTURE_2D, g_coneTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, g_coneFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, g_coneTexture, 0);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g_coneFramebuffer);
+    glViewport(0, 0, width, height);
+    setUniform(g_program, "u_prepass", true);
+    g_mesh->render();
+    setUniform(g_program, "u_prepass", false);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, g_coneTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Moves the hits of the previous frame to the pixels they fall in now, into g_reprojTexture, and binds
+// both images for the main pass. Nothing is reprojected on the first frame or after a resize.
+void renderReprojection(const GLint viewport[4]) {
+    int width = viewport[2];
+    int height = viewport[3];
+    if (!g_hitTexture) {
+        glGenTextures(1, &g_hitTexture);
+        glGenTextures(1, &g_reprojTexture);
+    }
+    if (width != g_hitTexWidth || height != g_hitTexHeight) {
+        g_hitTexWidth = width;
+        g_hitTexHeight = height;
+        glBindTexture(GL_TEXTURE_2D, g_hitTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, g_reprojTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        g_hitsValid = false;
+    }
+
+    const GLuint none = 0xFFFFFFFF;
+    glClearTexImage(g_reprojTexture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &none);
+    glBindImageTexture(0, g_hitTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+    glBindImageTexture(1, g_reprojTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    if (!g_hitsValid) return;
+
+    // Hits stored by the previous main pass, then reprojected ones read by the next one
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    setUniform(g_program, "u_prevInvViewMat", g_prevInvViewMat);
+    setUniform(g_program, "u_prevInvProjMat", g_prevInvProjMat);
+    setUniform(g_program, "u_reprojectPass", true);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    g_mesh->render();
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    setUniform(g_program, "u_reprojectPass", false);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+// Draws the octree with the shader, or with the CPU renderer when it is enabled
+void renderScene() {
+    // Edits and flattening the tree again, when switching layouts, change the voxels the hits saw
+    if (g_octree->editCount() != g_hitsEditCount) {
+        invalidateHits();
+    }
+    if (g_useCPURenderer) {
+        // The camera moves on in the meantime
+        g_hitsValid = false;
+        renderCPU();
+        return;
+    }
 
     const glm::mat4 viewMatrix = g_camera.computeViewMatrix();
     const glm::mat4 projMatrix = g_camera.computeProjectionMatrix();
@@ -231,20 +516,112 @@ void render() {
 
     setUniform(g_program, "u_time", static_cast<float>(glfwGetTime()));
 
+    {
+        PROFILE_ZONE("flushOctree");
+        g_octree->flush();
+    }
+
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_3D, g_voxelArray->octree->textureID);
+    glBindTexture(GL_TEXTURE_BUFFER, g_octree->textureID);
     setUniform(g_program, "u_octreeTex", 0);
-    setUniform(g_program, "u_octreeDepth", (int)(g_voxelArray->octree->treeDepth));
+    setUniform(g_program, "u_octreeDepth", (int)(g_octree->treeDepth));
+    setUniform(g_program, "u_compactNodes", g_octree->nodePool().format == NodeFormat::Compact);
+    setUniform(g_program, "u_skipEmpty", g_traceSettings.skipEmpty);
+    setUniform(g_program, "u_resumeLookups", g_traceSettings.resumeLookups);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, g_octree->lodTextureID);
+    setUniform(g_program, "u_lodTex", 1);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, g_octree->farTextureID);
+    setUniform(g_program, "u_farTex", 3);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_BUFFER, g_octree->paletteTextureID);
+    setUniform(g_program, "u_paletteTex", 4);
+    setUniform(g_program, "u_paletteSize", static_cast<int>(g_octree->nodePool().paletteSize));
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, g_octree->rankTextureID);
+    setUniform(g_program, "u_rankTex", 5);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_BUFFER, g_octree->attributeTextureID);
+    setUniform(g_program, "u_attributeTex", 6);
+    setUniform(g_program, "u_attributes", g_octree->nodePool().ranks != nullptr);
+    setUniform(g_program, "u_bricks", g_octree->nodePool().bricks);
+    setUniform(g_program, "u_lodFootprint", lodFootprint(g_traceSettings, g_camera, viewport[3]));
+    glActiveTexture(GL_TEXTURE0);
+
+    // Samplers of different types cannot share a unit, even when unused
+    setUniform(g_program, "u_coneTex", 2);
+    setUniform(g_program, "u_resolution", glm::ivec2(viewport[2], viewport[3]));
+    setUniform(g_program, "u_conePrepass", g_traceSettings.conePrepass);
+    setUniform(g_program, "u_hitImage", 0);
+    setUniform(g_program, "u_reprojImage", 1);
+    setUniform(g_program, "u_reprojection", g_traceSettings.temporalReprojection);
+
+    const bool prepasses = g_traceSettings.conePrepass || g_traceSettings.temporalReprojection;
+    if (prepasses) g_prepassTimer.begin();
+    if (g_traceSettings.temporalReprojection) {
+        renderReprojection(viewport);
+    }
+    if (g_traceSettings.conePrepass) {
+        renderPrepass(viewport);
+    }
+    if (prepasses) g_prepassTimer.end();
 
     // Render objects
     
+    g_passTimer.begin();
     g_mesh->render();
+    g_passTimer.end();
+
+    g_hitsValid = g_traceSettings.temporalReprojection;
+    g_prevInvViewMat = glm::inverse(viewMatrix);
+    g_prevInvProjMat = glm::inverse(projMatrix);
+}
+
+// The main rendering call
+void render() {
+    PROFILE_ZONE("render");
+
+    if(g_reloadShaders) {
+        reloadShaders();
+        g_reloadShaders = false;
+    }
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);  // Erase the color and z buffers.
+
+    renderScene();
 
     renderUI();
 }
 
+// Orbit around the centre of the volume
+void updateCamera() {
+    float size = static_cast<float>(1 << g_octree->treeDepth);
+    glm::vec3 targetPosition = glm::vec3(size, size, size) * 0.5f;
+    g_camera.setTarget(targetPosition);
+
+    glm::vec3 cameraOffset = glm::normalize(glm::vec3(cos(g_cameraAngleX), 0.0f, sin(g_cameraAngleX))) * (1.1f + g_cameraDistance);
+    g_camera.setPosition(targetPosition + cameraOffset);
+}
+
 // Update any accessible variable based on the current time
 void update(const float currentTimeInSec) {
+    PROFILE_ZONE("update");
+
+    // Frame time graphs, the GPU one lagging a few frames behind
+    static uint64_t lastFrame = profilerNow();
+    uint64_t now = profilerNow();
+    g_frameTimes.add((now - lastFrame) * 1e-6f);
+    lastFrame = now;
+    if (g_passTimer.collect()) {
+        g_gpuTimes.add(g_passTimer.lastTime());
+    }
+    if (g_prepassTimer.collect()) {
+        g_prepassTimes.add(g_prepassTimer.lastTime());
+    }
 
     // Update the FPS computation
     static int frameCount = 0;
@@ -257,17 +634,12 @@ void update(const float currentTimeInSec) {
         lastTime = currentTimeInSec;
     }
 
-    // Update the camera position
-
-    glm::vec3 targetPosition = glm::vec3(g_voxelArray->size, g_voxelArray->size, g_voxelArray->size) * 0.5f;
-    g_camera.setTarget(targetPosition);
-
-    glm::vec3 cameraOffset = glm::normalize(glm::vec3(cos(g_cameraAngleX), 0.0f, sin(g_cameraAngleX))) * (1.1f + g_cameraDistance);
-    g_camera.setPosition(targetPosition + cameraOffset);
+    updateCamera();
 }
 
 void reloadShaders() {
-    
+    PROFILE_ZONE("reloadShaders");
+
     GLuint g_newProgram = glCreateProgram();
     loadShader(g_newProgram, GL_VERTEX_SHADER, "../resources/vertexShader.glsl");
     loadShader(g_newProgram, GL_FRAGMENT_SHADER, "../resources/fragmentShader.glsl");
@@ -287,14 +659,197 @@ void reloadShaders() {
 
 }
 
+void parseArguments(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--dag") {
+            g_useDAG = true;
+        } else if (arg == "--load" && i + 1 < argc) {
+            g_loadFile = argv[++i];
+        } else if (arg == "--save" && i + 1 < argc) {
+            g_saveFile = argv[++i];
+        } else if (arg == "--cpu-reference" && i + 1 < argc) {
+            g_cpuReferenceFile = argv[++i];
+        } else if (arg == "--cpu-render" && i + 1 < argc) {
+            g_cpuRenderFile = argv[++i];
+        } else if (arg == "--no-skip") {
+            g_traceSettings.skipEmpty = false;
+        } else if (arg == "--no-resume") {
+            g_traceSettings.resumeLookups = false;
+        } else if (arg == "--no-lod") {
+            g_traceSettings.levelOfDetail = false;
+        } else if (arg == "--no-prepass") {
+            g_traceSettings.conePrepass = false;
+        } else if (arg == "--reprojection") {
+            g_traceSettings.temporalReprojection = true;
+        } else if (arg == "--compact") {
+            g_nodeFormat = NodeFormat::Compact;
+        } else if (arg == "--palette" && i + 1 < argc) {
+            g_paletteBits = std::min(std::max(1, std::atoi(argv[++i])), max_palette_bits);
+        } else if (arg == "--attributes") {
+            g_attributeStream = true;
+        } else if (arg == "--bricks") {
+            g_bricks = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            g_threadCount = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--simd" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (!parseSimdLevel(name, g_simdLevel)) {
+                std::cerr << "WARNING: Unknown instruction set '" << name << "', expected scalar, sse4, avx2 or avx512" << std::endl;
+            }
+        } else if (arg == "--cpu") {
+            g_useCPURenderer = true;
+        } else if (arg == "--depth" && i + 1 < argc) {
+            g_sceneDepth = std::min(std::max(1, std::atoi(argv[++i])), max_octree_depth);
+        } else if (arg == "--resolution" && i + 1 < argc) {
+            std::string resolution = argv[++i];
+            size_t x = resolution.find('x');
+            g_windowWidth = std::max(1, std::atoi(resolution.c_str()));
+            g_windowHeight = x == std::string::npos ? g_windowWidth : std::max(1, std::atoi(resolution.c_str() + x + 1));
+        } else if (arg == "--benchmark" && i + 1 < argc) {
+            g_benchmarkFile = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            g_traceFile = argv[++i];
+            g_traceOnExit = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            g_benchmarkFrames = std::max(1, std::atoi(argv[++i]));
+        } else {
+            std::cerr << "WARNING: Unknown argument '" << arg << "'" << std::endl;
+        }
+    }
+}
+
+// Renders the default view on the CPU without creating a window, either with the
+// single-threaded reference or with the tiled renderer
+int renderHeadless() {
+    loadScene();
+
+    Image image;
+    image.resize(g_windowWidth, g_windowHeight);
+    g_camera.setAspectRatio(static_cast<float>(image.width) / static_cast<float>(image.height));
+    g_camera.setNear(0.1);
+    g_camera.setFar(80);
+    g_camera.setFoV(90);
+    updateCamera();
+
+    if (!g_cpuReferenceFile.empty()) {
+        renderReference(g_octree->nodePool(), g_traceSettings, g_camera, image);
+        return writeImage(g_cpuReferenceFile, image) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    CPURenderer renderer(g_threadCount);
+    renderer.settings = g_traceSettings;
+    renderer.simd = g_simdLevel;
+    renderer.render(g_octree->nodePool(), g_camera, image);
+    std::cout << "Rendered " << image.width << "x" << image.height << " on " << renderer.threadCount() << " threads ("
+              << simdLevelName(packetTracer(renderer.simd).level) << ") in "
+              << renderer.frameTime() * 1000.0 << " ms, prepass " << renderer.prepassTime() * 1000.0 << " ms (" << renderer.raysPerSecond() * 1e-6 << " Mrays/s, "
+              << renderer.stats().stepsPerRay() << " steps/ray, " << renderer.stats().fetchesPerRay() << " fetches/ray)" << std::endl;
+    return writeImage(g_cpuRenderFile, image) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Renders g_benchmarkFrames frames along an orbit and writes their timings to g_benchmarkFile.
+// With --cpu no window is created, so it also runs on machines without any GL driver.
+int runBenchmark() {
+    BenchmarkInfo info;
+    info.scene = g_loadFile.empty() ? "sphere" : g_loadFile;
+    info.width = g_windowWidth;
+    info.height = g_windowHeight;
+    info.settings = g_traceSettings;
+
+    BenchmarkResults results;
+    if (g_useCPURenderer) {
+        loadScene();
+
+        Image image;
+        image.resize(g_windowWidth, g_windowHeight);
+        g_camera.setAspectRatio(static_cast<float>(image.width) / static_cast<float>(image.height));
+        g_camera.setNear(0.1);
+        g_camera.setFar(80);
+        g_camera.setFoV(90);
+
+        CPURenderer renderer(g_threadCount);
+        renderer.settings = g_traceSettings;
+        renderer.simd = g_simdLevel;
+        for (int frame = 0; frame < g_benchmarkFrames; frame++) {
+            orbitCamera(g_camera, g_octree->treeDepth, frame, g_benchmarkFrames);
+            renderer.render(g_octree->nodePool(), g_camera, image);
+            bool prepasses = g_traceSettings.conePrepass || g_traceSettings.temporalReprojection;
+            results.addFrame(renderer.frameTime(), -1, prepasses ? renderer.prepassTime() : -1, &renderer.stats());
+        }
+        info.renderer = "cpu";
+        info.device = std::to_string(renderer.threadCount()) + " threads, " + simdLevelName(packetTracer(renderer.simd).level);
+    } else {
+        init();
+        glViewport(0, 0, g_windowWidth, g_windowHeight);
+        g_camera.setAspectRatio(static_cast<float>(g_windowWidth) / static_cast<float>(g_windowHeight));
+
+        // The first frame pays for shader compilation and the octree upload
+        orbitCamera(g_camera, g_octree->treeDepth, 0, g_benchmarkFrames);
+        renderScene();
+        glFinish();
+        g_passTimer.collect();
+        g_prepassTimer.collect();
+
+        for (int frame = 0; frame < g_benchmarkFrames; frame++) {
+            orbitCamera(g_camera, g_octree->treeDepth, frame, g_benchmarkFrames);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            renderScene();
+            glFinish();
+            double cpuTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            // The passes are finished, so their queries are available right away
+            double gpuTime = g_passTimer.collect() ? g_passTimer.lastTime() * 1e-3 : -1;
+            double prepassTime = g_prepassTimer.collect() ? g_prepassTimer.lastTime() * 1e-3 : -1;
+            results.addFrame(cpuTime, gpuTime, prepassTime);
+
+            glfwSwapBuffers(g_window);
+            glfwPollEvents();
+        }
+
+        info.renderer = "gpu";
+        info.device = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    }
+
+    info.depth = g_octree->treeDepth;
+    info.nodeBlocks = g_octree->blockPool().size / 8;
+    info.nodeFormat = nodeFormatName(g_octree->nodePool().format);
+    info.poolBytes = poolBytes(g_octree->nodePool());
+    info.paletteColors = g_octree->nodePool().paletteSize;
+    info.attributeCount = g_octree->nodePool().attributeCount;
+    info.bricks = g_octree->nodePool().bricks;
+    info.dag = g_octree->isDAG();
+
+    bool written = results.write(g_benchmarkFile, info);
+    results.printSummary();
+    if (!g_useCPURenderer) clear();
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char **argv) {
+    parseArguments(argc, argv);
+    if (!g_benchmarkFile.empty()) {
+        return runBenchmark();
+    }
+    if (!g_cpuReferenceFile.empty() || !g_cpuRenderFile.empty()) {
+        return renderHeadless();
+    }
+    setProfileThreadName("Main");
     init();
     while (!glfwWindowShouldClose(g_window)) {
         update(static_cast<float>(glfwGetTime()));
         render();
-        glfwSwapBuffers(g_window);
+        {
+            PROFILE_ZONE("swapBuffers");
+            glfwSwapBuffers(g_window);
+        }
         glfwPollEvents();
     }
     clear();
+    if (g_traceOnExit && writeChromeTrace(g_traceFile)) {
+        std::cout << "Saved " << g_traceFile << std::endl;
+    }
     return EXIT_SUCCESS;
 }
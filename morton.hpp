@@ -0,0 +1,81 @@
+/*
+    morton.hpp
+    author: Telo PHILIPPE
+
+    Morton (Z-order) codes matching the octree child ordering, and a parallel radix sort
+    used to build octrees bottom-up.
+*/
+
+#ifndef MORTON_HPP
+#define MORTON_HPP
+
+#include "parallel.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Interleaves the bits of x, y and z so that every group of 3 bits is a child index
+// (x + (y << 1) + (z << 2)), the most significant group being the child of the root.
+inline uint64_t mortonEncode(uint32_t x, uint32_t y, uint32_t z) {
+    uint64_t code = 0;
+    for (int b = 0; b < 21; b++) {
+        code |= (uint64_t)((x >> b) & 1) << (3 * b);
+        code |= (uint64_t)((y >> b) & 1) << (3 * b + 1);
+        code |= (uint64_t)((z >> b) & 1) << (3 * b + 2);
+    }
+    return code;
+}
+
+inline void mortonDecode(uint64_t code, uint32_t& x, uint32_t& y, uint32_t& z) {
+    x = y = z = 0;
+    for (int b = 0; b < 21; b++) {
+        x |= (uint32_t)((code >> (3 * b)) & 1) << b;
+        y |= (uint32_t)((code >> (3 * b + 1)) & 1) << b;
+        z |= (uint32_t)((code >> (3 * b + 2)) & 1) << b;
+    }
+}
+
+struct MortonVoxel {
+    uint64_t code;
+    int value;
+};
+
+// Sorts voxels by code, using only the lowest `bits` bits of the codes.
+// LSD radix sort on 8-bit digits, each pass histogrammed and scattered by all workers.
+inline void sortMortonVoxels(std::vector<MortonVoxel>& voxels, int bits) {
+    const size_t count = voxels.size();
+    std::vector<MortonVoxel> buffer(count);
+    std::vector<size_t> histograms(workerCount() * 256);
+
+    for (int shift = 0; shift < bits; shift += 8) {
+        std::fill(histograms.begin(), histograms.end(), 0);
+
+        parallelForRanges(count, [&](size_t worker, size_t begin, size_t end) {
+            size_t* histogram = &histograms[worker * 256];
+            for (size_t i = begin; i < end; i++) {
+                histogram[(voxels[i].code >> shift) & 0xFF]++;
+            }
+        });
+
+        // Exclusive prefix sum in (digit, worker) order keeps the sort stable
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            for (size_t worker = 0; worker < workerCount(); worker++) {
+                size_t n = histograms[worker * 256 + digit];
+                histograms[worker * 256 + digit] = offset;
+                offset += n;
+            }
+        }
+
+        parallelForRanges(count, [&](size_t worker, size_t begin, size_t end) {
+            size_t* histogram = &histograms[worker * 256];
+            for (size_t i = begin; i < end; i++) {
+                buffer[histogram[(voxels[i].code >> shift) & 0xFF]++] = voxels[i];
+            }
+        });
+
+        voxels.swap(buffer);
+    }
+}
+
+#endif  // MORTON_HPP
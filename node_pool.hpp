@@ -0,0 +1,580 @@
+/*
+    node_pool.hpp
+    author: Telo PHILIPPE
+
+    Encoding of the flattened octree uploaded to the GPU, and a CPU mirror of the
+    lookup done by sampleOctree in resources/fragmentShader.glsl.
+
+    The pool is a linear array of 32-bit entries grouped in blocks of 8, one block per
+    interior node: entry 8 * n + c describes child c of node n, with
+    c = x + (y << 1) + (z << 2). The root is block 0. An entry is either
+    - 0 for an empty child,
+    - value_flag | rgb for a leaf of colour rgb, or value_flag | i for a leaf of colour
+      palette[i] when the pool has a palette (see palette.hpp),
+    - address_flag | (n - b + address_bias) for an interior child stored in block n, b being
+      the block holding the entry. Offsets being relative, children written right after
+      their parent stay in reach however large the pool grows.
+    - far_flag | i for an interior child stored in block far[i], when n - b is out of the
+      range of address offsets. Far pointers are kept in an array of their own.
+
+    Next to the pool, a level of detail array holds one entry per block: the node stored in
+    block n pre-filtered as occupancy << 24 | rgb, with rgb the average colour of its solid
+    voxels and occupancy the fraction of them, 255 when the node is full. A lookup may stop
+    on an interior node and use this entry in place of its subtree. Level of detail colours
+    are rgb, palette or not.
+
+    A block pool may instead keep geometry and colours apart. Its leaf entries are then
+    value_flag alone, so blocks are shared by every node of the same shape whatever its
+    colours, and a rank array next to the pool holds for entry 8 * n + c the number of
+    leaves in children 0 to c - 1 of node n. Summing the ranks of the entries read on the
+    way down gives the index of a leaf in the attribute array, which lists the leaf values
+    (rgb or palette indices) in depth-first order. Such pools have no level of detail
+    entries: a lookup stopping on an interior node takes the colour of its first leaf.
+
+    The bottom levels of a block pool may be stored as bricks instead: nodes brick_levels
+    above the voxels, 8 voxels wide, are then written as a run of brick_header_size entries
+    and the values of their solid voxels, padded to whole blocks and reached like any other
+    block. The first 16 entries hold one occupancy bit per voxel in Morton order, which is
+    the depth-first order of the children the brick replaces, so that every 2x2x2 cell is a
+    byte and every 4x4x4 octant two entries. The next 4 hold the number of solid voxels
+    before each octant, as 16-bit halves. Voxel values follow in the same order, packed like
+    the leaves of compact pools. The level of detail entry of a brick is the one of its
+    first block, those of the other blocks are unused.
+*/
+
+#ifndef NODE_POOL_HPP
+#define NODE_POOL_HPP
+
+#include "gl_includes.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+const int value_flag = 0xF0000000;
+const int value_mask = 0x00FFFFFF;
+
+const int address_flag = 0x0F000000;
+const int address_mask = 0x00FFFFFF;
+const int address_bias = 0x00800000;    // Offsets range from -address_bias to address_mask - address_bias
+
+const int far_flag = 0x0E000000;
+const int far_mask = 0x00FFFFFF;
+
+// Largest distance in blocks written as an address offset, address_bias unless the build lowers
+// it: the *_far tests do, so that far pointers are used by trees small enough to test
+#ifndef OCTREE_NEAR_RANGE
+#define OCTREE_NEAR_RANGE address_bias
+#endif
+const int near_range = OCTREE_NEAR_RANGE;
+
+const int lod_occupancy_shift = 24;
+
+enum class NodeFormat {
+    Blocks,     // 8 entries per interior node, level of detail entries apart
+    Compact     // Descriptors with child masks, level of detail entries inline
+};
+
+const int compact_descriptor_size = 3;
+
+// Leaves of a compact pool with a palette hold their index alone, packed several per entry:
+// four 8-bit indices for palettes of up to 256 colours, two 16-bit indices above
+const size_t compact_byte_palette_size = 256;
+
+// Bricks replace the brick_levels bottom levels of block pools that have them
+const int brick_levels = 3;
+const int brick_mask_words = 16;    // One bit per voxel of the 8x8x8 brick
+const int brick_header_size = 20;   // Occupancy bits, then the solid voxels before each octant
+
+// Read-only view on a flattened octree, either owned by the caller or mapped from a file
+struct NodePool {
+    const GLuint* data;
+    size_t size;
+    int depth;
+    const GLuint* lod;  // size / 8 level of detail entries of a block pool, null if there are none
+    const GLuint* far;  // Far pointers of a block pool
+    size_t farCount;
+    NodeFormat format;
+    const GLuint* palette;  // Colours of the leaves, null if leaves hold their colour
+    size_t paletteSize;
+    const GLuint* ranks;        // size ranks of a block pool with an attribute stream, null otherwise
+    const GLuint* attributes;   // Leaf values in depth-first order
+    size_t attributeCount;
+    bool bricks;        // The bottom levels of the block pool are bricks
+};
+
+inline const char* nodeFormatName(NodeFormat format) {
+    return format == NodeFormat::Compact ? "compact" : "blocks";
+}
+
+// Memory taken by the pool and its level of detail entries
+inline size_t poolBytes(const NodePool& pool) {
+    size_t entries = pool.size + pool.farCount + pool.paletteSize + (pool.format == NodeFormat::Blocks && pool.lod ? pool.size / 8 : 0)
+        + (pool.ranks ? pool.size : 0) + pool.attributeCount;
+    return entries * sizeof(GLuint);
+}
+
+// Level of the nodes stored as bricks, -1 if there are none
+inline int brickLevel(const NodePool& pool) {
+    return pool.bricks && pool.depth >= brick_levels ? pool.depth - brick_levels : -1;
+}
+
+inline bool hasLevelOfDetail(const NodePool& pool) {
+    return pool.format == NodeFormat::Compact || pool.lod || pool.attributes;
+}
+
+// Colour of a leaf entry as rgb
+inline GLuint leafColor(const GLuint* palette, GLuint cell) {
+    return palette ? palette[cell & value_mask] : cell & value_mask;
+}
+
+// Colour as rgb of the leaf entry cell, rank being the sum of the ranks on its path.
+// fetches is incremented when the colour is read from the attribute stream.
+inline GLuint leafColor(const NodePool& pool, GLuint cell, GLuint rank, uint64_t& fetches) {
+    if (pool.attributes) {
+        fetches++;
+        cell = pool.attributes[rank];
+    }
+    return leafColor(pool.palette, cell);
+}
+
+// Number of leaves in the children of node before child c, 0 without an attribute stream
+inline GLuint childRank(const NodePool& pool, GLuint node, int c, uint64_t& fetches) {
+    if (!pool.ranks) {
+        return 0;
+    }
+    fetches++;
+    return pool.ranks[static_cast<size_t>(node) * 8 + c];
+}
+
+// Compact leaves are packed 1 << compactLeafShift per entry
+inline int compactLeafShift(size_t paletteSize) {
+    return paletteSize == 0 ? 0 : (paletteSize <= compact_byte_palette_size ? 2 : 1);
+}
+
+// Leaf leaf of an array of leaves packed 1 << shift per entry, in the block format
+inline GLuint packedLeaf(const GLuint* entries, GLuint leaf, int shift) {
+    GLuint entry = entries[leaf >> shift];
+    if (shift == 0) {
+        return entry;
+    }
+    GLuint slotBits = 32 >> shift;
+    return ((entry >> ((leaf & ((1u << shift) - 1)) * slotBits)) & ((1u << slotBits) - 1)) | value_flag;
+}
+
+// Stores the leaf entry cell as leaf leaf of an array of leaves packed 1 << shift per entry,
+// starting at first in out, zeroed beforehand
+inline void packLeaf(std::vector<GLuint>& out, size_t first, GLuint leaf, GLuint cell, int shift) {
+    if (shift == 0) {
+        out[first + leaf] = cell;
+    } else {
+        out[first + (leaf >> shift)] |= (cell & value_mask) << ((leaf & ((1u << shift) - 1)) * (32 >> shift));
+    }
+}
+
+// Block of the interior child described by cell, an entry of block. False for empty children and leaves.
+inline bool childBlock(GLuint cell, GLuint block, const GLuint* far, GLuint& child) {
+    GLuint tag = cell & ~address_mask;
+    if (tag == (GLuint)address_flag) {
+        child = block + (cell & address_mask) - address_bias;
+        return true;
+    } else if (tag == (GLuint)far_flag) {
+        child = far[cell & far_mask];
+        return true;
+    }
+    return false;
+}
+
+// Entry of block pointing to block child without a far pointer, if their distance allows it
+inline bool nearAddress(GLuint block, GLuint child, GLuint& cell) {
+    int64_t offset = static_cast<int64_t>(child) - static_cast<int64_t>(block) + address_bias;
+    if (offset < 0 || offset > address_mask || offset < address_bias - near_range || offset > address_bias + near_range) {
+        return false;
+    }
+    cell = static_cast<GLuint>(offset) | address_flag;
+    return true;
+}
+
+// Number of bits set in an 8-bit mask
+inline GLuint bitCount8(GLuint m) {
+    m = m - ((m >> 1) & 0x55);
+    m = (m & 0x33) + ((m >> 2) & 0x33);
+    return (m + (m >> 4)) & 0x0F;
+}
+
+// Entry c of node in the block format, whatever the format of the pool, interior children
+// being returned as address_flag with their node in child. fetches is incremented by the
+// number of pool and far pointer reads, a descriptor counting as one.
+inline GLuint childEntry(const NodePool& pool, GLuint node, int c, GLuint& child, uint64_t& fetches) {
+    fetches++;
+    if (pool.format == NodeFormat::Blocks) {
+        GLuint cell = pool.data[static_cast<size_t>(node) * 8 + c];
+        if (!childBlock(cell, node, pool.far, child)) {
+            return cell;
+        }
+        if ((cell & ~far_mask) == (GLuint)far_flag) fetches++;
+        return address_flag;
+    }
+    GLuint masks = pool.data[node];
+    GLuint children = pool.data[node + 1];
+    GLuint bit = 1u << c;
+    GLuint leaves = (masks >> 8) & 0xFF;
+    GLuint interior = masks & ~leaves & 0xFF;
+    if (leaves & bit) {
+        fetches++;
+        return packedLeaf(pool.data + children + compact_descriptor_size * bitCount8(interior), bitCount8(leaves & (bit - 1)), compactLeafShift(pool.paletteSize));
+    } else if (interior & bit) {
+        child = children + compact_descriptor_size * bitCount8(interior & (bit - 1));
+        return address_flag;
+    }
+    return 0;
+}
+
+// Number of bits set in a 32-bit mask
+inline GLuint bitCount32(GLuint m) {
+    m = m - ((m >> 1) & 0x55555555u);
+    m = (m & 0x33333333u) + ((m >> 2) & 0x33333333u);
+    m = (m + (m >> 4)) & 0x0F0F0F0Fu;
+    m += m >> 8;
+    m += m >> 16;
+    return m & 0x3F;
+}
+
+// Index of voxel (x, y, z) in its brick, from its last brick_levels child indices
+inline GLuint brickVoxel(int x, int y, int z) {
+    GLuint m = 0;
+    for (int c = brick_levels - 1; c >= 0; c--) {
+        m = m << 3 | ((x >> c) & 1) | (((y >> c) & 1) << 1) | (((z >> c) & 1) << 2);
+    }
+    return m;
+}
+
+// Entry of voxel (x, y, z) in the brick stored from block brick, in the block format. d is set
+// to the level at which a lookup in the nodes the brick replaces would stop: depth - 1 for solid
+// voxels, and for empty ones the level above the coarsest empty cell holding them, found from
+// the occupancy bits. fetches is incremented by the number of entries read.
+inline GLuint brickEntry(const NodePool& pool, GLuint brick, int x, int y, int z, int& d, uint64_t& fetches) {
+    const GLuint* entries = pool.data + static_cast<size_t>(brick) * 8;
+    const GLuint m = brickVoxel(x, y, z);
+    const GLuint w = m >> 5, bit = m & 31;
+    const GLuint mask = entries[w];
+    fetches++;
+    d = pool.depth - 1;
+    if (!((mask >> bit) & 1)) {
+        if (((mask >> (bit & 24)) & 0xFF) == 0) {
+            d--;
+            fetches++;
+            if ((mask | entries[w ^ 1]) == 0) d--;
+        }
+        return 0;
+    }
+    // Solid voxels before the octant, then before the voxel within it
+    GLuint leaf = (entries[brick_mask_words + (w >> 2)] >> ((w & 2) * 8)) & 0xFFFF;
+    fetches++;
+    if (w & 1) {
+        leaf += bitCount32(entries[w - 1]);
+        fetches++;
+    }
+    leaf += bitCount32(mask & ((1u << bit) - 1));
+    fetches++;
+    return packedLeaf(entries + brick_header_size, leaf, compactLeafShift(pool.paletteSize));
+}
+
+// True if the cell levels below the brick stored from block brick that holds voxel (x, y, z) has
+// a solid voxel, levels being 1 to brick_levels
+inline bool brickCellOccupied(const NodePool& pool, GLuint brick, int x, int y, int z, int levels, uint64_t& fetches) {
+    const GLuint* entries = pool.data + static_cast<size_t>(brick) * 8;
+    const GLuint m = brickVoxel(x, y, z);
+    const GLuint w = m >> 5, bit = m & 31;
+    const GLuint mask = entries[w];
+    fetches++;
+    if (levels >= 3) {
+        return (mask >> bit) & 1;
+    } else if (levels == 2) {
+        return ((mask >> (bit & 24)) & 0xFF) != 0;
+    }
+    fetches++;
+    return (mask | entries[w ^ 1]) != 0;
+}
+
+// Level of detail entry of an interior node, pool must have some. With an attribute stream,
+// rank is the index of the first leaf of the node, whose colour stands for it, full.
+inline GLuint lodEntry(const NodePool& pool, GLuint node, GLuint rank, uint64_t& fetches) {
+    fetches++;
+    if (pool.attributes) {
+        return 0xFFu << lod_occupancy_shift | leafColor(pool.palette, pool.attributes[rank]);
+    }
+    return pool.format == NodeFormat::Blocks ? pool.lod[node] : pool.data[node + 2];
+}
+
+// Level of detail entry of the node stored in block n of data, from the level of detail
+// entries of its interior children. Leaves count as full, colours are averaged weighted
+// by occupancy.
+inline GLuint filterBlock(const GLuint* data, const GLuint* far, const GLuint* palette, GLuint n, const GLuint* lod) {
+    GLuint occupancy = 0, r = 0, g = 0, b = 0;
+    for (int i = 0; i < 8; i++) {
+        GLuint cell = data[static_cast<size_t>(n) * 8 + i];
+        GLuint childOccupancy, rgb, child;
+        if ((cell & ~value_mask) == (GLuint)value_flag) {
+            childOccupancy = 255;
+            rgb = leafColor(palette, cell);
+        } else if (childBlock(cell, n, far, child)) {
+            GLuint entry = lod[child];
+            childOccupancy = entry >> lod_occupancy_shift;
+            rgb = entry & value_mask;
+        } else {
+            continue;
+        }
+        occupancy += childOccupancy;
+        r += childOccupancy * ((rgb >> 16) & 0xFF);
+        g += childOccupancy * ((rgb >> 8) & 0xFF);
+        b += childOccupancy * (rgb & 0xFF);
+    }
+    if (occupancy == 0) {
+        return 0;
+    }
+    // Rounded up, so that a node holding anything never looks empty
+    GLuint average = (occupancy + 7) / 8;
+    return average << lod_occupancy_shift | ((r + occupancy / 2) / occupancy) << 16 | ((g + occupancy / 2) / occupancy) << 8 | ((b + occupancy / 2) / occupancy);
+}
+
+// Level of detail entry of the brick stored from block n of data: every voxel counts, the
+// colour is their average
+inline GLuint filterBrick(const GLuint* data, const GLuint* palette, size_t paletteSize, GLuint n) {
+    const GLuint* entries = data + static_cast<size_t>(n) * 8;
+    GLuint count = 0;
+    for (int i = 0; i < brick_mask_words; i++) {
+        count += bitCount32(entries[i]);
+    }
+    if (count == 0) {
+        return 0;
+    }
+    const int shift = compactLeafShift(paletteSize);
+    GLuint r = 0, g = 0, b = 0;
+    for (GLuint leaf = 0; leaf < count; leaf++) {
+        GLuint rgb = leafColor(palette, packedLeaf(entries + brick_header_size, leaf, shift));
+        r += (rgb >> 16) & 0xFF;
+        g += (rgb >> 8) & 0xFF;
+        b += rgb & 0xFF;
+    }
+    GLuint occupancy = (count * 255 + 511) / 512;
+    return occupancy << lod_occupancy_shift | ((r + count / 2) / count) << 16 | ((g + count / 2) / count) << 8 | ((b + count / 2) / count);
+}
+
+// Computes the level of detail entry of block n, a node at level d, and of the blocks below
+// it, once each
+inline void filterBlocks(const NodePool& pool, GLuint n, int d, std::vector<GLuint>& lod, std::vector<bool>& done) {
+    if (done[n]) {
+        return;
+    }
+    if (d == brickLevel(pool)) {
+        lod[n] = filterBrick(pool.data, pool.palette, pool.paletteSize, n);
+        done[n] = true;
+        return;
+    }
+    for (int i = 0; i < 8; i++) {
+        GLuint child;
+        if (childBlock(pool.data[static_cast<size_t>(n) * 8 + i], n, pool.far, child)) {
+            filterBlocks(pool, child, d + 1, lod, done);
+        }
+    }
+    lod[n] = filterBlock(pool.data, pool.far, pool.palette, n, lod.data());
+    done[n] = true;
+}
+
+// Level of detail entries of a pool that has none. Pools with an attribute stream have no
+// colours to filter and get none.
+inline std::vector<GLuint> filterPool(const NodePool& pool) {
+    std::vector<GLuint> lod(pool.attributes ? 0 : pool.size / 8, 0);
+    std::vector<bool> done(lod.size(), false);
+    if (!lod.empty()) {
+        filterBlocks(pool, 0, 0, lod, done);
+    }
+    return lod;
+}
+
+// Masks of the compact descriptor of block n: valid | leaf << 8
+inline GLuint compactMasks(const NodePool& blocks, GLuint n) {
+    GLuint masks = 0;
+    for (int i = 0; i < 8; i++) {
+        GLuint cell = blocks.data[static_cast<size_t>(n) * 8 + i], child;
+        if ((cell & ~value_mask) == (GLuint)value_flag) masks |= 0x101u << i;
+        else if (childBlock(cell, n, blocks.far, child)) masks |= 1u << i;
+    }
+    return masks;
+}
+
+// Writes the children array of block n and of the blocks below it, once each, and returns
+// its index. written holds the index of the arrays already written, 0 for none.
+inline GLuint compactChildren(const NodePool& blocks, const GLuint* lod, GLuint n, std::vector<GLuint>& out, std::vector<GLuint>& written) {
+    if (written[n]) {
+        return written[n];
+    }
+    const GLuint masks = compactMasks(blocks, n);
+    const GLuint leaves = bitCount8(masks >> 8);
+    const GLuint interior = bitCount8(masks & 0xFF) - leaves;
+    const int shift = compactLeafShift(blocks.paletteSize);
+    GLuint children = static_cast<GLuint>(out.size());
+    written[n] = children;
+    out.resize(out.size() + compact_descriptor_size * interior + ((leaves + (1u << shift) - 1) >> shift), 0);
+
+    GLuint descriptor = children, leafEntries = children + compact_descriptor_size * interior, leaf = 0;
+    for (int i = 0; i < 8; i++) {
+        GLuint cell = blocks.data[static_cast<size_t>(n) * 8 + i], block;
+        if ((cell & ~value_mask) == (GLuint)value_flag) {
+            packLeaf(out, leafEntries, leaf++, cell, shift);
+        } else if (childBlock(cell, n, blocks.far, block)) {
+            // out may grow while the children of the child are written
+            GLuint grandchildren = compactChildren(blocks, lod, block, out, written);
+            out[descriptor] = compactMasks(blocks, block);
+            out[descriptor + 1] = grandchildren;
+            out[descriptor + 2] = lod[block];
+            descriptor += compact_descriptor_size;
+        }
+    }
+    return children;
+}
+
+// Compact copy of a block pool, blocks shared by several parents keeping a single children array.
+// Returns an empty pool if it would not fit in 32-bit indices, if leaves are in an attribute
+// stream, whose ranks the compact format has no room for, or if the pool has bricks.
+inline std::vector<GLuint> compactPool(const NodePool& blocks) {
+    std::vector<GLuint> out;
+    if (blocks.size < 8 || blocks.attributes || blocks.bricks) {
+        return out;
+    }
+    std::vector<GLuint> filtered;
+    const GLuint* lod = blocks.lod;
+    if (!lod) {
+        filtered = filterPool(blocks);
+        lod = filtered.data();
+    }
+
+    out.resize(compact_descriptor_size, 0);
+    std::vector<GLuint> written(blocks.size / 8, 0);
+    GLuint children = compactChildren(blocks, lod, 0, out, written);
+    out[0] = compactMasks(blocks, 0);
+    out[1] = children;
+    out[2] = lod[0];
+
+    if (out.size() > 0xFFFFFFFFull) {
+        std::cerr << "ERROR: Compact node pool needs " << out.size() << " entries, more than 32-bit indices reach" << std::endl;
+        out.clear();
+    }
+    return out;
+}
+
+struct Voxel {
+    glm::vec3 color;
+    glm::vec3 normal;
+};
+
+// Same as sampleOctree in the fragment shader: returns the colour of voxel (x, y, z),
+// black if empty. d is set to the level at which the lookup stopped.
+inline Voxel sampleOctree(const NodePool& pool, int x, int y, int z, int& d) {
+    d = 0;
+    if (x < 0 || y < 0 || z < 0 || x >= 1 << pool.depth || y >= 1 << pool.depth || z >= 1 << pool.depth) return Voxel { glm::vec3(0.0f), glm::vec3(0.0f) };
+
+    GLuint node = 0;
+    GLuint rank = 0;
+    uint64_t fetches = 0;
+    for (d = 0; d < pool.depth; d++) {
+        if (d == brickLevel(pool)) {
+            GLuint cell = brickEntry(pool, node, x, y, z, d, fetches);
+            GLuint rgb = cell ? leafColor(pool.palette, cell) : 0;
+            return Voxel { glm::vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, glm::vec3(0.0f) };
+        }
+        int c = pool.depth - d - 1;
+        int child = ((x >> c) & 1) | (((y >> c) & 1) << 1) | (((z >> c) & 1) << 2);
+
+        GLuint next;
+        GLuint cell = childEntry(pool, node, child, next, fetches);
+        rank += childRank(pool, node, child, fetches);
+
+        if ((cell & ~value_mask) == (GLuint)value_flag) {
+            GLuint rgb = leafColor(pool, cell, rank, fetches);
+            return Voxel { glm::vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, glm::vec3(0.0f) };
+        } else if (cell == (GLuint)address_flag) {
+            node = next;
+        } else {
+            return Voxel { glm::vec3(0.0f), glm::vec3(0.0f) };
+        }
+    }
+    return Voxel { glm::vec3(0.0f), glm::vec3(0.0f) };
+}
+
+// Morton codes hold 21 bits per axis, so no tree is deeper (MAX_OCTREE_DEPTH in the shader)
+const int max_octree_depth = 21;
+
+// Nodes visited by the previous lookup of a ray, from the root down
+struct OctreePath {
+    GLuint nodes[max_octree_depth];
+    GLuint ranks[max_octree_depth];     // Index of the first leaf of each node in the attribute stream
+    int levels = 0;     // Number of valid entries in nodes
+    int x = 0;          // Voxel of the previous lookup
+    int y = 0;
+    int z = 0;
+};
+
+// Same as sampleOctreeFrom in the fragment shader: like sampleOctree, but starts from the
+// deepest node of path whose cell also contains (x, y, z) instead of the root, and stops on
+// interior nodes no wider than lodSize voxels, returning their level of detail colour.
+// coverage is set to the solid fraction of the cell returned: 1 for a voxel, the occupancy of
+// the level of detail entry for a node. fetches is incremented by the number of pool and
+// level of detail entries read.
+inline Voxel sampleOctree(const NodePool& pool, OctreePath& path, int x, int y, int z, float lodSize, int& d, float& coverage, uint64_t& fetches) {
+    d = 0;
+    coverage = 1.0f;
+    if (x < 0 || y < 0 || z < 0 || x >= 1 << pool.depth || y >= 1 << pool.depth || z >= 1 << pool.depth) return Voxel { glm::vec3(0.0f), glm::vec3(0.0f) };
+
+    // Cells at level l are 2^(depth - l) wide, so both voxels share the first depth - bits levels
+    int start = 0;
+    if (path.levels > 0) {
+        int diff = (x ^ path.x) | (y ^ path.y) | (z ^ path.z);
+        int bits = 0;
+        while (diff >> bits) bits++;
+        start = std::min(pool.depth - bits, path.levels - 1);
+    }
+    path.x = x;
+    path.y = y;
+    path.z = z;
+
+    GLuint node = start > 0 ? path.nodes[start] : 0;
+    GLuint rank = start > 0 ? path.ranks[start] : 0;
+    for (d = start; d < pool.depth; d++) {
+        path.nodes[d] = node;
+        path.ranks[d] = rank;
+        path.levels = d + 1;
+        if (d == brickLevel(pool)) {
+            GLuint cell = brickEntry(pool, node, x, y, z, d, fetches);
+            GLuint rgb = cell ? leafColor(pool.palette, cell) : 0;
+            return Voxel { glm::vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, glm::vec3(0.0f) };
+        }
+
+        int c = pool.depth - d - 1;
+        int child = ((x >> c) & 1) | (((y >> c) & 1) << 1) | (((z >> c) & 1) << 2);
+
+        GLuint next;
+        GLuint cell = childEntry(pool, node, child, next, fetches);
+        rank += childRank(pool, node, child, fetches);
+
+        if ((cell & ~value_mask) == (GLuint)value_flag) {
+            GLuint rgb = leafColor(pool, cell, rank, fetches);
+            return Voxel { glm::vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, glm::vec3(0.0f) };
+        } else if (cell == (GLuint)address_flag) {
+            node = next;
+            if (hasLevelOfDetail(pool) && static_cast<float>(1 << c) <= lodSize) {
+                GLuint entry = lodEntry(pool, node, rank, fetches);
+                coverage = static_cast<float>(entry >> lod_occupancy_shift) / 255.0f;
+                return Voxel { glm::vec3((entry & 0xFF0000) >> 16, (entry & 0xFF00) >> 8, entry & 0xFF) / 255.0f, glm::vec3(0.0f) };
+            }
+        } else {
+            return Voxel { glm::vec3(0.0f), glm::vec3(0.0f) };
+        }
+    }
+    return Voxel { glm::vec3(0.0f), glm::vec3(0.0f) };
+}
+
+#endif  // NODE_POOL_HPP
@@ -1,51 +1,841 @@
 #ifndef OCTREE_HPP
 #define OCTREE_HPP
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <memory>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "gl_includes.hpp"
+#include "morton.hpp"
+#include "node_pool.hpp"
+#include "octree_file.hpp"
+#include "palette.hpp"
+#include "parallel.hpp"
 
-const int value_flag = 0xF0000000;
-const int value_mask = 0x00FFFFFF;
+// Nodes are referred to by their 32-bit index in the node pool
+typedef GLuint OctreeNodePtr;
 
-const int address_flag = 0x0F000000;
-const int address_mask = 0x00FFFFFF;
-
-struct OctreeNode;
-
-typedef std::shared_ptr<OctreeNode> OctreeNodePtr;
+const OctreeNodePtr null_node = 0xFFFFFFFF;
 
 struct OctreeNode {
     int value;
     OctreeNodePtr children[8];
+    GLuint block;   // Block of the node in the flattened pool, null_node if not flattened yet
+    GLuint refs;    // Number of parents, more than one only in a DAG
     bool empty;
     bool leaf;
 };
 
+struct DAGStats {
+    GLuint nodesBefore;
+    GLuint nodesAfter;
+    GLuint interiorBefore;
+    GLuint interiorAfter;
+
+    // How many times smaller the node pool emitted by writeData got
+    float compressionRatio() const {
+        return interiorAfter ? static_cast<float>(interiorBefore) / interiorAfter : 1.0f;
+    }
+};
+
+// Conservative classification of a cube of voxels, returned by the bounds of buildImplicit
+struct CellBounds {
+    enum Kind {
+        Empty,      // No voxel of the cube is solid
+        Uniform,    // Every voxel of the cube is solid and of colour value
+        Mixed       // Unknown, the cube is subdivided
+    };
+    Kind kind;
+    int value;
+};
+
+// Cells of 2^5 voxels per side crossing the surface are built in parallel by buildImplicit
+const int implicit_task_depth = 5;
+
+/*
+    Arena holding every node of an octree.
+    Nodes live in fixed-size chunks so they never move once allocated, which keeps
+    references valid while the pool grows. Released nodes are chained in a free list
+    through children[0] and reused by the next allocations.
+*/
+class OctreeNodePool {
+private:
+    static const int chunk_shift = 12;
+    static const GLuint chunk_size = 1 << chunk_shift;
+    static const GLuint chunk_mask = chunk_size - 1;
+
+    std::vector<std::unique_ptr<OctreeNode[]>> chunks;
+    GLuint allocated = 0;
+    GLuint liveNodes = 0;
+    OctreeNodePtr freeList = null_node;
+
+public:
+    OctreeNode& operator[](OctreeNodePtr index) {
+        return chunks[index >> chunk_shift][index & chunk_mask];
+    }
+
+    const OctreeNode& operator[](OctreeNodePtr index) const {
+        return chunks[index >> chunk_shift][index & chunk_mask];
+    }
+
+    OctreeNodePtr allocate() {
+        OctreeNodePtr index;
+        if (freeList != null_node) {
+            index = freeList;
+            freeList = (*this)[index].children[0];
+        } else {
+            if ((allocated & chunk_mask) == 0) {
+                chunks.emplace_back(new OctreeNode[chunk_size]);
+            }
+            index = allocated++;
+        }
+        liveNodes++;
+
+        OctreeNode& node = (*this)[index];
+        node.value = 0;
+        node.block = null_node;
+        node.refs = 1;
+        node.empty = true;
+        node.leaf = false;
+        for (int i = 0; i < 8; i++) {
+            node.children[i] = null_node;
+        }
+        return index;
+    }
+
+    // Reserves count consecutive nodes past the high-water mark, left uninitialised.
+    // Used by the parallel builder, which fills the nodes from several threads.
+    OctreeNodePtr allocateRange(GLuint count) {
+        OctreeNodePtr first = allocated;
+        allocated += count;
+        while (chunks.size() * chunk_size < allocated) {
+            chunks.emplace_back(new OctreeNode[chunk_size]);
+        }
+        liveNodes += count;
+        return first;
+    }
+
+    void release(OctreeNodePtr index) {
+        (*this)[index].children[0] = freeList;
+        freeList = index;
+        liveNodes--;
+    }
+
+    void clear() {
+        chunks.clear();
+        allocated = 0;
+        liveNodes = 0;
+        freeList = null_node;
+    }
+
+    GLuint size() const {
+        return liveNodes;
+    }
+
+    size_t memoryUsage() const {
+        return chunks.size() * chunk_size * sizeof(OctreeNode);
+    }
+};
+
 class Octree {
 private:
+    OctreeNodePool nodes;
     OctreeNodePtr root;
+
+    // Set once identical subtrees have been merged: nodes may then have several parents
+    bool dag = false;
+    std::unordered_map<OctreeNodePtr, int> writtenNodes;
+
+    struct NodeKey {
+        int value;
+        bool leaf;
+        OctreeNodePtr children[8];
+
+        bool operator==(const NodeKey& other) const {
+            return value == other.value && leaf == other.leaf && std::memcmp(children, other.children, sizeof(children)) == 0;
+        }
+    };
+
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& key) const {
+            uint64_t h = 14695981039346656037ULL;
+            h = (h ^ (GLuint)key.value) * 1099511628211ULL;
+            h = (h ^ key.leaf) * 1099511628211ULL;
+            for (int i = 0; i < 8; i++) {
+                h = (h ^ key.children[i]) * 1099511628211ULL;
+            }
+            return static_cast<size_t>(h);
+        }
+    };
+
+    // Post-order pass: children are made unique first, so two nodes are identical
+    // exactly when their values and child indices are equal
+    OctreeNodePtr deduplicate(OctreeNodePtr node, std::unordered_map<NodeKey, OctreeNodePtr, NodeKeyHash>& unique,
+                              std::unordered_map<OctreeNodePtr, OctreeNodePtr>& visited, DAGStats& stats) {
+        std::unordered_map<OctreeNodePtr, OctreeNodePtr>::iterator it = visited.find(node);
+        if (it != visited.end()) {
+            nodes[it->second].refs++;
+            return it->second;
+        }
+
+        NodeKey key;
+        key.value = nodes[node].value;
+        key.leaf = nodes[node].leaf;
+        for (int i = 0; i < 8; i++) {
+            OctreeNodePtr child = nodes[node].children[i];
+            if (child != null_node) {
+                child = deduplicate(child, unique, visited, stats);
+                nodes[node].children[i] = child;
+            }
+            key.children[i] = child;
+        }
+
+        stats.nodesBefore++;
+        if (!key.leaf) stats.interiorBefore++;
+
+        OctreeNodePtr canonical = node;
+        std::pair<std::unordered_map<NodeKey, OctreeNodePtr, NodeKeyHash>::iterator, bool> inserted = unique.insert(std::make_pair(key, node));
+        if (inserted.second) {
+            nodes[node].refs = 0;
+        } else {
+            // The duplicate goes away with the references it held on its children, which
+            // are also the children of canonical and keep those
+            canonical = inserted.first->second;
+            for (int i = 0; i < 8; i++) {
+                if (key.children[i] != null_node) {
+                    nodes[key.children[i]].refs--;
+                }
+            }
+            nodes.release(node);
+        }
+        visited[node] = canonical;
+        nodes[canonical].refs++;
+        return canonical;
+    }
+
+    // CPU copy of the flattened pool last uploaded, kept in sync by set and erase.
+    // Blocks of removed nodes are recycled, edited blocks are uploaded by flush.
+    // lodData holds the level of detail entry of each block and farData the far pointers
+    // (see node_pool.hpp), uploaded whole when they change.
+    std::vector<GLuint> poolData;
+    std::vector<GLuint> lodData;
+    std::vector<GLuint> farData;
+    std::vector<GLuint> freeBlocks;
+    std::vector<GLuint> freeFarPointers;
+    std::vector<GLuint> dirtyBlocks;
+    bool poolDirty = false;
+    bool farDirty = false;
+    size_t bufferCapacity = 0;
+    size_t edits = 0;
+
+    // Format of the pool handed out by nodePool and uploaded. Compact pools are derived from
+    // poolData, or from the mapped file, and rebuilt whole after edits.
+    NodeFormat format = NodeFormat::Blocks;
+    mutable std::vector<GLuint> compactData;
+    mutable bool compactStale = true;
+
+    // Set by buildPalette: node values stay rgb, snapped to the palette, and leaves are
+    // written as indices into it
+    Palette palette;
+
+    // Set by setAttributeStream: writeData keeps geometry and colours apart (see node_pool.hpp),
+    // blocks being shared by all nodes of the same shape. Blocks other than the root's are never
+    // modified: edits give the nodes on their path the block of their new shape, and splice the
+    // values of the edited subtree into the stream (see updateGeometry). Blocks no longer reached
+    // stay in the pool until it is flattened again (see updatePool).
+    bool attributeStream = false;
+    std::vector<GLuint> rankData;
+    std::vector<GLuint> attributeData;
+
+    // Shape of an interior node for the attribute stream: 0 for an empty child, 1 for a leaf,
+    // 2 + block for an interior child
+    struct GeometryKey {
+        GLuint children[8];
+
+        bool operator==(const GeometryKey& other) const {
+            return std::memcmp(children, other.children, sizeof(children)) == 0;
+        }
+    };
+
+    struct GeometryKeyHash {
+        size_t operator()(const GeometryKey& key) const {
+            uint64_t h = 14695981039346656037ULL;
+            for (int i = 0; i < 8; i++) {
+                h = (h ^ key.children[i]) * 1099511628211ULL;
+            }
+            return static_cast<size_t>(h);
+        }
+    };
+
+    // Where writeGeometry put a node shared in a DAG: its block and its range of attributes
+    struct WrittenGeometry {
+        GLuint block;
+        size_t first;
+        size_t count;
+    };
+
+    std::unordered_map<GeometryKey, GLuint, GeometryKeyHash> geometryBlocks;
+    std::unordered_map<OctreeNodePtr, WrittenGeometry> writtenGeometry;
+    size_t flattenedSize = 0;   // Entries of the pool written by the last writeData
+
+    // Set by setBricks: writeData stores the nodes brick_levels above the voxels as bricks
+    // (see node_pool.hpp). Edits write the brick on their path again, in place when it still
+    // fits in its blocks, and the node blocks above it (see updatePool). brickRuns holds the
+    // number of blocks of the brick starting at each block of poolData, 0 for node blocks and
+    // the rest of a brick.
+    bool bricks = false;
+    std::vector<GLuint> brickRuns;
+
+    // Level of the nodes written as bricks, -1 for none. Attribute streams have no bricks.
+    int brickDepth() const {
+        return bricks && !attributeStream && treeDepth >= static_cast<GLuint>(brick_levels) ? static_cast<int>(treeDepth) - brick_levels : -1;
+    }
+
+    // Pool of an octree loaded from a file, used instead of the node tree, level of detail
+    // entries included
+    std::unique_ptr<MappedOctreeFile> mappedFile;
+
+    void createTexture(size_t entryCount) {
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        if (entryCount > static_cast<size_t>(maxTexels)) {
+            std::cerr << "WARNING: Octree needs " << entryCount << " texels, the buffer texture limit is " << maxTexels << std::endl;
+        }
+
+        // Opengl texture generation
+
+        if (!bufferID) glGenBuffers(1, &bufferID);
+        if (!lodBufferID) glGenBuffers(1, &lodBufferID);
+        if (!farBufferID) glGenBuffers(1, &farBufferID);
+        if (!paletteBufferID) glGenBuffers(1, &paletteBufferID);
+        glActiveTexture(GL_TEXTURE0);
+        if (!textureID) glGenTextures(1, &textureID);
+        if (!lodTextureID) glGenTextures(1, &lodTextureID);
+        if (!farTextureID) glGenTextures(1, &farTextureID);
+        if (!paletteTextureID) glGenTextures(1, &paletteTextureID);
+        if (!rankBufferID) glGenBuffers(1, &rankBufferID);
+        if (!attributeBufferID) glGenBuffers(1, &attributeBufferID);
+        if (!rankTextureID) glGenTextures(1, &rankTextureID);
+        if (!attributeTextureID) glGenTextures(1, &attributeTextureID);
+    }
+
+    static void uploadBufferTexture(GLuint texture, GLuint buffer, const GLuint* data, size_t count) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, count * sizeof(GLuint), data, GL_STATIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void uploadFarPointers(const NodePool& pool) {
+        glBindBuffer(GL_TEXTURE_BUFFER, farBufferID);
+        glBufferData(GL_TEXTURE_BUFFER, pool.farCount * sizeof(GLuint), pool.far, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, farTextureID);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, farBufferID);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        farDirty = false;
+    }
+
+    // (Re)allocates the buffers with room for capacity pool entries and uploads both arrays whole.
+    // Compact pools hold their level of detail entries and attribute streams have none, the
+    // second buffer is then left empty. Ranks, if any, get the capacity of the pool, and
+    // attributes are uploaded whole.
+    void uploadPool(const NodePool& pool, size_t capacity) {
+        size_t lodCount = pool.format == NodeFormat::Blocks && pool.lod ? pool.size / 8 : 0;
+        glBindBuffer(GL_TEXTURE_BUFFER, bufferID);
+        glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, pool.size * sizeof(GLuint), pool.data);
+        glBindBuffer(GL_TEXTURE_BUFFER, lodBufferID);
+        glBufferData(GL_TEXTURE_BUFFER, (lodCount ? capacity / 8 : 0) * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+        if (lodCount) glBufferSubData(GL_TEXTURE_BUFFER, 0, lodCount * sizeof(GLuint), pool.lod);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        bufferCapacity = capacity;
+
+        glBindTexture(GL_TEXTURE_BUFFER, textureID);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, bufferID);
+        glBindTexture(GL_TEXTURE_BUFFER, lodTextureID);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, lodBufferID);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        uploadFarPointers(pool);
+
+        uploadBufferTexture(paletteTextureID, paletteBufferID, pool.palette, pool.paletteSize);
+        uploadBufferTexture(rankTextureID, rankBufferID, nullptr, pool.ranks ? capacity : 0);
+        if (pool.ranks) {
+            glBindBuffer(GL_TEXTURE_BUFFER, rankBufferID);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, pool.size * sizeof(GLuint), pool.ranks);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+        uploadBufferTexture(attributeTextureID, attributeBufferID, pool.attributes, pool.attributeCount);
+    }
+
+    // Entry of block pointing to block child, through a new far pointer if it is out of reach
+    GLuint encodeAddress(GLuint block, GLuint child) {
+        GLuint cell;
+        if (nearAddress(block, child, cell)) {
+            return cell;
+        }
+        GLuint slot;
+        if (!freeFarPointers.empty()) {
+            slot = freeFarPointers.back();
+            freeFarPointers.pop_back();
+            farData[slot] = child;
+        } else {
+            slot = static_cast<GLuint>(farData.size());
+            if (slot > static_cast<GLuint>(far_mask)) {
+                std::cerr << "ERROR: Octree needs more than " << far_mask + 1 << " far pointers, block " << child << " is dropped" << std::endl;
+                return 0;
+            }
+            farData.push_back(child);
+        }
+        farDirty = true;
+        return slot | far_flag;
+    }
+
+    // Makes the far pointers of the entries of block available again
+    void releaseFarPointers(GLuint block) {
+        for (int i = 0; i < 8; i++) {
+            GLuint cell = poolData[block * 8 + i];
+            if ((cell & ~far_mask) == (GLuint)far_flag) {
+                freeFarPointers.push_back(cell & far_mask);
+            }
+        }
+    }
+
+    const GLuint* paletteColors() const {
+        return palette.empty() ? nullptr : palette.colors.data();
+    }
+
+    GLuint leafEntry(int value) const {
+        return (palette.empty() ? value & value_mask : palette.index(value & value_mask)) | value_flag;
+    }
+
+    GLuint encodeEntry(OctreeNodePtr child, GLuint block) {
+        if (child == null_node) {
+            return 0;
+        }
+        const OctreeNode& n = nodes[child];
+        if (n.leaf) {
+            return leafEntry(n.value);
+        }
+        return encodeAddress(block, n.block);
+    }
+
+    // Rewrites the brick of an edited node at brickDepth: over its blocks if it still fits,
+    // the ones left over being freed, or else at the end of the pool. A root brick is the
+    // whole pool.
+    void encodeBrick(OctreeNodePtr node) {
+        std::vector<GLuint> run;
+        fillBrickRun(node, run);
+        const GLuint count = static_cast<GLuint>(run.size() / 8);
+        OctreeNode& n = nodes[node];
+        if (node == root) {
+            poolData.resize(run.size());
+            lodData.assign(count, 0);
+            brickRuns.assign(count, 0);
+            freeBlocks.clear();
+            poolDirty = true;
+        } else if (n.block != null_node && brickRuns[n.block] >= count) {
+            for (GLuint b = n.block + count; b < n.block + brickRuns[n.block]; b++) {
+                std::fill(poolData.begin() + b * 8, poolData.begin() + b * 8 + 8, 0);
+                freeBlocks.push_back(b);
+            }
+        } else {
+            freeBlock(node);
+            n.block = static_cast<GLuint>(poolData.size() / 8);
+            poolData.resize(poolData.size() + run.size(), 0);
+            lodData.resize(poolData.size() / 8, 0);
+            brickRuns.resize(poolData.size() / 8, 0);
+        }
+        std::copy(run.begin(), run.end(), poolData.begin() + n.block * 8);
+        brickRuns[n.block] = count;
+        lodData[n.block] = filterBrick(poolData.data(), paletteColors(), palette.colors.size(), n.block);
+        for (GLuint b = n.block; b < n.block + count; b++) {
+            dirtyBlocks.push_back(b);
+        }
+        compactStale = true;
+    }
+
+    // Rewrites the block of an edited node at depth d, giving it one if it is new, or its
+    // brick at brickDepth. Nodes below bricks have no block.
+    void encodeBlock(OctreeNodePtr node, int d) {
+        if (poolData.empty() || attributeStream || (brickDepth() >= 0 && d > brickDepth())) {
+            return;
+        }
+        if (d == brickDepth()) {
+            encodeBrick(node);
+            return;
+        }
+        OctreeNode& n = nodes[node];
+        if (n.block == null_node) {
+            if (!freeBlocks.empty()) {
+                n.block = freeBlocks.back();
+                freeBlocks.pop_back();
+            } else {
+                n.block = static_cast<GLuint>(poolData.size() / 8);
+                poolData.resize(poolData.size() + 8, 0);
+                lodData.push_back(0);
+                brickRuns.push_back(0);
+            }
+        }
+        releaseFarPointers(n.block);
+        for (int i = 0; i < 8; i++) {
+            poolData[n.block * 8 + i] = encodeEntry(n.children[i], n.block);
+        }
+        // Edits encode the path bottom-up, so the entries of the children are already up to date
+        lodData[n.block] = filterBlock(poolData.data(), farData.data(), paletteColors(), n.block, lodData.data());
+        dirtyBlocks.push_back(n.block);
+        compactStale = true;
+    }
+
+    // Forgets the flattened copy after a restructuring pass, writeData builds a new one
+    void discardPool() {
+        poolData.clear();
+        lodData.clear();
+        farData.clear();
+        rankData.clear();
+        attributeData.clear();
+        geometryBlocks.clear();
+        brickRuns.clear();
+        freeBlocks.clear();
+        freeFarPointers.clear();
+        dirtyBlocks.clear();
+        compactStale = true;
+    }
+
+    // Makes the block of node available again, or all the blocks of its brick
+    void freeBlock(OctreeNodePtr node) {
+        GLuint block = nodes[node].block;
+        if (block != null_node && !poolData.empty() && !attributeStream) {
+            GLuint count = brickRuns[block];
+            if (count == 0) {
+                releaseFarPointers(block);
+                count = 1;
+            }
+            std::fill(poolData.begin() + block * 8, poolData.begin() + (block + count) * 8, 0);
+            for (GLuint b = block; b < block + count; b++) {
+                lodData[b] = 0;
+                brickRuns[b] = 0;
+                freeBlocks.push_back(b);
+            }
+            compactStale = true;
+        }
+        nodes[node].block = null_node;
+    }
+
+    void releaseNode(OctreeNodePtr node) {
+        freeBlock(node);
+        nodes.release(node);
+    }
+
+    // Drops one reference to node, releasing its subtree when it was the last one
+    void unref(OctreeNodePtr node) {
+        if (--nodes[node].refs > 0) {
+            return;
+        }
+        if (!nodes[node].leaf) {
+            for (int i = 0; i < 8; i++) {
+                if (nodes[node].children[i] != null_node) {
+                    unref(nodes[node].children[i]);
+                }
+            }
+        }
+        releaseNode(node);
+    }
+
+    // True when the eight children of node are leaves of the same colour
+    bool hasUniformChildren(OctreeNodePtr node, int& value) const {
+        const OctreeNode& n = nodes[node];
+        for (int i = 0; i < 8; i++) {
+            if (n.children[i] == null_node || !nodes[n.children[i]].leaf || nodes[n.children[i]].value != nodes[n.children[0]].value) {
+                return false;
+            }
+        }
+        value = nodes[n.children[0]].value;
+        return true;
+    }
+
+    // Replaces the children of node by a single leaf of the given colour
+    void makeLeaf(OctreeNodePtr node, int value) {
+        for (int i = 0; i < 8; i++) {
+            if (nodes[node].children[i] != null_node) {
+                unref(nodes[node].children[i]);
+                nodes[node].children[i] = null_node;
+            }
+        }
+        freeBlock(node);
+        nodes[node].value = value;
+        nodes[node].leaf = true;
+        nodes[node].empty = false;
+    }
+
+    // Leaves below node at level d, with their levels, each once in a DAG
+    void gatherLeaves(OctreeNodePtr node, int d, std::vector<OctreeNodePtr>& leaves, std::vector<int>& levels, std::unordered_set<OctreeNodePtr>& visited) {
+        if (dag && !visited.insert(node).second) {
+            return;
+        }
+        if (nodes[node].leaf) {
+            leaves.push_back(node);
+            levels.push_back(d);
+            return;
+        }
+        for (int i = 0; i < 8; i++) {
+            if (nodes[node].children[i] != null_node) {
+                gatherLeaves(nodes[node].children[i], d + 1, leaves, levels, visited);
+            }
+        }
+    }
+
+    void collapse(OctreeNodePtr node, std::unordered_set<OctreeNodePtr>& visited) {
+        if (nodes[node].leaf || (dag && !visited.insert(node).second)) {
+            return;
+        }
+        for (int i = 0; i < 8; i++) {
+            if (nodes[node].children[i] != null_node) {
+                collapse(nodes[node].children[i], visited);
+            }
+        }
+        int value;
+        if (node != root && hasUniformChildren(node, value)) {
+            makeLeaf(node, value);
+        }
+    }
+
+    // Sets (or erases) voxel (x, y, z) in the subtree of node, at depth d.
+    // Returns the node replacing node in its parent: a new node if there was none,
+    // a private copy if node was shared in a DAG, null_node if the subtree became empty.
+    // Uniform regions stay collapsed: a leaf above treeDepth is split to reach the voxel,
+    // and nodes whose children end up identical leaves are merged back.
+    OctreeNodePtr edit(OctreeNodePtr node, int d, int x, int y, int z, int value, bool erase) {
+        if (node != null_node && !erase && nodes[node].leaf && nodes[node].value == value) {
+            return node;
+        }
+
+        if (node == null_node) {
+            if (erase) {
+                return null_node;
+            }
+            node = nodes.allocate();
+        } else if (nodes[node].refs > 1) {
+            nodes[node].refs--;
+            OctreeNodePtr copy = nodes.allocate();
+            nodes[copy] = nodes[node];
+            nodes[copy].block = null_node;
+            nodes[copy].refs = 1;
+            for (int i = 0; i < 8; i++) {
+                if (nodes[copy].children[i] != null_node) {
+                    nodes[nodes[copy].children[i]].refs++;
+                }
+            }
+            node = copy;
+        }
+
+        if (d == static_cast<int>(treeDepth)) {
+            if (erase) {
+                releaseNode(node);
+                return null_node;
+            }
+            nodes[node].value = value;
+            nodes[node].leaf = true;
+            nodes[node].empty = false;
+            return node;
+        }
+
+        if (nodes[node].leaf) {
+            int uniformValue = nodes[node].value;
+            nodes[node].leaf = false;
+            nodes[node].value = 0;
+            for (int i = 0; i < 8; i++) {
+                OctreeNodePtr child = nodes.allocate();
+                nodes[child].value = uniformValue;
+                nodes[child].leaf = true;
+                nodes[child].empty = false;
+                nodes[node].children[i] = child;
+            }
+        }
+
+        int c = treeDepth - d - 1;
+        int coord = ((x >> c) & 1) + (((y >> c) & 1) << 1) + (((z >> c) & 1) << 2);
+        OctreeNodePtr child = edit(nodes[node].children[coord], d + 1, x, y, z, value, erase);
+        nodes[node].children[coord] = child;
+
+        int uniformValue;
+        if (node != root && hasUniformChildren(node, uniformValue)) {
+            makeLeaf(node, uniformValue);
+            return node;
+        }
+
+        bool empty = true;
+        for (int i = 0; i < 8; i++) {
+            empty = empty && nodes[node].children[i] == null_node;
+        }
+        if (empty && node != root) {
+            releaseNode(node);
+            return null_node;
+        }
+        nodes[node].empty = empty;
+        encodeBlock(node, d);
+        return node;
+    }
+
+    // Copies the subtree of node in another tree into this one, returns the copy
+    OctreeNodePtr graft(const Octree& from, OctreeNodePtr node) {
+        OctreeNodePtr copy = nodes.allocate();
+        nodes[copy].value = from.nodes[node].value;
+        nodes[copy].leaf = from.nodes[node].leaf;
+        nodes[copy].empty = from.nodes[node].empty;
+        for (int i = 0; i < 8; i++) {
+            if (from.nodes[node].children[i] != null_node) {
+                OctreeNodePtr child = graft(from, from.nodes[node].children[i]);
+                nodes[copy].children[i] = child;
+            }
+        }
+        return copy;
+    }
+
+    OctreeNodePtr newLeaf(int value) {
+        OctreeNodePtr node = nodes.allocate();
+        nodes[node].value = value;
+        nodes[node].leaf = true;
+        nodes[node].empty = false;
+        return node;
+    }
+
+    // Builds the cell of 2^(treeDepth - d) voxels whose first voxel is (x, y, z), see buildImplicit.
+    // Returns its node, null_node if the cell is empty. Adds the nodes removed by collapsing to collapsed.
+    template <typename Bounds, typename Sample>
+    OctreeNodePtr buildImplicit(int d, int x, int y, int z, Bounds& bounds, Sample& sample, GLuint& collapsed) {
+        if (d == static_cast<int>(treeDepth)) {
+            GLuint color = sample(x, y, z);
+            return color >> 24 ? newLeaf(static_cast<int>(color & 0x00FFFFFF)) : null_node;
+        }
+
+        const int size = 1 << (treeDepth - d);
+        CellBounds cell = bounds(x, y, z, size);
+        if (cell.kind == CellBounds::Empty) {
+            return null_node;
+        }
+        if (cell.kind == CellBounds::Uniform) {
+            return newLeaf(cell.value);
+        }
+
+        OctreeNodePtr node = nodes.allocate();
+        const int half = size / 2;
+        bool empty = true;
+        for (int c = 0; c < 8; c++) {
+            OctreeNodePtr child = buildImplicit(d + 1, x + (c & 1) * half, y + ((c >> 1) & 1) * half, z + ((c >> 2) & 1) * half,
+                                                bounds, sample, collapsed);
+            nodes[node].children[c] = child;
+            empty = empty && child == null_node;
+        }
+        if (empty) {
+            releaseNode(node);
+            return null_node;
+        }
+
+        int value;
+        if (hasUniformChildren(node, value)) {
+            makeLeaf(node, value);
+            collapsed += 8;
+        } else {
+            nodes[node].empty = false;
+        }
+        return node;
+    }
+
+    // Upper levels of buildImplicit: classifies the children of node, at depth d, down to depth
+    // levels where the mixed cells are left to tasks
+    struct ImplicitTask {
+        OctreeNodePtr parent;
+        int child;
+        int x, y, z;
+    };
+
+    template <typename Bounds>
+    void splitImplicit(OctreeNodePtr node, int d, int x, int y, int z, int levels, Bounds& bounds, std::vector<ImplicitTask>& tasks) {
+        const int half = 1 << (treeDepth - d - 1);
+        for (int c = 0; c < 8; c++) {
+            int cx = x + (c & 1) * half;
+            int cy = y + ((c >> 1) & 1) * half;
+            int cz = z + ((c >> 2) & 1) * half;
+            if (d + 1 == levels) {
+                tasks.push_back(ImplicitTask { node, c, cx, cy, cz });
+                continue;
+            }
+
+            CellBounds cell = bounds(cx, cy, cz, half);
+            if (cell.kind == CellBounds::Uniform) {
+                OctreeNodePtr leaf = newLeaf(cell.value);
+                nodes[node].children[c] = leaf;
+            } else if (cell.kind == CellBounds::Mixed) {
+                OctreeNodePtr child = nodes.allocate();
+                nodes[node].children[c] = child;
+                splitImplicit(child, d + 1, cx, cy, cz, levels, bounds, tasks);
+            }
+        }
+    }
+
+    // Removes the upper nodes left empty by splitImplicit and collapses the uniform ones.
+    // Returns the node replacing node in its parent.
+    OctreeNodePtr pruneImplicit(OctreeNodePtr node, int d, int levels, GLuint& collapsed) {
+        if (nodes[node].leaf || d == levels) {
+            return node;
+        }
+        bool empty = true;
+        for (int c = 0; c < 8; c++) {
+            if (nodes[node].children[c] != null_node) {
+                OctreeNodePtr child = pruneImplicit(nodes[node].children[c], d + 1, levels, collapsed);
+                nodes[node].children[c] = child;
+                empty = empty && child == null_node;
+            }
+        }
+
+        int value;
+        if (node == root) {
+            nodes[node].empty = empty;
+        } else if (empty) {
+            releaseNode(node);
+            return null_node;
+        } else if (hasUniformChildren(node, value)) {
+            makeLeaf(node, value);
+            collapsed += 8;
+        } else {
+            nodes[node].empty = false;
+        }
+        return node;
+    }
+
 public:
-    GLuint textureID;
+    GLuint textureID = 0;
+    GLuint bufferID = 0;
+    GLuint lodTextureID = 0;    // Level of detail entries, one per block of textureID
+    GLuint lodBufferID = 0;
+    GLuint farTextureID = 0;    // Far pointers of textureID
+    GLuint farBufferID = 0;
+    GLuint paletteTextureID = 0;    // Colours of the leaves of textureID, empty without a palette
+    GLuint paletteBufferID = 0;
+    GLuint rankTextureID = 0;   // Ranks of the entries of textureID, empty without an attribute stream
+    GLuint rankBufferID = 0;
+    GLuint attributeTextureID = 0;  // Leaf values of textureID, empty without an attribute stream
+    GLuint attributeBufferID = 0;
     GLuint treeDepth;
     
     Octree(int depth) {
-        root = std::make_shared<OctreeNode>();
-        root->empty = true;
-        root->leaf = false;
-        root->value = 0;
-        for (int i = 0; i < 8; i++) {
-            root->children[i] = nullptr;
-        }
+        root = nodes.allocate();
         treeDepth = depth;
     }
 
     void insert(OctreeNodePtr node, int d, int x, int y, int z, int value) {
-        if (d == treeDepth) {
-            node->value = value;
-            node->leaf = true;
-            node->empty = false;
+        if (d == static_cast<int>(treeDepth)) {
+            nodes[node].value = value;
+            nodes[node].leaf = true;
+            nodes[node].empty = false;
             return;
         }
         int c = treeDepth - d - 1;
@@ -55,34 +845,384 @@ public:
 
         int coord = xnorm + (ynorm << 1) + (znorm << 2);
 
-        if (node->children[coord] == nullptr) {
-            node->children[coord] = std::make_shared<OctreeNode>();
-            node->children[coord]->empty = true;
-            node->children[coord]->leaf = false;
-            node->children[coord]->value = 0;
-            for (int i = 0; i < 8; i++) {
-                node->children[coord]->children[i] = nullptr;
-            }
-            node->empty = false;
+        if (nodes[node].children[coord] == null_node) {
+            OctreeNodePtr child = nodes.allocate();
+            nodes[node].children[coord] = child;
+            nodes[node].empty = false;
         }
 
-        insert(node->children[coord], d + 1, x, y, z, value);
+        insert(nodes[node].children[coord], d + 1, x, y, z, value);
     }
 
+    // Does not touch the flattened pool, use set on trees already uploaded
     void insert(int x, int y, int z, int value) {
         insert(root, 0, x, y, z, value);
     }
 
+    // Sets voxel (x, y, z) to value in place. Once generateTexture has been called, only
+    // the node blocks on the path to the voxel, and its brick if any, are rewritten and queued
+    // for flush, with an attribute stream along with its values. With a palette, value becomes
+    // the closest palette colour.
+    void set(int x, int y, int z, int value) {
+        if (!palette.empty()) {
+            value = static_cast<int>(palette.quantize(value & value_mask));
+        }
+        edit(root, 0, x, y, z, value, false);
+        edits++;
+        updatePool(x, y, z);
+    }
+
+    void erase(int x, int y, int z) {
+        edit(root, 0, x, y, z, 0, true);
+        edits++;
+        updatePool(x, y, z);
+    }
+
+    // Counts the calls to set, erase and writeData, for the renderers that keep hits of earlier
+    // frames: they are stale once it changes
+    size_t editCount() const {
+        return edits;
+    }
+
+    // Value of voxel (x, y, z) in the node tree, 0 when empty. Collapsed leaves above
+    // treeDepth hold the value of every voxel they cover.
+    int get(int x, int y, int z) const {
+        OctreeNodePtr node = root;
+        for (int d = 0; node != null_node; d++) {
+            if (nodes[node].leaf) {
+                return nodes[node].value;
+            }
+            if (d == static_cast<int>(treeDepth)) {
+                return 0;
+            }
+            int c = treeDepth - d - 1;
+            int coord = ((x >> c) & 1) + (((y >> c) & 1) << 1) + (((z >> c) & 1) << 2);
+            node = nodes[node].children[coord];
+        }
+        return 0;
+    }
+
+    // Uploads the blocks changed since the last upload, merging neighbouring blocks
+    // into single glBufferSubData calls. The buffer is reallocated if it became too small.
+    void flush() {
+        if (!bufferID || (!poolDirty && dirtyBlocks.empty())) {
+            return;
+        }
+        NodePool pool = nodePool();
+        if (pool.format == NodeFormat::Compact) {
+            // A child added or removed moves every children array after it
+            uploadPool(pool, pool.size);
+        } else if (poolDirty || pool.size > bufferCapacity) {
+            // Leave room for the blocks of future edits
+            uploadPool(pool, (pool.size / 8 + pool.size / 32) * 8);
+        } else {
+            std::sort(dirtyBlocks.begin(), dirtyBlocks.end());
+            dirtyBlocks.erase(std::unique(dirtyBlocks.begin(), dirtyBlocks.end()), dirtyBlocks.end());
+            for (size_t i = 0; i < dirtyBlocks.size();) {
+                size_t j = i + 1;
+                while (j < dirtyBlocks.size() && dirtyBlocks[j] == dirtyBlocks[j - 1] + 1) {
+                    j++;
+                }
+                GLuint first = dirtyBlocks[i];
+                GLuint count = static_cast<GLuint>(j - i);
+                glBindBuffer(GL_TEXTURE_BUFFER, bufferID);
+                glBufferSubData(GL_TEXTURE_BUFFER, first * 8 * sizeof(GLuint), count * 8 * sizeof(GLuint), &poolData[first * 8]);
+                if (!lodData.empty()) {
+                    glBindBuffer(GL_TEXTURE_BUFFER, lodBufferID);
+                    glBufferSubData(GL_TEXTURE_BUFFER, first * sizeof(GLuint), count * sizeof(GLuint), &lodData[first]);
+                }
+                if (!rankData.empty()) {
+                    glBindBuffer(GL_TEXTURE_BUFFER, rankBufferID);
+                    glBufferSubData(GL_TEXTURE_BUFFER, first * 8 * sizeof(GLuint), count * 8 * sizeof(GLuint), &rankData[first * 8]);
+                }
+                i = j;
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            if (farDirty) uploadFarPointers(pool);
+            // Edits move the values after the ones they replace
+            if (pool.attributes) uploadBufferTexture(attributeTextureID, attributeBufferID, pool.attributes, pool.attributeCount);
+        }
+        dirtyBlocks.clear();
+        poolDirty = false;
+    }
+
+    // Builds the tree bottom-up from voxels sorted by Morton code (see sortMortonVoxels).
+    // The tree must be empty. Each level is created in one pass shared by all workers:
+    // siblings are contiguous in the sorted order, so a node is emitted for every run
+    // of codes sharing the same parent prefix.
+    void build(const std::vector<MortonVoxel>& voxels) {
+        size_t count = voxels.size();
+        if (count == 0) {
+            return;
+        }
+
+        std::vector<uint64_t> codes(count);
+        OctreeNodePtr firstNode = nodes.allocateRange(count);
+        parallelFor(count, [&](size_t i) {
+            OctreeNode& leaf = nodes[firstNode + i];
+            leaf.value = voxels[i].value;
+            leaf.block = null_node;
+            leaf.refs = 1;
+            leaf.leaf = true;
+            leaf.empty = false;
+            for (int c = 0; c < 8; c++) {
+                leaf.children[c] = null_node;
+            }
+            codes[i] = voxels[i].code;
+        });
+
+        std::vector<GLuint> runStarts;
+        std::vector<uint64_t> parentCodes;
+        for (int d = treeDepth; d > 0; d--) {
+            // Find the first child of every parent, in order
+            std::vector<std::vector<GLuint>> workerStarts(workerCount());
+            parallelForRanges(count, [&](size_t worker, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    if (i == 0 || (codes[i] >> 3) != (codes[i - 1] >> 3)) {
+                        workerStarts[worker].push_back(i);
+                    }
+                }
+            });
+            runStarts.clear();
+            for (const std::vector<GLuint>& starts : workerStarts) {
+                runStarts.insert(runStarts.end(), starts.begin(), starts.end());
+            }
+
+            size_t parentCount = runStarts.size();
+            OctreeNodePtr firstParent = d == 1 ? root : nodes.allocateRange(parentCount);
+            parentCodes.resize(parentCount);
+            parallelFor(parentCount, [&](size_t p) {
+                OctreeNode& parent = nodes[firstParent + p];
+                parent.value = 0;
+                parent.block = null_node;
+                parent.refs = 1;
+                parent.leaf = false;
+                parent.empty = false;
+                for (int c = 0; c < 8; c++) {
+                    parent.children[c] = null_node;
+                }
+                size_t end = p + 1 < parentCount ? runStarts[p + 1] : count;
+                for (size_t i = runStarts[p]; i < end; i++) {
+                    parent.children[codes[i] & 7] = firstNode + i;
+                }
+                parentCodes[p] = codes[runStarts[p]] >> 3;
+            });
+
+            codes.swap(parentCodes);
+            count = parentCount;
+            firstNode = firstParent;
+        }
+    }
+
+    // Builds the tree one aligned chunk of 2^chunkDepth voxels per side at a time, so that
+    // only the voxels of a single chunk are ever held in memory. generate(x0, y0, z0, voxels)
+    // appends the solid voxels of the chunk whose first voxel is (x0, y0, z0), in any order,
+    // with Morton codes relative to that corner. Each chunk is built bottom-up and collapsed
+    // on its own before being copied under the upper levels, which are collapsed last.
+    // The tree must be empty. Returns the number of nodes removed by collapsing.
+    template <typename Generator>
+    GLuint buildChunked(int chunkDepth, Generator generate) {
+        chunkDepth = std::max(1, std::min(chunkDepth, static_cast<int>(treeDepth)));
+        const int levels = treeDepth - chunkDepth;
+        const uint64_t chunkCount = uint64_t(1) << (3 * levels);
+        const int chunkSize = 1 << chunkDepth;
+
+        GLuint collapsed = 0;
+        std::vector<MortonVoxel> voxels;
+        // Morton order, so that consecutive chunks share their upper nodes
+        for (uint64_t i = 0; i < chunkCount; i++) {
+            uint32_t cx, cy, cz;
+            mortonDecode(i, cx, cy, cz);
+
+            voxels.clear();
+            generate(static_cast<int>(cx) * chunkSize, static_cast<int>(cy) * chunkSize, static_cast<int>(cz) * chunkSize, voxels);
+            if (voxels.empty()) {
+                continue;
+            }
+            sortMortonVoxels(voxels, 3 * chunkDepth);
+
+            Octree chunk(chunkDepth);
+            chunk.build(voxels);
+            collapsed += chunk.collapse();
+
+            // Path from the root down to the parent of the chunk
+            OctreeNodePtr node = root;
+            for (int d = 0; d < levels; d++) {
+                int c = levels - d - 1;
+                int coord = ((cx >> c) & 1) + (((cy >> c) & 1) << 1) + (((cz >> c) & 1) << 2);
+                nodes[node].empty = false;
+                if (d == levels - 1) {
+                    OctreeNodePtr subtree = graft(chunk, chunk.root);
+                    nodes[node].children[coord] = subtree;
+                } else {
+                    if (nodes[node].children[coord] == null_node) {
+                        OctreeNodePtr child = nodes.allocate();
+                        nodes[node].children[coord] = child;
+                    }
+                    node = nodes[node].children[coord];
+                }
+            }
+            if (levels == 0) {
+                for (int c = 0; c < 8; c++) {
+                    if (chunk.nodes[chunk.root].children[c] != null_node) {
+                        OctreeNodePtr child = graft(chunk, chunk.nodes[chunk.root].children[c]);
+                        nodes[root].children[c] = child;
+                        nodes[root].empty = false;
+                    }
+                }
+            }
+        }
+        return collapsed + collapse();
+    }
+
+    // Builds the tree top-down from an implicit volume. bounds(x, y, z, size) classifies the
+    // cube of size voxels per side whose first voxel is (x, y, z), and must be conservative:
+    // Empty and Uniform cubes are stored as is, without ever sampling their voxels.
+    // sample(x, y, z) returns the colour of a voxel of a Mixed cube packed as 0xAARRGGBB,
+    // alpha 0 when empty (as VoxelArray::sampleVoxel). Only the cubes crossing the surface
+    // are subdivided, so the work follows its area rather than the volume.
+    // Both are called from several threads at once. The tree must be empty, it comes out
+    // collapsed. Returns the number of nodes removed by collapsing.
+    template <typename Bounds, typename Sample>
+    GLuint buildImplicit(Bounds bounds, Sample sample) {
+        if (treeDepth == 0) {
+            return 0;
+        }
+        const int levels = std::max(1, static_cast<int>(treeDepth) - implicit_task_depth);
+        std::vector<ImplicitTask> tasks;
+        splitImplicit(root, 0, 0, 0, 0, levels, bounds, tasks);
+
+        // Each task is built in a tree of its own, then copied in place. In batches, so that
+        // only a few subtrees are held twice at once.
+        GLuint collapsed = 0;
+        const size_t batchSize = workerCount() * 4;
+        std::vector<std::unique_ptr<Octree>> subtrees(batchSize);
+        std::vector<OctreeNodePtr> subtreeRoots(batchSize);
+        std::vector<GLuint> subtreeCollapsed(batchSize);
+        for (size_t first = 0; first < tasks.size(); first += batchSize) {
+            size_t count = std::min(batchSize, tasks.size() - first);
+            parallelFor(count, [&](size_t i) {
+                const ImplicitTask& task = tasks[first + i];
+                subtrees[i].reset(new Octree(treeDepth - levels));
+                subtreeCollapsed[i] = 0;
+                subtreeRoots[i] = subtrees[i]->buildImplicit(0, task.x, task.y, task.z, bounds, sample, subtreeCollapsed[i]);
+            }, 1);
+
+            for (size_t i = 0; i < count; i++) {
+                if (subtreeRoots[i] != null_node) {
+                    OctreeNodePtr subtree = graft(*subtrees[i], subtreeRoots[i]);
+                    nodes[tasks[first + i].parent].children[tasks[first + i].child] = subtree;
+                }
+                collapsed += subtreeCollapsed[i];
+                subtrees[i].reset();
+            }
+        }
+
+        pruneImplicit(root, 0, levels, collapsed);
+        discardPool();
+        return collapsed;
+    }
+
+    // Merges identical subtrees so that the tree becomes a directed acyclic graph.
+    // Afterwards nodes are shared between parents: insert must no longer be used, set and
+    // erase copy the shared nodes they modify. The flattened pool is discarded.
+    DAGStats reduceToDAG() {
+        DAGStats stats = {};
+        std::unordered_map<NodeKey, OctreeNodePtr, NodeKeyHash> unique;
+        std::unordered_map<OctreeNodePtr, OctreeNodePtr> visited;
+        root = deduplicate(root, unique, visited, stats);
+        dag = true;
+        discardPool();
+
+        stats.nodesAfter = nodes.size();
+        for (std::unordered_map<NodeKey, OctreeNodePtr, NodeKeyHash>::const_iterator it = unique.begin(); it != unique.end(); ++it) {
+            if (!it->first.leaf) stats.interiorAfter++;
+        }
+        return stats;
+    }
+
+    // Turns every node whose eight children are leaves of one colour into a leaf at the
+    // parent level, bottom-up so that whole uniform subtrees shrink to one leaf.
+    // Returns the number of nodes removed. The flattened pool is discarded.
+    GLuint collapse() {
+        GLuint before = nodes.size();
+        std::unordered_set<OctreeNodePtr> visited;
+        collapse(root, visited);
+        discardPool();
+        return before - nodes.size();
+    }
+
+    // Replaces the colour of every leaf by its entry in a palette of at most 2^bits colours
+    // (see palette.hpp), built from the leaves weighted by the voxels they cover, and collapses
+    // the subtrees this made uniform. From then on leaves are written as palette indices.
+    // Returns the number of nodes removed. The flattened pool is discarded.
+    GLuint buildPalette(int bits) {
+        std::vector<OctreeNodePtr> leaves;
+        std::vector<int> levels;
+        std::unordered_set<OctreeNodePtr> visited;
+        gatherLeaves(root, 0, leaves, levels, visited);
+
+        std::vector<WeightedColor> colors = gatherColors(leaves.size(), [&](size_t i, GLuint& rgb, double& weight) {
+            rgb = static_cast<GLuint>(nodes[leaves[i]].value & value_mask);
+            weight = std::ldexp(1.0, 3 * (static_cast<int>(treeDepth) - levels[i]));
+        });
+        std::vector<GLuint> indexOf;
+        palette = Palette::medianCut(colors, bits, indexOf);
+
+        parallelFor(leaves.size(), [&](size_t i) {
+            WeightedColor key = { static_cast<GLuint>(nodes[leaves[i]].value & value_mask), 0.0 };
+            size_t c = std::lower_bound(colors.begin(), colors.end(), key,
+                                        [](const WeightedColor& a, const WeightedColor& b) { return a.rgb < b.rgb; }) - colors.begin();
+            nodes[leaves[i]].value = static_cast<int>(palette.colors[indexOf[c]]);
+        });
+        return collapse();
+    }
+
+    const Palette& colorPalette() const {
+        return palette;
+    }
+
+    bool isDAG() const {
+        return dag;
+    }
+
+    // True when the refs of every node reachable from the root equal its number of parents
+    // and no other node is alive
+    bool checkRefCounts() const {
+        std::unordered_map<OctreeNodePtr, GLuint> parents;
+        std::vector<OctreeNodePtr> stack(1, root);
+        parents[root] = 1;
+        while (!stack.empty()) {
+            OctreeNodePtr node = stack.back();
+            stack.pop_back();
+            for (int i = 0; i < 8; i++) {
+                OctreeNodePtr child = nodes[node].children[i];
+                if (child != null_node && ++parents[child] == 1) {
+                    stack.push_back(child);
+                }
+            }
+        }
+        if (parents.size() != nodes.size()) {
+            return false;
+        }
+        for (std::unordered_map<OctreeNodePtr, GLuint>::const_iterator it = parents.begin(); it != parents.end(); ++it) {
+            if (nodes[it->first].refs != it->second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     void print(OctreeNodePtr node, int depth) {
-        if (node == nullptr) {
+        if (node == null_node) {
             return;
         }
         for (int i = 0; i < depth; i++) {
             std::cout << " ";
         }
-        std::cout << node->value << std::endl;
+        std::cout << nodes[node].value << std::endl;
         for (int i = 0; i < 8; i++) {
-            print(node->children[i], depth + 1);
+            print(nodes[node].children[i], depth + 1);
         }
     }
 
@@ -90,74 +1230,499 @@ public:
         print(root, 0);
     }
 
-    int writeData(OctreeNodePtr node, int depth, int* data, int* index) {
-        if (node == nullptr) {
+    // Sets the occupancy bits and values of the voxels below node, levels above the voxels,
+    // whose first voxel has index first in its brick (see node_pool.hpp)
+    void fillBrick(OctreeNodePtr node, int levels, GLuint first, GLuint* masks, GLuint* values) const {
+        const OctreeNode& n = nodes[node];
+        if (n.leaf) {
+            for (GLuint m = first; m < first + (1u << (3 * levels)); m++) {
+                masks[m >> 5] |= 1u << (m & 31);
+                values[m] = leafEntry(n.value);
+            }
+            return;
+        }
+        for (int i = 0; i < 8; i++) {
+            if (n.children[i] != null_node) {
+                fillBrick(n.children[i], levels - 1, first + (static_cast<GLuint>(i) << (3 * (levels - 1))), masks, values);
+            }
+        }
+    }
+
+    // Appends the brick replacing node, brick_levels above the voxels, to data, padded to whole
+    // blocks
+    void fillBrickRun(OctreeNodePtr node, std::vector<GLuint>& data) const {
+        GLuint masks[brick_mask_words] = {};
+        GLuint values[1 << (3 * brick_levels)];
+        fillBrick(node, brick_levels, 0, masks, values);
+
+        GLuint count = 0, before[8];
+        for (int o = 0; o < 8; o++) {
+            before[o] = count;
+            count += bitCount32(masks[2 * o]) + bitCount32(masks[2 * o + 1]);
+        }
+        const int shift = compactLeafShift(palette.colors.size());
+        const size_t first = data.size();
+        const size_t entries = brick_header_size + ((count + (1u << shift) - 1) >> shift);
+        data.resize(first + (entries + 7) / 8 * 8, 0);
+        std::copy(masks, masks + brick_mask_words, data.begin() + first);
+        for (int o = 0; o < 8; o++) {
+            data[first + brick_mask_words + o / 2] |= before[o] << (16 * (o & 1));
+        }
+        GLuint leaf = 0;
+        for (GLuint m = 0; m < 1u << (3 * brick_levels); m++) {
+            if ((masks[m >> 5] >> (m & 31)) & 1) {
+                packLeaf(data, first + brick_header_size, leaf++, values[m], shift);
+            }
+        }
+    }
+
+    // Forgets the blocks the nodes below node had before it became a brick
+    void forgetBlocks(OctreeNodePtr node) {
+        for (int i = 0; i < 8; i++) {
+            OctreeNodePtr child = nodes[node].children[i];
+            if (child != null_node && !nodes[child].leaf) {
+                nodes[child].block = null_node;
+                forgetBlocks(child);
+            }
+        }
+    }
+
+    // Appends the brick of node to data, see fillBrickRun. Returns the index of its first block.
+    int writeBrick(OctreeNodePtr node, std::vector<GLuint>& data) {
+        const int block = static_cast<int>(data.size() / 8);
+        fillBrickRun(node, data);
+        lodData.resize(data.size() / 8, 0);
+        lodData[block] = filterBrick(data.data(), paletteColors(), palette.colors.size(), block);
+        brickRuns.resize(data.size() / 8, 0);
+        brickRuns[block] = static_cast<GLuint>(data.size() / 8 - block);
+        forgetBlocks(node);
+        return block;
+    }
+
+    // Appends the node block of node and of its interior descendants to data (see node_pool.hpp),
+    // or its brick at brickDepth. Returns the index of the block of node.
+    int writeData(OctreeNodePtr node, int depth, std::vector<GLuint>& data) {
+        if (node == null_node) {
             return -1;
         }
-        if (node->leaf) {
+        if (nodes[node].leaf) {
             return -1;
         }
-        int numCellsX = 1 << (treeDepth - 1);
-        int numCellsY = 1 << (treeDepth - 1);
-        int numCellsZ = 1 << (treeDepth - 1);
+        int currentIndex = static_cast<int>(data.size() / 8);
 
-        int cellX = *index % numCellsX;
-        int cellY = (*index / numCellsX) % numCellsY;
-        int cellZ = (*index / (numCellsX * numCellsY)) % numCellsZ;
+        // Shared subtrees are emitted once and referenced by all their parents
+        if (dag) {
+            std::unordered_map<OctreeNodePtr, int>::iterator it = writtenNodes.find(node);
+            if (it != writtenNodes.end()) {
+                return it->second;
+            }
+            writtenNodes[node] = currentIndex;
+        }
 
-        int currentIndex = *index;
+        if (depth == brickDepth()) {
+            nodes[node].block = writeBrick(node, data);
+            return nodes[node].block;
+        }
 
-        *index = *index + 1;
+        nodes[node].block = currentIndex;
+        data.resize(data.size() + 8, 0);
+        lodData.resize(data.size() / 8, 0);
+        brickRuns.resize(data.size() / 8, 0);
         for (int i = 0; i < 8; i++) {
-            int encodedValue = 0;
-            if(node->children[i] != nullptr) {
-                if(node->children[i]->leaf) {
-                    int value = node->children[i]->value;
-                    encodedValue = value & value_mask | value_flag;
+            GLuint encodedValue = 0;
+            OctreeNodePtr childPtr = nodes[node].children[i];
+            if(childPtr != null_node) {
+                const OctreeNode& child = nodes[childPtr];
+                if(child.leaf) {
+                    encodedValue = leafEntry(child.value);
                 } else {
-                    int childIndex = writeData(node->children[i], depth + 1, data, index);
-                    encodedValue = childIndex & address_mask | address_flag;
+                    int childIndex = writeData(childPtr, depth + 1, data);
+                    encodedValue = encodeAddress(currentIndex, childIndex);
                 }
             }
-            int subCellX = cellX * 2 + (i & 1);
-            int subCellY = cellY * 2 + ((i & 2) >> 1);
-            int subCellZ = cellZ * 2 + ((i & 4) >> 2);
-
-            int subCellIndex = subCellX + subCellY * numCellsX * 2 + subCellZ * numCellsX * numCellsY * 4;
-            data[subCellIndex] = encodedValue;
+            data[currentIndex * 8 + i] = encodedValue;
         }
+        // Written after the subtrees of the children, whose entries are now known
+        lodData[currentIndex] = filterBlock(data.data(), farData.data(), paletteColors(), currentIndex, lodData.data());
 
         return currentIndex;
     }
 
-    void generateTexture() {
-        int* texture = new int[1 << (3 * treeDepth)];
-        /*for (int i = 0; i < (1 << (3 * treeDepth)); i++) {
-            texture[i] = 0;
-        }*/
-        int index = 0;
-        writeData(root, 0, texture, &index);
+    // Appends the geometry block of node and of its interior descendants to data, post-order,
+    // and the values of its leaves to attributeData, depth-first (see node_pool.hpp). Nodes of
+    // the same shape share a block, the root being written to block 0, reserved beforehand.
+    // Returns the block of node and sets leaves to the number of leaves below it.
+    GLuint writeGeometry(OctreeNodePtr node, std::vector<GLuint>& data, size_t& leaves) {
+        // Shared subtrees are walked once, their attributes copied for every other parent
+        if (dag) {
+            std::unordered_map<OctreeNodePtr, WrittenGeometry>::const_iterator it = writtenGeometry.find(node);
+            if (it != writtenGeometry.end()) {
+                size_t first = attributeData.size();
+                attributeData.resize(first + it->second.count);
+                std::copy(attributeData.begin() + it->second.first, attributeData.begin() + it->second.first + it->second.count, attributeData.begin() + first);
+                leaves = it->second.count;
+                return it->second.block;
+            }
+        }
 
-        // Opengl texture generation
+        const size_t first = attributeData.size();
+        GeometryKey key;
+        GLuint ranks[8];
+        leaves = 0;
+        for (int i = 0; i < 8; i++) {
+            ranks[i] = static_cast<GLuint>(leaves);
+            OctreeNodePtr childPtr = nodes[node].children[i];
+            if (childPtr == null_node) {
+                key.children[i] = 0;
+            } else if (nodes[childPtr].leaf) {
+                key.children[i] = 1;
+                attributeData.push_back(leafEntry(nodes[childPtr].value) & value_mask);
+                leaves++;
+            } else {
+                size_t childLeaves;
+                key.children[i] = writeGeometry(childPtr, data, childLeaves) + 2;
+                leaves += childLeaves;
+            }
+        }
 
-        glActiveTexture(GL_TEXTURE0);
+        GLuint block = 0;
+        if (node != root) {
+            std::pair<std::unordered_map<GeometryKey, GLuint, GeometryKeyHash>::iterator, bool> inserted =
+                geometryBlocks.insert(std::make_pair(key, static_cast<GLuint>(data.size() / 8)));
+            block = inserted.first->second;
+            if (!inserted.second) {
+                if (dag) writtenGeometry[node] = WrittenGeometry { block, first, leaves };
+                return block;
+            }
+            data.resize(data.size() + 8, 0);
+            rankData.resize(data.size(), 0);
+        }
+        for (int i = 0; i < 8; i++) {
+            GLuint cell = key.children[i];
+            data[block * 8 + i] = cell == 0 ? 0 : (cell == 1 ? static_cast<GLuint>(value_flag) : encodeAddress(block, cell - 2));
+            rankData[block * 8 + i] = ranks[i];
+        }
+        if (dag) writtenGeometry[node] = WrittenGeometry { block, first, leaves };
+        return block;
+    }
+
+    // Number of leaves below the geometry block block, from the rank of its last child
+    size_t geometryLeaves(GLuint block) const {
+        size_t leaves = 0;
+        for (;;) {
+            GLuint cell = poolData[block * 8 + 7];
+            leaves += rankData[block * 8 + 7];
+            if (!childBlock(cell, block, farData.data(), block)) {
+                return leaves + (cell != 0 ? 1 : 0);
+            }
+        }
+    }
 
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_3D, textureID);
+    // Shape of the node written to geometry block block
+    GeometryKey geometryKey(GLuint block) const {
+        GeometryKey key;
+        for (int i = 0; i < 8; i++) {
+            GLuint cell = poolData[block * 8 + i];
+            GLuint child;
+            key.children[i] = childBlock(cell, block, farData.data(), child) ? child + 2 : (cell != 0 ? 1 : 0);
+        }
+        return key;
+    }
 
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Brings the attribute stream up to date after an edit of voxel (x, y, z) in the node tree.
+    // Above the deepest node of the path that was interior before and after the edit, only
+    // the child on the path changed, so its subtree is written again and its values replace
+    // the old ones in the stream. The ranks of the following children of the path shift by
+    // the difference, giving the nodes of the path new shapes, written to new blocks unless a
+    // block of the same shape exists. The root stays in block 0.
+    void updateGeometry(int x, int y, int z) {
+        GLuint blocks[max_octree_depth];
+        int slots[max_octree_depth];
+        OctreeNodePtr node = root;
+        size_t first = 0;
+        int d = 0;
+        blocks[0] = 0;
+        for (;; d++) {
+            int c = treeDepth - d - 1;
+            slots[d] = ((x >> c) & 1) + (((y >> c) & 1) << 1) + (((z >> c) & 1) << 2);
+            first += rankData[blocks[d] * 8 + slots[d]];
+            OctreeNodePtr child = nodes[node].children[slots[d]];
+            GLuint cell = poolData[blocks[d] * 8 + slots[d]];
+            if (child == null_node || nodes[child].leaf || !childBlock(cell, blocks[d], farData.data(), blocks[d + 1])) {
+                break;
+            }
+            node = child;
+        }
 
-        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32UI, 1 << treeDepth, 1 << treeDepth, 1 << treeDepth, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, texture);
-        glBindTexture(GL_TEXTURE_3D, 0);
+        // Values of the child as it was, then as it is now
+        GLuint oldCell = poolData[blocks[d] * 8 + slots[d]], oldChild;
+        size_t oldCount = childBlock(oldCell, blocks[d], farData.data(), oldChild) ? geometryLeaves(oldChild) : (oldCell != 0 ? 1 : 0);
+        const size_t written = attributeData.size();
+        OctreeNodePtr child = nodes[node].children[slots[d]];
+        GLuint childKey = 0;
+        if (child != null_node && nodes[child].leaf) {
+            attributeData.push_back(leafEntry(nodes[child].value) & value_mask);
+            childKey = 1;
+        } else if (child != null_node) {
+            size_t leaves;
+            childKey = writeGeometry(child, poolData, leaves) + 2;
+            writtenGeometry.clear();
+        }
+        const size_t newCount = attributeData.size() - written;
+        std::vector<GLuint> values(attributeData.begin() + written, attributeData.end());
+        attributeData.resize(written);
+        attributeData.erase(attributeData.begin() + first, attributeData.begin() + first + oldCount);
+        attributeData.insert(attributeData.begin() + first, values.begin(), values.end());
 
-        delete[] texture;
+        for (; d >= 0; d--) {
+            GeometryKey key = geometryKey(blocks[d]);
+            key.children[slots[d]] = childKey;
+            GLuint ranks[8];
+            for (int i = 0; i < 8; i++) {
+                ranks[i] = rankData[blocks[d] * 8 + i];
+                if (i > slots[d]) ranks[i] = static_cast<GLuint>(ranks[i] + newCount - oldCount);
+            }
+            GLuint block = 0;
+            if (d > 0) {
+                std::pair<std::unordered_map<GeometryKey, GLuint, GeometryKeyHash>::iterator, bool> inserted =
+                    geometryBlocks.insert(std::make_pair(key, static_cast<GLuint>(poolData.size() / 8)));
+                block = inserted.first->second;
+                if (!inserted.second) {
+                    childKey = block + 2;
+                    continue;
+                }
+                poolData.resize(poolData.size() + 8, 0);
+                rankData.resize(poolData.size(), 0);
+            } else {
+                releaseFarPointers(0);
+            }
+            for (int i = 0; i < 8; i++) {
+                GLuint cell = key.children[i];
+                poolData[block * 8 + i] = cell == 0 ? 0 : (cell == 1 ? static_cast<GLuint>(value_flag) : encodeAddress(block, cell - 2));
+                rankData[block * 8 + i] = ranks[i];
+            }
+            dirtyBlocks.push_back(block);
+            childKey = block + 2;
+        }
+        compactStale = true;
+    }
+
+    // Brings the flattened pool, if any, up to date after an edit of voxel (x, y, z). edit
+    // rewrites node blocks and bricks itself, the attribute stream is patched here. Blocks that
+    // moved are not all reused, so the tree is flattened again once the pool doubled.
+    void updatePool(int x, int y, int z) {
+        if (poolData.empty()) {
+            return;
+        }
+        if ((attributeStream || brickDepth() >= 0) && poolData.size() >= 2 * flattenedSize) {
+            writeData();
+        } else if (attributeStream) {
+            updateGeometry(x, y, z);
+        }
+    }
+
+    // Flattens the whole tree into a compact pool, which becomes the copy kept in sync
+    // by edits. The next flush uploads it entirely.
+    const std::vector<GLuint>& writeData() {
+        poolData.clear();
+        lodData.clear();
+        farData.clear();
+        rankData.clear();
+        attributeData.clear();
+        geometryBlocks.clear();
+        brickRuns.clear();
+        freeBlocks.clear();
+        freeFarPointers.clear();
+        dirtyBlocks.clear();
+        writtenNodes.clear();
+        if (!attributeStream) {
+            writeData(root, 0, poolData);
+        } else if (!nodes[root].leaf) {
+            poolData.resize(8, 0);
+            rankData.resize(8, 0);
+            size_t leaves;
+            writeGeometry(root, poolData, leaves);
+            writtenGeometry.clear();
+            if (attributeData.size() > 0xFFFFFFFFull) {
+                std::cerr << "ERROR: Attribute stream needs " << attributeData.size() << " entries, more than 32-bit ranks reach" << std::endl;
+            }
+        }
+        writtenNodes.clear();
+        flattenedSize = poolData.size();
+        poolDirty = true;
+        compactStale = true;
+        edits++;
+        return poolData;
+    }
+
+    // The flattened pool as edited since the last writeData, or as mapped from a file, in the
+    // block format
+    NodePool blockPool() const {
+        if (mappedFile) {
+            return mappedFile->pool();
+        }
+        if (attributeStream) {
+            return NodePool { poolData.data(), poolData.size(), static_cast<int>(treeDepth), nullptr, farData.data(), farData.size(), NodeFormat::Blocks,
+                              paletteColors(), palette.colors.size(), rankData.data(), attributeData.data(), attributeData.size(), false };
+        }
+        return NodePool { poolData.data(), poolData.size(), static_cast<int>(treeDepth), lodData.data(), farData.data(), farData.size(), NodeFormat::Blocks,
+                          paletteColors(), palette.colors.size(), nullptr, nullptr, 0, brickDepth() >= 0 };
+    }
+
+    // blockPool in the format set by setNodeFormat. Falls back to the block format when the
+    // tree is too large for a compact pool, or when it has an attribute stream.
+    NodePool nodePool() const {
+        NodePool pool = blockPool();
+        if (format == NodeFormat::Compact) {
+            if (compactStale) {
+                compactData = compactPool(pool);
+                compactStale = false;
+            }
+            if (!compactData.empty()) {
+                return NodePool { compactData.data(), compactData.size(), pool.depth, nullptr, nullptr, 0, NodeFormat::Compact, pool.palette, pool.paletteSize,
+                                  nullptr, nullptr, 0, false };
+            }
+        }
+        return pool;
+    }
+
+    // Files are always written in the block format, the one edits work on
+    void setNodeFormat(NodeFormat nodeFormat) {
+        if (nodeFormat != format) {
+            format = nodeFormat;
+            poolDirty = true;
+        }
+    }
+
+    NodeFormat nodeFormat() const {
+        return format;
+    }
+
+    // Switches between colours in the leaf entries and an attribute stream, flattening the
+    // tree again if it was. Mapped pools keep the layout of their file.
+    void setAttributeStream(bool enabled) {
+        if (mappedFile) {
+            if (enabled != attributeStream) {
+                std::cerr << "WARNING: Octree loaded from a file keeps its " << (attributeStream ? "attribute stream" : "leaf colours") << std::endl;
+            }
+            return;
+        }
+        if (enabled != attributeStream) {
+            attributeStream = enabled;
+            if (!poolData.empty()) writeData();
+        }
+    }
+
+    bool hasAttributeStream() const {
+        return attributeStream;
+    }
+
+    // Switches the bottom levels between blocks and bricks, flattening the tree again if it was.
+    // Bricks are left out of attribute streams. Mapped pools keep the layout of their file.
+    // Bricks hold one bit and one value per solid voxel: they shrink pools of thin surfaces and
+    // scattered voxels, but grow those whose cells collapsed into large uniform leaves.
+    void setBricks(bool enabled) {
+        if (mappedFile) {
+            if (enabled != bricks) {
+                std::cerr << "WARNING: Octree loaded from a file keeps its " << (bricks ? "bricks" : "bottom levels") << std::endl;
+            }
+            return;
+        }
+        if (enabled != bricks) {
+            bricks = enabled;
+            if (!poolData.empty()) writeData();
+        }
+    }
+
+    bool hasBricks() const {
+        return bricks;
+    }
+
+    bool save(const std::string& filename) const {
+        return saveOctreeFile(filename, blockPool(), dag ? octree_file_flag_dag : 0);
+    }
+
+    // Maps a file written by save. generateTexture uploads the pool straight from the mapping.
+    // The loaded octree is read-only: its node tree is empty, so set and erase do not apply.
+    static std::shared_ptr<Octree> load(const std::string& filename) {
+        std::unique_ptr<MappedOctreeFile> file(new MappedOctreeFile());
+        if (!file->open(filename)) {
+            return nullptr;
+        }
+        std::shared_ptr<Octree> octree = std::make_shared<Octree>(file->header().depth);
+        octree->dag = (file->header().flags & octree_file_flag_dag) != 0;
+        octree->mappedFile = std::move(file);
+        NodePool pool = octree->mappedFile->pool();
+        if (pool.palette) {
+            octree->palette.assign(pool.palette, pool.paletteSize);
+        }
+        octree->attributeStream = pool.ranks != nullptr;
+        octree->bricks = pool.bricks;
+        return octree;
+    }
+
+    // Uploads the flattened tree to a buffer texture, sized by the number of interior nodes,
+    // and its level of detail entries to a second one unless the pool is compact. The tree is
+    // flattened first if writeData has not been called since the last change. Mapped pools
+    // are uploaded as is.
+    void generateTexture() {
+        if (mappedFile) {
+            NodePool pool = nodePool();
+            createTexture(pool.size);
+            uploadPool(pool, pool.size);
+            poolDirty = false;
+            return;
+        }
+        writeData();
+        createTexture(nodePool().size);
+        flush();
+    }
+
+    GLuint nodeCount() const {
+        return nodes.size();
+    }
+
+    size_t memoryUsage() const {
+        return nodes.memoryUsage();
     }
 
     ~Octree() {
         if(textureID) {
             glDeleteTextures(1, &textureID);
         }
+        if(bufferID) {
+            glDeleteBuffers(1, &bufferID);
+        }
+        if(lodTextureID) {
+            glDeleteTextures(1, &lodTextureID);
+        }
+        if(lodBufferID) {
+            glDeleteBuffers(1, &lodBufferID);
+        }
+        if(farTextureID) {
+            glDeleteTextures(1, &farTextureID);
+        }
+        if(farBufferID) {
+            glDeleteBuffers(1, &farBufferID);
+        }
+        if(paletteTextureID) {
+            glDeleteTextures(1, &paletteTextureID);
+        }
+        if(paletteBufferID) {
+            glDeleteBuffers(1, &paletteBufferID);
+        }
+        if(rankTextureID) {
+            glDeleteTextures(1, &rankTextureID);
+        }
+        if(rankBufferID) {
+            glDeleteBuffers(1, &rankBufferID);
+        }
+        if(attributeTextureID) {
+            glDeleteTextures(1, &attributeTextureID);
+        }
+        if(attributeBufferID) {
+            glDeleteBuffers(1, &attributeBufferID);
+        }
     }
 };
 
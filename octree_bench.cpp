@@ -0,0 +1,510 @@
+/*
+    octree_bench.cpp
+    author: Telo PHILIPPE
+
+    Microbenchmarks of the octree hot paths, each timed in isolation over a range of
+    depths and scenes of different densities: voxel generation, octree construction
+    (VoxelArray::generateOctree, dense, streamed or implicit, Octree::insert, Octree::build,
+    Octree::buildImplicit), flattening
+    (Octree::writeData, compactPool, attribute streams, bricks), palettes (Octree::buildPalette)
+    and CPU ray traversal of both node formats, of attribute streams and of bricks.
+
+    Every case runs --repeat times and is reported with its median and fastest run, the
+    spread between runs, the throughput of the median run and the peak memory reached.
+
+    Timings are only meaningful in an optimised build (-DCMAKE_BUILD_TYPE=Release).
+
+    usage: octree_bench [--min-depth N] [--max-depth N] [--repeat N] [--max-voxels N] [--filter name]
+*/
+
+#include "gl_includes.hpp"
+#include "octree.hpp"
+#include "voxel_array.hpp"
+#include "morton.hpp"
+#include "parallel.hpp"
+#include "camera.hpp"
+#include "cpu_raycaster.hpp"
+#include "cpu_renderer.hpp"
+#include "cpu_packet.hpp"
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Benchmark options
+int g_minDepth = 5;
+int g_maxDepth = 10;
+int g_repeat = 5;
+size_t g_maxVoxels = 32 << 20;      // Bigger scenes are skipped, they would not fit in memory
+std::string g_filter {};
+
+// Dense VoxelArrays keep 4 bytes per voxel
+const size_t max_voxel_array_bytes = size_t(2) << 30;
+
+// Resolution of the traversal benchmark
+const int trace_width = 256;
+const int trace_height = 256;
+
+// Resets the peak resident set size, where the OS allows it, so that each case reports its own peak
+static void resetPeakMemory() {
+#if defined(__linux__)
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+#endif
+}
+
+// Peak resident set size of the process, in bytes
+static size_t peakMemory() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return counters.PeakWorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss);    // Already in bytes on macOS
+#endif
+}
+
+struct Scene {
+    std::string name;
+    std::function<int(int, int, int, int)> voxel;   // Colour of (x, y, z) at a given size, 0 if empty
+    // Conservative bounds of voxel over the cube of cellSize voxels at (x, y, z), for buildImplicit.
+    // Empty for scenes without any.
+    std::function<CellBounds(int, int, int, int, int)> bounds;
+};
+
+static int rgb(float r, float g, float b) {
+    return (int)((unsigned int)(r * 255.0f) << 16 | (unsigned int)(g * 255.0f) << 8 | (unsigned int)(b * 255.0f));
+}
+
+// Scenes from sparse to dense: a thin shell (the VoxelArray scene), random noise and a terrain
+static std::vector<Scene> scenes() {
+    std::vector<Scene> list;
+    list.push_back(Scene { "shell", [](int x, int y, int z, int size) {
+        glm::vec3 p = glm::vec3(x, y, z) / glm::vec3(size) * 2.0f - 1.0f;
+        float l = glm::length(p);
+        if (l >= 1.0f || l <= 0.95f) return 0;
+        float s = (p.x + p.y + p.z) * 10.0f;
+        return rgb(std::sin(s) * 0.4f + 0.6f, std::sin(s + 2.0f) * 0.4f + 0.6f, std::sin(s + 4.0f) * 0.4f + 0.6f);
+    }, [](int x, int y, int z, int cellSize, int size) {
+        return VoxelArray::shellBounds(x, y, z, cellSize, size);
+    } });
+    list.push_back(Scene { "noise", [](int x, int y, int z, int) {
+        // 2% of the voxels, hashed so that the scene does not depend on the traversal order
+        uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+        h ^= h >> 13;
+        h *= 0x5bd1e995u;
+        h ^= h >> 15;
+        return h % 50 == 0 ? rgb(0.8f, 0.2f, 0.2f) : 0;
+    }, nullptr });
+    list.push_back(Scene { "terrain", [](int x, int y, int z, int size) {
+        glm::vec2 p = glm::vec2(x, z) / static_cast<float>(size);
+        float height = (0.3f + 0.1f * std::sin(p.x * 12.0f) * std::cos(p.y * 9.0f) + 0.05f * std::sin(p.x * 31.0f + p.y * 27.0f)) * size;
+        if (y > height) return 0;
+        return y + 2 > height ? rgb(0.3f, 0.7f, 0.2f) : rgb(0.5f, 0.4f, 0.3f);
+    }, [](int x, int y, int z, int cellSize, int size) {
+        // The height moves by at most 2.75 voxels per voxel along x and 2.25 along z
+        double extent = (cellSize - 1) * 0.5;
+        glm::vec2 p = glm::vec2(x + extent, z + extent) / static_cast<float>(size);
+        double height = (0.3 + 0.1 * std::sin(p.x * 12.0) * std::cos(p.y * 9.0) + 0.05 * std::sin(p.x * 31.0 + p.y * 27.0)) * size;
+        double slack = (2.75 + 2.25) * extent + 1.0;
+        if (y > height + slack) return CellBounds { CellBounds::Empty, 0 };
+        if (y + cellSize + 1 < height - slack) return CellBounds { CellBounds::Uniform, rgb(0.5f, 0.4f, 0.3f) };
+        return CellBounds { CellBounds::Mixed, 0 };
+    } });
+    return list;
+}
+
+// Sorted solid voxels of the scene, empty if there are more than g_maxVoxels of them
+static std::vector<MortonVoxel> generateScene(const Scene& scene, int depth) {
+    const int size = 1 << depth;
+    std::vector<std::vector<MortonVoxel>> slices(size);
+    std::atomic<size_t> count(0);
+    parallelFor(size, [&](size_t k) {
+        if (count > g_maxVoxels) return;
+        for (int j = 0; j < size; j++) {
+            for (int i = 0; i < size; i++) {
+                int value = scene.voxel(i, j, static_cast<int>(k), size);
+                if (value) slices[k].push_back({ mortonEncode(i, j, k), value });
+            }
+        }
+        count += slices[k].size();
+    }, 1);
+    if (count > g_maxVoxels) return std::vector<MortonVoxel>();
+
+    std::vector<MortonVoxel> voxels;
+    voxels.reserve(count);
+    for (std::vector<MortonVoxel>& slice : slices) {
+        voxels.insert(voxels.end(), slice.begin(), slice.end());
+        std::vector<MortonVoxel>().swap(slice);
+    }
+    sortMortonVoxels(voxels, 3 * depth);
+    return voxels;
+}
+
+// Times of the repetitions of a case, in seconds
+struct Timings {
+    std::vector<double> runs;
+
+    double median() const {
+        std::vector<double> sorted = runs;
+        std::sort(sorted.begin(), sorted.end());
+        size_t n = sorted.size();
+        return n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+    }
+    double min() const { return *std::min_element(runs.begin(), runs.end()); }
+    double max() const { return *std::max_element(runs.begin(), runs.end()); }
+};
+
+// Runs setup then the timed body g_repeat times. Only the body is timed.
+static Timings measure(const std::function<void()>& setup, const std::function<void()>& body) {
+    Timings timings;
+    for (int r = 0; r < g_repeat; r++) {
+        setup();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        body();
+        timings.runs.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return timings;
+}
+
+static bool selected(const std::string& name) {
+    return g_filter.empty() || name.find(g_filter) != std::string::npos;
+}
+
+static void printHeader() {
+    std::printf("%-18s %-8s %5s %10s %10s %11s %11s %7s %22s %10s\n",
+                "case", "scene", "depth", "voxels", "nodes", "median ms", "min ms", "spread", "throughput", "peak MB");
+}
+
+// items / median time is reported as the throughput, in `unit` per second
+static void report(const std::string& name, const std::string& scene, int depth, size_t voxels, size_t nodes,
+                   const Timings& timings, double items, const char* unit) {
+    double median = timings.median();
+    double spread = median > 0 ? (timings.max() - timings.min()) / median * 100.0 : 0.0;
+    char throughput[32];
+    std::snprintf(throughput, sizeof(throughput), "%.2f M%s/s", median > 0 ? items / median * 1e-6 : 0.0, unit);
+    std::printf("%-18s %-8s %5d %10zu %10zu %11.3f %11.3f %6.1f%% %22s %10.1f\n",
+                name.c_str(), scene.c_str(), depth, voxels, nodes, median * 1000.0, timings.min() * 1000.0, spread,
+                throughput, peakMemory() / (1024.0 * 1024.0));
+    std::fflush(stdout);
+}
+
+// VoxelArray::generateVoxelData and VoxelArray::generateOctree, on the only scene VoxelArray
+// knows, from the dense array, streamed chunk by chunk (streamOctree) and top-down (implicitOctree)
+static void benchVoxelArray(int depth) {
+    const size_t size = size_t(1) << depth;
+    const double cells = static_cast<double>(size * size * size);
+
+    // The constructor builds the octree once and logs its statistics, keep them out of the report
+    std::streambuf* out = std::cout.rdbuf();
+    std::ostringstream log;
+
+    if (size * size * size * sizeof(GLuint) <= max_voxel_array_bytes && (selected("generateVoxelData") || selected("generateOctree"))) {
+        std::cout.rdbuf(log.rdbuf());
+        resetPeakMemory();
+        VoxelArray array(depth, false, VoxelStorage::Dense);
+        std::cout.rdbuf(out);
+
+        if (selected("generateVoxelData")) {
+            Timings timings = measure([] {}, [&] { array.generateVoxelData(); });
+            report("generateVoxelData", "shell", depth, size * size * size, 0, timings, cells, "voxels");
+        }
+        if (selected("generateOctree")) {
+            resetPeakMemory();
+            std::cout.rdbuf(log.rdbuf());
+            Timings timings = measure([&] { log.str(""); }, [&] { array.generateOctree(); });
+            std::cout.rdbuf(out);
+            report("generateOctree", "shell", depth, size * size * size, array.octree->nodeCount(), timings, cells, "voxels");
+        }
+    }
+
+    if (selected("streamOctree")) {
+        std::cout.rdbuf(log.rdbuf());
+        resetPeakMemory();
+        std::unique_ptr<VoxelArray> array;
+        Timings timings = measure([&] { array.reset(); log.str(""); }, [&] {
+            array.reset(new VoxelArray(depth, false, VoxelStorage::Streamed));
+        });
+        std::cout.rdbuf(out);
+        report("streamOctree", "shell", depth, size * size * size, array->octree->nodeCount(), timings, cells, "voxels");
+    }
+
+    if (selected("implicitOctree")) {
+        std::cout.rdbuf(log.rdbuf());
+        resetPeakMemory();
+        std::unique_ptr<VoxelArray> array;
+        Timings timings = measure([&] { array.reset(); log.str(""); }, [&] {
+            array.reset(new VoxelArray(depth, false, VoxelStorage::Implicit));
+        });
+        std::cout.rdbuf(out);
+        report("implicitOctree", "shell", depth, size * size * size, array->octree->nodeCount(), timings, cells, "voxels");
+    }
+}
+
+// Octree::insert, one voxel at a time, against Octree::build on the same sorted voxels, and
+// Octree::buildImplicit straight from the scene when it has bounds
+static void benchConstruction(const Scene& scene, int depth, const std::vector<MortonVoxel>& voxels) {
+    std::unique_ptr<Octree> octree;
+
+    if (selected("insert")) {
+        std::vector<glm::uvec3> positions(voxels.size());
+        for (size_t i = 0; i < voxels.size(); i++) {
+            mortonDecode(voxels[i].code, positions[i].x, positions[i].y, positions[i].z);
+        }
+        resetPeakMemory();
+        Timings timings = measure([&] { octree.reset(); octree.reset(new Octree(depth)); }, [&] {
+            for (size_t i = 0; i < voxels.size(); i++) {
+                octree->insert(positions[i].x, positions[i].y, positions[i].z, voxels[i].value);
+            }
+        });
+        report("insert", scene.name, depth, voxels.size(), octree->nodeCount(), timings, static_cast<double>(voxels.size()), "voxels");
+    }
+
+    if (selected("build")) {
+        resetPeakMemory();
+        Timings timings = measure([&] { octree.reset(); octree.reset(new Octree(depth)); }, [&] { octree->build(voxels); });
+        report("build", scene.name, depth, voxels.size(), octree->nodeCount(), timings, static_cast<double>(voxels.size()), "voxels");
+    }
+
+    if (scene.bounds && selected("implicit")) {
+        const int size = 1 << depth;
+        resetPeakMemory();
+        Timings timings = measure([&] { octree.reset(); octree.reset(new Octree(depth)); }, [&] {
+            octree->buildImplicit([&](int x, int y, int z, int cellSize) { return scene.bounds(x, y, z, cellSize, size); },
+                                  [&](int x, int y, int z) {
+                                      int value = scene.voxel(x, y, z, size);
+                                      return value ? 0xFF000000u | static_cast<GLuint>(value) : 0u;
+                                  });
+        });
+        report("implicit", scene.name, depth, voxels.size(), octree->nodeCount(), timings, static_cast<double>(voxels.size()), "voxels");
+    }
+}
+
+// Octree::writeData on the collapsed tree, as flattened for the GPU
+static void benchFlatten(const std::string& scene, int depth, const std::vector<MortonVoxel>& voxels, Octree& octree) {
+    if (!selected("writeData")) return;
+    resetPeakMemory();
+    Timings timings = measure([] {}, [&] { octree.writeData(); });
+    report("writeData", scene, depth, voxels.size(), octree.nodeCount(), timings, static_cast<double>(octree.nodeCount()), "nodes");
+}
+
+// Conversion of the flattened tree to the compact node format, and the memory it saves
+static void benchCompact(const std::string& scene, int depth, const std::vector<MortonVoxel>& voxels, Octree& octree) {
+    if (!selected("compactPool")) return;
+    const NodePool blocks = octree.blockPool();
+    std::vector<GLuint> compact;
+    resetPeakMemory();
+    Timings timings = measure([] {}, [&] { compact = compactPool(blocks); });
+    report("compactPool", scene, depth, voxels.size(), octree.nodeCount(), timings, static_cast<double>(blocks.size / 8), "nodes");
+
+    const NodePool pool = NodePool { compact.data(), compact.size(), blocks.depth, nullptr, nullptr, 0, NodeFormat::Compact, blocks.palette, blocks.paletteSize,
+                                      nullptr, nullptr, 0, false };
+    std::printf("%-18s %-8s %5d pool of %.2f MB as blocks, %.2f MB compact, %.2fx less\n", "-", scene.c_str(), depth,
+                poolBytes(blocks) / (1024.0 * 1024.0), poolBytes(pool) / (1024.0 * 1024.0),
+                poolBytes(pool) ? static_cast<double>(poolBytes(blocks)) / poolBytes(pool) : 0.0);
+}
+
+// Octree::writeData with the bottom levels as bricks, and the memory it saves. octree is left
+// with its bricks.
+static void benchBricks(const std::string& scene, int depth, const std::vector<MortonVoxel>& voxels, Octree& octree) {
+    const size_t blockBytes = poolBytes(octree.blockPool());
+    octree.setBricks(true);
+    if (!selected("writeData-bricks")) return;
+    resetPeakMemory();
+    Timings timings = measure([] {}, [&] { octree.writeData(); });
+    report("writeData-bricks", scene, depth, voxels.size(), octree.nodeCount(), timings, static_cast<double>(octree.nodeCount()), "nodes");
+
+    const NodePool pool = octree.blockPool();
+    std::printf("%-18s %-8s %5d pool of %.2f MB as blocks, %.2f MB with bricks, %.2fx less\n", "-", scene.c_str(), depth,
+                blockBytes / (1024.0 * 1024.0), poolBytes(pool) / (1024.0 * 1024.0),
+                poolBytes(pool) ? static_cast<double>(blockBytes) / poolBytes(pool) : 0.0);
+}
+
+// Octree::writeData with geometry and colours apart, and the memory it saves. octree is left
+// with its attribute stream.
+static void benchAttributes(const std::string& scene, int depth, const std::vector<MortonVoxel>& voxels, Octree& octree) {
+    const size_t blockBytes = poolBytes(octree.blockPool());
+    octree.setAttributeStream(true);
+    if (!selected("writeData-attributes")) return;
+    resetPeakMemory();
+    Timings timings = measure([] {}, [&] { octree.writeData(); });
+    report("writeData-attributes", scene, depth, voxels.size(), octree.nodeCount(), timings, static_cast<double>(octree.nodeCount()), "nodes");
+
+    const NodePool pool = octree.blockPool();
+    std::printf("%-18s %-8s %5d %zu geometry blocks, %zu leaf values, %.2f MB, %.2fx less than blocks\n", "-", scene.c_str(), depth,
+                pool.size / 8, pool.attributeCount, poolBytes(pool) / (1024.0 * 1024.0),
+                poolBytes(pool) ? static_cast<double>(blockBytes) / poolBytes(pool) : 0.0);
+}
+
+// Octree::buildPalette on the collapsed tree, for 8 and 12-bit indices, and the size of the
+// compact pool once leaves hold indices
+static void benchPalette(const std::string& scene, int depth, const std::vector<MortonVoxel>& voxels) {
+    const int bits[] = { 8, 12 };
+    for (int b : bits) {
+        const std::string name = "buildPalette-" + std::to_string(b);
+        if (!selected(name)) continue;
+        std::unique_ptr<Octree> octree;
+        resetPeakMemory();
+        Timings timings = measure([&] {
+            octree.reset();
+            octree.reset(new Octree(depth));
+            octree->build(voxels);
+            octree->collapse();
+        }, [&] { octree->buildPalette(b); });
+        report(name, scene, depth, voxels.size(), octree->nodeCount(), timings, static_cast<double>(voxels.size()), "voxels");
+
+        octree->writeData();
+        octree->setNodeFormat(NodeFormat::Compact);
+        std::printf("%-18s %-8s %5d %zu colours, compact pool of %.2f MB\n", "-", scene.c_str(), depth,
+                    octree->colorPalette().colors.size(), poolBytes(octree->nodePool()) / (1024.0 * 1024.0));
+    }
+}
+
+// Single-threaded CPU reference ray caster, from a few points of the benchmark orbit
+static void benchTraversal(const std::string& scene, int depth, const std::vector<MortonVoxel>& voxels, Octree& octree) {
+    if (!selected("trace")) return;
+
+    const NodePool pool = octree.nodePool();
+    Camera camera;
+    camera.setAspectRatio(static_cast<float>(trace_width) / trace_height);
+    camera.setNear(0.1);
+    camera.setFar(80);
+    camera.setFoV(90);
+    Image image;
+    image.resize(trace_width, trace_height);
+
+    const int views = 4;
+    TraversalStats stats;
+    resetPeakMemory();
+    Timings timings = measure([&] { stats = TraversalStats(); }, [&] {
+        for (int view = 0; view < views; view++) {
+            orbitCamera(camera, depth, view, views);
+            renderReference(pool, TraceSettings(), camera, image, &stats);
+        }
+    });
+    report("trace", scene, depth, voxels.size(), octree.nodeCount(), timings, static_cast<double>(stats.rays), "rays");
+}
+
+// Tiled renderer on a single worker, once per packet kernel the processor supports, on the
+// pool in the format octree is set to
+static void benchPacketTraversal(const std::string& scene, int depth, const std::vector<MortonVoxel>& voxels, Octree& octree) {
+    const NodePool pool = octree.nodePool();
+    Camera camera;
+    camera.setAspectRatio(static_cast<float>(trace_width) / trace_height);
+    camera.setNear(0.1);
+    camera.setFar(80);
+    camera.setFoV(90);
+    Image image;
+    image.resize(trace_width, trace_height);
+
+    const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE4, SimdLevel::AVX2, SimdLevel::AVX512 };
+    for (SimdLevel level : levels) {
+        const std::string name = std::string("trace-") + simdLevelName(level) + (pool.format == NodeFormat::Compact ? "-compact" : (pool.ranks ? "-attributes" : (pool.bricks ? "-bricks" : "")));
+        if (!selected(name) || packetTracer(level).level != level) continue;
+
+        CPURenderer renderer(1);
+        renderer.simd = level;
+        const int views = 4;
+        uint64_t rays = 0;
+        resetPeakMemory();
+        Timings timings = measure([&] { rays = 0; }, [&] {
+            for (int view = 0; view < views; view++) {
+                orbitCamera(camera, depth, view, views);
+                renderer.render(pool, camera, image);
+                rays += renderer.stats().rays;
+            }
+        });
+        report(name, scene, depth, voxels.size(), octree.nodeCount(), timings, static_cast<double>(rays), "rays");
+    }
+}
+
+static void parseArguments(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--min-depth" && i + 1 < argc) {
+            g_minDepth = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--max-depth" && i + 1 < argc) {
+            g_maxDepth = std::min(std::atoi(argv[++i]), max_octree_depth);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            g_repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--max-voxels" && i + 1 < argc) {
+            g_maxVoxels = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            g_filter = argv[++i];
+        } else {
+            std::cerr << "WARNING: Unknown argument '" << arg << "'" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    parseArguments(argc, argv);
+#ifndef NDEBUG
+    std::cerr << "WARNING: Unoptimised build, configure with -DCMAKE_BUILD_TYPE=Release for meaningful timings" << std::endl;
+#endif
+    std::printf("%u workers, %d runs per case\n", workerCount(), g_repeat);
+    printHeader();
+
+    for (int depth = g_minDepth; depth <= g_maxDepth; depth++) {
+        for (const Scene& scene : scenes()) {
+            std::vector<MortonVoxel> voxels = generateScene(scene, depth);
+            if (voxels.empty()) {
+                std::printf("%-18s %-8s %5d skipped, more than %zu voxels\n", "-", scene.name.c_str(), depth, g_maxVoxels);
+                continue;
+            }
+            if (scene.name == "shell") {
+                benchVoxelArray(depth);
+            }
+
+            benchConstruction(scene, depth, voxels);
+
+            Octree octree(depth);
+            octree.build(voxels);
+            octree.collapse();
+            octree.writeData();
+            benchFlatten(scene.name, depth, voxels, octree);
+            benchCompact(scene.name, depth, voxels, octree);
+            benchPalette(scene.name, depth, voxels);
+            benchTraversal(scene.name, depth, voxels, octree);
+            benchPacketTraversal(scene.name, depth, voxels, octree);
+            octree.setNodeFormat(NodeFormat::Compact);
+            benchPacketTraversal(scene.name, depth, voxels, octree);
+            octree.setNodeFormat(NodeFormat::Blocks);
+            benchBricks(scene.name, depth, voxels, octree);
+            benchPacketTraversal(scene.name, depth, voxels, octree);
+            octree.setBricks(false);
+            benchAttributes(scene.name, depth, voxels, octree);
+            benchPacketTraversal(scene.name, depth, voxels, octree);
+        }
+    }
+    return EXIT_SUCCESS;
+}
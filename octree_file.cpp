@@ -0,0 +1,209 @@
+/*
+    octree_file.cpp
+    author: Telo PHILIPPE
+
+    Implementation of the .vxo octree files.
+*/
+
+#include "octree_file.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t octreeChecksum(const GLuint* data, size_t count, uint64_t hash) {
+    for (size_t i = 0; i < count; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+namespace {
+
+// Checksum of every array of the pool, in file order
+uint64_t poolChecksum(const NodePool& pool) {
+    uint64_t hash = octreeChecksum(pool.palette, pool.paletteSize, octreeChecksum(pool.far, pool.farCount, octreeChecksum(pool.data, pool.size)));
+    if (pool.lod) {
+        hash = octreeChecksum(pool.lod, pool.size / 8, hash);
+    }
+    if (pool.ranks) {
+        hash = octreeChecksum(pool.attributes, pool.attributeCount, octreeChecksum(pool.ranks, pool.size, hash));
+    }
+    return hash;
+}
+
+}  // namespace
+
+bool saveOctreeFile(const std::string& filename, const NodePool& blockPool, uint32_t flags) {
+    NodePool pool = blockPool;
+    std::vector<GLuint> filtered;
+    if (pool.ranks) {
+        pool.lod = nullptr;
+    } else if (!pool.lod) {
+        filtered = filterPool(pool);
+        pool.lod = filtered.data();
+    }
+
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    if (!file.good()) {
+        std::cerr << "ERROR: Cannot write file '" << filename << "'" << std::endl;
+        return false;
+    }
+
+    OctreeFileHeader header;
+    std::memcpy(header.magic, octree_file_magic, sizeof(header.magic));
+    header.version = octree_file_version;
+    header.depth = pool.depth;
+    header.flags = flags & ~(octree_file_flag_attributes | octree_file_flag_bricks);
+    if (pool.ranks) header.flags |= octree_file_flag_attributes;
+    if (pool.bricks) header.flags |= octree_file_flag_bricks;
+    header.entryCount = pool.size;
+    header.farCount = pool.farCount;
+    header.paletteSize = pool.paletteSize;
+    header.lodCount = pool.lod ? pool.size / 8 : 0;
+    header.attributeCount = pool.ranks ? pool.attributeCount : 0;
+    header.checksum = poolChecksum(pool);
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(pool.data), pool.size * sizeof(GLuint));
+    file.write(reinterpret_cast<const char*>(pool.far), pool.farCount * sizeof(GLuint));
+    file.write(reinterpret_cast<const char*>(pool.palette), pool.paletteSize * sizeof(GLuint));
+    file.write(reinterpret_cast<const char*>(pool.lod), header.lodCount * sizeof(GLuint));
+    if (pool.ranks) {
+        file.write(reinterpret_cast<const char*>(pool.ranks), pool.size * sizeof(GLuint));
+        file.write(reinterpret_cast<const char*>(pool.attributes), pool.attributeCount * sizeof(GLuint));
+    }
+    return file.good();
+}
+
+MappedOctreeFile::~MappedOctreeFile() {
+    close();
+}
+
+bool MappedOctreeFile::open(const std::string& filename, bool verifyChecksum) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "ERROR: Cannot open file '" << filename << "'" << std::endl;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        std::cerr << "ERROR: Cannot read the size of file '" << filename << "'" << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* mapping = fileMapping ? MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!mapping) {
+        std::cerr << "ERROR: Cannot map file '" << filename << "'" << std::endl;
+        if (fileMapping) CloseHandle(fileMapping);
+        CloseHandle(file);
+        return false;
+    }
+    m_file = file;
+    m_fileMapping = fileMapping;
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "ERROR: Cannot open file '" << filename << "'" << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::cerr << "ERROR: Cannot read the size of file '" << filename << "'" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void* mapping = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "ERROR: Cannot map file '" << filename << "'" << std::endl;
+        return false;
+    }
+    // The whole pool is read front to back by the checksum and the upload
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+    m_size = static_cast<size_t>(st.st_size);
+#endif
+    m_mapping = mapping;
+
+    if (m_size < sizeof(OctreeFileHeader) || std::memcmp(header().magic, octree_file_magic, sizeof(octree_file_magic)) != 0) {
+        std::cerr << "ERROR: '" << filename << "' is not an octree file" << std::endl;
+        close();
+        return false;
+    }
+    const OctreeFileHeader& h = header();
+    if (h.version != octree_file_version) {
+        std::cerr << "ERROR: '" << filename << "' has version " << h.version << ", expected " << octree_file_version << std::endl;
+        close();
+        return false;
+    }
+    const bool attributes = (h.flags & octree_file_flag_attributes) != 0;
+    if (h.depth > static_cast<uint32_t>(max_octree_depth) || h.entryCount == 0 || h.entryCount % 8 != 0 || h.entryCount / 8 > 0xFFFFFFFFull
+        || h.lodCount != (attributes ? 0 : h.entryCount / 8)) {
+        std::cerr << "ERROR: '" << filename << "' has an invalid header" << std::endl;
+        close();
+        return false;
+    }
+    // Every array is checked against the entries left, so that no size computation can overflow
+    const uint64_t counts[] = { h.entryCount, h.farCount, h.paletteSize, h.lodCount, attributes ? h.entryCount : 0, h.attributeCount };
+    uint64_t left = (m_size - sizeof(OctreeFileHeader)) / sizeof(GLuint);
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        if (counts[i] > left) {
+            std::cerr << "ERROR: '" << filename << "' is truncated" << std::endl;
+            close();
+            return false;
+        }
+        left -= counts[i];
+    }
+    const NodePool mapped = pool();
+    if (verifyChecksum && poolChecksum(mapped) != h.checksum) {
+        std::cerr << "ERROR: '" << filename << "' is corrupted (checksum mismatch)" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedOctreeFile::close() {
+    if (!m_mapping) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(m_mapping);
+    CloseHandle(m_fileMapping);
+    CloseHandle(m_file);
+    m_file = nullptr;
+    m_fileMapping = nullptr;
+#else
+    munmap(m_mapping, m_size);
+#endif
+    m_mapping = nullptr;
+    m_size = 0;
+}
+
+NodePool MappedOctreeFile::pool() const {
+    const OctreeFileHeader& h = header();
+    const GLuint* data = reinterpret_cast<const GLuint*>(static_cast<const char*>(m_mapping) + sizeof(OctreeFileHeader));
+    const GLuint* palette = h.paletteSize ? data + h.entryCount + h.farCount : nullptr;
+    const GLuint* lod = h.lodCount ? data + h.entryCount + h.farCount + h.paletteSize : nullptr;
+    const GLuint* ranks = (h.flags & octree_file_flag_attributes) ? data + h.entryCount + h.farCount + h.paletteSize + h.lodCount : nullptr;
+    return NodePool { data, static_cast<size_t>(h.entryCount), static_cast<int>(h.depth), lod, data + h.entryCount, static_cast<size_t>(h.farCount), NodeFormat::Blocks,
+                      palette, static_cast<size_t>(h.paletteSize), ranks, ranks ? ranks + h.entryCount : nullptr, static_cast<size_t>(h.attributeCount),
+                      (h.flags & octree_file_flag_bricks) != 0 };
+}
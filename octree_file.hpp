@@ -0,0 +1,76 @@
+/*
+    octree_file.hpp
+    author: Telo PHILIPPE
+
+    Binary storage of flattened octrees (.vxo files). A file is an OctreeFileHeader
+    followed by the node pool, its far pointers, its palette, its level of detail entries, and
+    for pools with an attribute stream their ranks and attributes, exactly as Octree::writeData
+    produces them, so it can be memory-mapped and uploaded to the GPU without any conversion.
+*/
+
+#ifndef OCTREE_FILE_HPP
+#define OCTREE_FILE_HPP
+
+#include "gl_includes.hpp"
+#include "node_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+const char octree_file_magic[4] = { 'V', 'X', 'O', 'T' };
+// Version 2: relative addresses and far pointers. Version 3: palettes. Version 4: attribute streams.
+// Version 5: bricks. Version 6: level of detail entries.
+const uint32_t octree_file_version = 6;
+
+const uint32_t octree_file_flag_dag = 1;
+const uint32_t octree_file_flag_attributes = 2;     // entryCount ranks follow the palette
+const uint32_t octree_file_flag_bricks = 4;         // The bottom levels of the pool are bricks
+
+struct OctreeFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t depth;
+    uint32_t flags;
+    uint64_t entryCount;    // Number of 32-bit entries, 8 per node block
+    uint64_t farCount;      // Number of far pointers, stored after the entries
+    uint64_t paletteSize;   // Number of palette colours, stored after the far pointers, 0 without a palette
+    uint64_t lodCount;      // Number of level of detail entries, stored after the palette: one per block, 0 with an attribute stream
+    uint64_t attributeCount;    // Number of attributes, stored after the ranks
+    uint64_t checksum;      // FNV-1a of the entries, far pointers, palette, level of detail entries, ranks and attributes
+};
+
+const uint64_t octree_checksum_seed = 14695981039346656037ULL;
+
+// hash continues the checksum of the data before, if any
+uint64_t octreeChecksum(const GLuint* data, size_t count, uint64_t hash = octree_checksum_seed);
+
+// octree_file_flag_attributes and octree_file_flag_bricks are set from the pool. The level of
+// detail entries are computed if the pool has none.
+bool saveOctreeFile(const std::string& filename, const NodePool& pool, uint32_t flags);
+
+// Read-only memory mapping of a .vxo file. The pool points directly into the mapping,
+// which stays valid as long as the object lives.
+class MappedOctreeFile {
+public:
+    MappedOctreeFile() = default;
+    MappedOctreeFile(const MappedOctreeFile&) = delete;
+    MappedOctreeFile& operator=(const MappedOctreeFile&) = delete;
+    ~MappedOctreeFile();
+
+    bool open(const std::string& filename, bool verifyChecksum = true);
+    void close();
+
+    const OctreeFileHeader& header() const { return *reinterpret_cast<const OctreeFileHeader*>(m_mapping); }
+    NodePool pool() const;
+
+private:
+    void* m_mapping = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_fileMapping = nullptr;
+#endif
+};
+
+#endif  // OCTREE_FILE_HPP
@@ -0,0 +1,225 @@
+/*
+    palette.hpp
+    author: Telo PHILIPPE
+
+    Colour palettes for octrees whose leaves store an index instead of their colour
+    (see node_pool.hpp). A palette of at most 2^bits colours is built at import time by
+    median cut over the distinct colours of the leaves, each weighted by the number of
+    voxels it covers.
+*/
+
+#ifndef PALETTE_HPP
+#define PALETTE_HPP
+
+#include "gl_includes.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Palettes index up to 2^16 colours, so that two indices fit in a compact pool word
+const int max_palette_bits = 16;
+
+// A colour and the summed weight of its samples
+struct WeightedColor {
+    GLuint rgb;
+    double weight;
+};
+
+class Palette {
+public:
+    std::vector<GLuint> colors;    // 0x00RRGGBB
+
+    bool empty() const {
+        return colors.empty();
+    }
+
+    // Index of the palette colour closest to rgb
+    GLuint index(GLuint rgb) const {
+        std::unordered_map<GLuint, GLuint>::const_iterator it = indices.find(rgb);
+        if (it != indices.end()) {
+            return it->second;
+        }
+        GLuint best = 0;
+        int bestDistance = 0x7FFFFFFF;
+        for (size_t i = 0; i < colors.size(); i++) {
+            int dr = static_cast<int>((rgb >> 16) & 0xFF) - static_cast<int>((colors[i] >> 16) & 0xFF);
+            int dg = static_cast<int>((rgb >> 8) & 0xFF) - static_cast<int>((colors[i] >> 8) & 0xFF);
+            int db = static_cast<int>(rgb & 0xFF) - static_cast<int>(colors[i] & 0xFF);
+            int distance = dr * dr + dg * dg + db * db;
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = static_cast<GLuint>(i);
+            }
+        }
+        return best;
+    }
+
+    GLuint quantize(GLuint rgb) const {
+        return colors[index(rgb)];
+    }
+
+    // Replaces the colours, e.g. by the ones of a file
+    void assign(const GLuint* rgb, size_t count) {
+        colors.assign(rgb, rgb + count);
+        indices.clear();
+        for (size_t i = count; i-- > 0;) {
+            indices[colors[i]] = static_cast<GLuint>(i);
+        }
+    }
+
+    // Median cut over colors, sorted by colour without duplicates: the box holding the most
+    // weight times its longest side is split at the weighted median of that side, until
+    // there are 2^bits boxes or every box holds a single colour. Each box becomes the
+    // weighted average of its colours. indexOf[i] is set to the palette entry of colors[i].
+    static Palette medianCut(const std::vector<WeightedColor>& colors, int bits, std::vector<GLuint>& indexOf);
+
+private:
+    std::unordered_map<GLuint, GLuint> indices;    // Palette colour to its first index
+};
+
+// Samples sorted at once by gatherColors, before merging them into the colours of their worker
+const size_t palette_sample_batch = 1 << 16;
+
+// Distinct colours of count samples with their summed weights, sorted by colour. sample(i, rgb, weight)
+// gives sample i. Each worker sorts its range batch by batch into a run of distinct colours,
+// the runs are merged after, so memory follows the number of colours rather than of samples.
+template <typename Sample>
+std::vector<WeightedColor> gatherColors(size_t count, Sample sample) {
+    std::vector<std::vector<WeightedColor>> runs(workerCount());
+    const auto byColor = [](const WeightedColor& a, const WeightedColor& b) { return a.rgb < b.rgb; };
+    const auto mergeDuplicates = [](std::vector<WeightedColor>& colors) {
+        size_t out = 0;
+        for (size_t i = 0; i < colors.size(); i++) {
+            if (out > 0 && colors[out - 1].rgb == colors[i].rgb) {
+                colors[out - 1].weight += colors[i].weight;
+            } else {
+                colors[out++] = colors[i];
+            }
+        }
+        colors.resize(out);
+    };
+
+    parallelForRanges(count, [&](size_t worker, size_t begin, size_t end) {
+        std::vector<WeightedColor>& run = runs[worker];
+        std::vector<WeightedColor> batch;
+        for (size_t first = begin; first < end; first += palette_sample_batch) {
+            batch.resize(std::min(palette_sample_batch, end - first));
+            for (size_t i = 0; i < batch.size(); i++) {
+                sample(first + i, batch[i].rgb, batch[i].weight);
+            }
+            std::sort(batch.begin(), batch.end(), byColor);
+            mergeDuplicates(batch);
+            size_t middle = run.size();
+            run.insert(run.end(), batch.begin(), batch.end());
+            std::inplace_merge(run.begin(), run.begin() + middle, run.end(), byColor);
+            mergeDuplicates(run);
+        }
+    });
+
+    std::vector<WeightedColor> colors;
+    for (std::vector<WeightedColor>& run : runs) {
+        size_t middle = colors.size();
+        colors.insert(colors.end(), run.begin(), run.end());
+        std::vector<WeightedColor>().swap(run);
+        std::inplace_merge(colors.begin(), colors.begin() + middle, colors.end(), byColor);
+    }
+    mergeDuplicates(colors);
+    return colors;
+}
+
+inline Palette Palette::medianCut(const std::vector<WeightedColor>& colors, int bits, std::vector<GLuint>& indexOf) {
+    struct Box {
+        size_t begin, end;      // Range of order
+        double weight;
+        int axis;               // Longest side: 0 for red, 1 for green, 2 for blue
+        int extent;
+    };
+    const auto channel = [](GLuint rgb, int axis) { return static_cast<int>((rgb >> (16 - 8 * axis)) & 0xFF); };
+
+    std::vector<GLuint> order(colors.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = static_cast<GLuint>(i);
+
+    const auto measure = [&](Box& box) {
+        int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+        box.weight = 0.0;
+        for (size_t i = box.begin; i < box.end; i++) {
+            const WeightedColor& c = colors[order[i]];
+            box.weight += c.weight;
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], channel(c.rgb, a));
+                hi[a] = std::max(hi[a], channel(c.rgb, a));
+            }
+        }
+        box.axis = 0;
+        for (int a = 1; a < 3; a++) {
+            if (hi[a] - lo[a] > hi[box.axis] - lo[box.axis]) box.axis = a;
+        }
+        box.extent = hi[box.axis] - lo[box.axis];
+    };
+
+    // Boxes that can still be split, by score
+    std::vector<Box> boxes;
+    std::priority_queue<std::pair<double, size_t>> splittable;
+    const auto add = [&](const Box& box) {
+        if (box.extent > 0) splittable.push(std::make_pair(box.weight * box.extent, boxes.size()));
+        boxes.push_back(box);
+    };
+    if (!colors.empty()) {
+        Box all = { 0, colors.size(), 0.0, 0, 0 };
+        measure(all);
+        add(all);
+    }
+    const size_t maxColors = size_t(1) << std::min(std::max(bits, 1), max_palette_bits);
+    while (boxes.size() < maxColors && !splittable.empty()) {
+        const size_t split = splittable.top().second;
+        const Box box = boxes[split];
+        splittable.pop();
+
+        const int axis = box.axis;
+        std::sort(order.begin() + box.begin, order.begin() + box.end, [&](GLuint a, GLuint b) {
+            return channel(colors[a].rgb, axis) < channel(colors[b].rgb, axis);
+        });
+        // Both halves keep at least one colour
+        size_t median = box.begin + 1;
+        double below = colors[order[box.begin]].weight;
+        while (median < box.end - 1 && below + colors[order[median]].weight <= box.weight * 0.5) {
+            below += colors[order[median]].weight;
+            median++;
+        }
+        Box lower = { box.begin, median, 0.0, 0, 0 };
+        Box upper = { median, box.end, 0.0, 0, 0 };
+        measure(lower);
+        measure(upper);
+        boxes[split] = lower;
+        if (lower.extent > 0) splittable.push(std::make_pair(lower.weight * lower.extent, split));
+        add(upper);
+    }
+
+    Palette palette;
+    indexOf.assign(colors.size(), 0);
+    std::vector<GLuint> rgb(boxes.size());
+    for (size_t b = 0; b < boxes.size(); b++) {
+        double sum[3] = { 0.0, 0.0, 0.0 };
+        for (size_t i = boxes[b].begin; i < boxes[b].end; i++) {
+            const WeightedColor& c = colors[order[i]];
+            for (int a = 0; a < 3; a++) sum[a] += c.weight * channel(c.rgb, a);
+            indexOf[order[i]] = static_cast<GLuint>(b);
+        }
+        GLuint average = 0;
+        for (int a = 0; a < 3; a++) {
+            GLuint value = boxes[b].weight > 0.0 ? static_cast<GLuint>(sum[a] / boxes[b].weight + 0.5) : 0;
+            average |= std::min(value, 255u) << (16 - 8 * a);
+        }
+        rgb[b] = average;
+    }
+    palette.assign(rgb.data(), rgb.size());
+    return palette;
+}
+
+#endif  // PALETTE_HPP
@@ -0,0 +1,67 @@
+/*
+    parallel.hpp
+    author: Telo PHILIPPE
+
+    Minimal helpers to split loops across all hardware threads, run by one pool of workers
+    started on first use and shared by every loop.
+*/
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+
+// Number of threads used by parallelFor, at least one
+inline unsigned int workerCount() {
+    static const unsigned int count = std::max(1u, std::thread::hardware_concurrency());
+    return count;
+}
+
+// Workers of parallelForRanges. Loops issued one after the other, like the batches of
+// Octree::buildImplicit, reuse the same threads instead of creating new ones each time.
+inline ThreadPool& parallelPool() {
+    static ThreadPool pool(workerCount());
+    return pool;
+}
+
+// Set on the threads running a range of parallelForRanges
+inline bool& insideParallelLoop() {
+    static thread_local bool inside = false;
+    return inside;
+}
+
+// Calls fn(worker, begin, end) on contiguous ranges covering [0, count), one range per worker.
+// Small loops are run on the calling thread, where waking the workers would cost more than the
+// work, and so are loops nested in another one, whose workers are all busy.
+template <typename F>
+void parallelForRanges(size_t count, F fn, size_t minPerWorker = 4096) {
+    size_t workers = std::min<size_t>(workerCount(), (count + minPerWorker - 1) / minPerWorker);
+    if (workers <= 1 || insideParallelLoop()) {
+        if (count > 0) fn(0, 0, count);
+        return;
+    }
+
+    size_t chunk = (count + workers - 1) / workers;
+    parallelPool().run(workers, [&](size_t w) {
+        insideParallelLoop() = true;
+        size_t begin = std::min(count, w * chunk);
+        fn(w, begin, std::min(count, begin + chunk));
+        insideParallelLoop() = false;
+    });
+}
+
+// Calls fn(i) for every i in [0, count)
+template <typename F>
+void parallelFor(size_t count, F fn, size_t minPerWorker = 4096) {
+    parallelForRanges(count, [&fn](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            fn(i);
+        }
+    }, minPerWorker);
+}
+
+#endif  // PARALLEL_HPP
@@ -0,0 +1,155 @@
+/*
+    profiler.cpp
+    author: Telo PHILIPPE
+
+    Implementation of the profiler rings, GPU timers and trace export.
+*/
+
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+uint64_t profilerNow() {
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void ProfileRing::snapshot(std::vector<ProfileEvent>& out) const {
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t first = head > capacity ? head - capacity : 0;
+    size_t base = out.size();
+    for (uint64_t i = first; i < head; i++) {
+        out.push_back(m_events[i & (capacity - 1)]);
+    }
+
+    // The writer may have wrapped around onto the oldest entries while they were copied
+    uint64_t after = m_head.load(std::memory_order_acquire);
+    uint64_t valid = after > capacity ? after - capacity : 0;
+    if (valid > first) {
+        out.erase(out.begin() + base, out.begin() + base + std::min<uint64_t>(valid - first, head - first));
+    }
+}
+
+// Every ring ever created, kept alive until exit so that traces outlive their threads
+static std::mutex& ringsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<std::unique_ptr<ProfileRing>>& rings() {
+    static std::vector<std::unique_ptr<ProfileRing>> list;
+    return list;
+}
+
+// Rings without a name are named after their index
+static ProfileRing& createRing(const std::string& name) {
+    std::lock_guard<std::mutex> lock(ringsMutex());
+    rings().emplace_back(new ProfileRing(name.empty() ? "Thread " + std::to_string(rings().size()) : name));
+    return *rings().back();
+}
+
+ProfileRing& threadProfileRing() {
+    thread_local ProfileRing* ring = nullptr;
+    if (!ring) {
+        ring = &createRing("");
+    }
+    return *ring;
+}
+
+void setProfileThreadName(const std::string& name) {
+    ProfileRing& ring = threadProfileRing();
+    std::lock_guard<std::mutex> lock(ringsMutex());
+    ring.name = name;
+}
+
+static ProfileRing& gpuRing() {
+    static ProfileRing& ring = createRing("GPU");
+    return ring;
+}
+
+void GPUTimer::begin() {
+    if (!m_queries[0]) {
+        glGenQueries(latency, m_queries);
+    }
+    // All queries still in flight: skip this pass rather than wait
+    if (m_submitted[m_next]) return;
+
+    m_submitted[m_next] = profilerNow();
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_next]);
+    m_running = true;
+}
+
+void GPUTimer::end() {
+    if (!m_running) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    m_next = (m_next + 1) % latency;
+    m_running = false;
+}
+
+bool GPUTimer::collect() {
+    bool collected = false;
+    // Oldest first, m_next being the slot reused next
+    for (int i = 0; i < latency; i++) {
+        int slot = (m_next + i) % latency;
+        if (!m_submitted[slot] || (m_running && slot == m_next)) continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(m_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(m_queries[slot], GL_QUERY_RESULT, &elapsed);
+        gpuRing().push(ProfileEvent { m_name, m_submitted[slot], elapsed });
+        m_lastTime = elapsed * 1e-6f;
+        m_submitted[slot] = 0;
+        collected = true;
+    }
+    return collected;
+}
+
+void GPUTimer::release() {
+    if (m_queries[0]) {
+        glDeleteQueries(latency, m_queries);
+    }
+    for (int i = 0; i < latency; i++) {
+        m_queries[i] = 0;
+        m_submitted[i] = 0;
+    }
+    m_next = 0;
+    m_running = false;
+}
+
+bool writeChromeTrace(const std::string& filename) {
+    std::ofstream file(filename.c_str());
+    if (!file.good()) {
+        std::cerr << "ERROR: Cannot write file '" << filename << "'" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(ringsMutex());
+    std::vector<ProfileEvent> events;
+    file.setf(std::ios::fixed);
+    file.precision(3);     // Timestamps are in microseconds
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (size_t tid = 0; tid < rings().size(); tid++) {
+        const ProfileRing& ring = *rings()[tid];
+        file << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+             << ", \"args\": {\"name\": \"" << ring.name << "\"}}";
+        first = false;
+
+        events.clear();
+        ring.snapshot(events);
+        for (const ProfileEvent& event : events) {
+            file << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+                 << ", \"ts\": " << event.start / 1000.0 << ", \"dur\": " << event.duration / 1000.0 << "}";
+        }
+    }
+    file << "\n]}\n";
+    return file.good();
+}
@@ -0,0 +1,128 @@
+/*
+    profiler.hpp
+    author: Telo PHILIPPE
+
+    Lightweight instrumentation: scoped CPU zones recorded in a ring buffer per thread,
+    GL_TIME_ELAPSED queries around GPU passes, frame time histories for ImGui graphs,
+    and an export of everything still buffered to the Chrome trace_event format
+    (chrome://tracing or https://ui.perfetto.dev).
+
+    Recording never locks: each thread only writes to its own ring, and readers copy
+    rings while they are being written, dropping the entries overwritten meanwhile.
+*/
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "gl_includes.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A timed interval, in nanoseconds since the first call to profilerNow
+struct ProfileEvent {
+    const char* name;   // Must outlive the profiler, typically a string literal
+    uint64_t start;
+    uint64_t duration;
+};
+
+uint64_t profilerNow();
+
+// Single-writer ring of the last events of one thread, or of the GPU
+class ProfileRing {
+public:
+    static const size_t capacity = 1 << 14;
+
+    explicit ProfileRing(const std::string& name) : name(name) {}
+
+    void push(const ProfileEvent& event) {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        m_events[head & (capacity - 1)] = event;
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    // Appends the buffered events to out, oldest first. Safe to call while push runs.
+    void snapshot(std::vector<ProfileEvent>& out) const;
+
+    std::string name;
+
+private:
+    ProfileEvent m_events[capacity];
+    std::atomic<uint64_t> m_head { 0 };
+};
+
+// Ring of the calling thread, registered on first use
+ProfileRing& threadProfileRing();
+
+// Renames the track of the calling thread in exported traces
+void setProfileThreadName(const std::string& name);
+
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name) : m_name(name), m_start(profilerNow()) {}
+    ~ProfileZone() { threadProfileRing().push(ProfileEvent { m_name, m_start, profilerNow() - m_start }); }
+
+private:
+    const char* m_name;
+    uint64_t m_start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+
+// Times a GPU pass with GL_TIME_ELAPSED queries. Results are read back a few frames later
+// so that the CPU never waits for the GPU, and recorded on the "GPU" track at the CPU
+// time the pass was submitted. Needs a current GL context from begin to release.
+class GPUTimer {
+public:
+    explicit GPUTimer(const char* name) : m_name(name) {}
+
+    void begin();
+    void end();
+
+    // Records the passes whose results are available, returns false if there were none
+    bool collect();
+
+    // Duration of the last pass read back, in milliseconds
+    float lastTime() const { return m_lastTime; }
+
+    void release();
+
+private:
+    static const int latency = 4;
+
+    const char* m_name;
+    GLuint m_queries[latency] = {};
+    uint64_t m_submitted[latency] = {};     // CPU time of begin, 0 when the query is free
+    int m_next = 0;
+    bool m_running = false;
+    float m_lastTime = 0;
+};
+
+// Last values of a time series, laid out for ImGui::PlotLines(values, size, offset)
+struct TimeHistory {
+    static const int size = 120;
+    float values[size] = {};
+    int offset = 0;
+
+    void add(float value) {
+        values[offset] = value;
+        offset = (offset + 1) % size;
+    }
+
+    float last() const { return values[(offset + size - 1) % size]; }
+
+    float max() const {
+        float m = 0;
+        for (float v : values) m = v > m ? v : m;
+        return m;
+    }
+};
+
+// Writes the events of every ring in Chrome trace_event JSON
+bool writeChromeTrace(const std::string& filename);
+
+#endif  // PROFILER_HPP
@@ -14,6 +14,10 @@ const int value_mask = 0x00FFFFFF;
 
 const int address_flag = 0x0F000000;
 const int address_mask = 0x00FFFFFF;
+const int address_bias = 0x00800000;
+
+const int far_flag = 0x0E000000;
+const int far_mask = 0x00FFFFFF;
 
 out vec4 outColor;
 
@@ -51,10 +55,65 @@ struct VoxelMap {
 	ivec3 size;
 };
 
-uniform usampler3D u_octreeTex;
+// Flattened octree: blocks of 8 child entries, block 0 being the root (see node_pool.hpp)
+uniform usamplerBuffer u_octreeTex;
+uniform usamplerBuffer u_farTex;    // Blocks of the children too far away for relative addresses
 uniform int u_octreeDepth;
-
-const int mapSize = 1 << (u_octreeDepth);
+uniform bool u_skipEmpty;
+uniform bool u_resumeLookups;
+
+// Pre-filtered node of each block, occupancy << 24 | rgb (see node_pool.hpp)
+uniform usamplerBuffer u_lodTex;
+// Height of a pixel at a distance of one voxel, 0 to always descend to the leaves
+uniform float u_lodFootprint;
+
+// u_octreeTex holds descriptors with child masks instead of blocks, and the level of detail
+// entries in place of u_lodTex (NodeFormat::Compact in node_pool.hpp)
+uniform bool u_compactNodes;
+#define COMPACT_DESCRIPTOR_SIZE 3
+
+// Colours of the leaves, which hold an index into it, when u_paletteSize is not 0. Compact
+// pools then pack four 8-bit indices per entry up to COMPACT_BYTE_PALETTE_SIZE colours, two
+// 16-bit indices above.
+uniform usamplerBuffer u_paletteTex;
+uniform int u_paletteSize;
+#define COMPACT_BYTE_PALETTE_SIZE 256
+
+// Leaves of the block pool hold no colour: the ranks of the entries on the path to a leaf add up to
+// its index in u_attributeTex, which holds the leaf values in depth-first order (see node_pool.hpp).
+// Interior nodes take the colour of their first leaf, there is no u_lodTex.
+uniform bool u_attributes;
+uniform usamplerBuffer u_rankTex;
+uniform usamplerBuffer u_attributeTex;
+
+// The nodes BRICK_LEVELS above the voxels are bricks in block pools with u_bricks (see node_pool.hpp):
+// the occupancy bits of their 8x8x8 voxels in Morton order, the solid voxels before each 4x4x4 octant
+// as 16-bit halves, then the solid voxels packed like the leaves of compact pools
+uniform bool u_bricks;
+#define BRICK_LEVELS 3
+#define BRICK_MASK_WORDS 16
+#define BRICK_HEADER_SIZE 20
+
+// Cone prepass: drawn at 1/PREPASS_TILE of the resolution, each fragment traces the cone holding
+// the rays of a tile of pixels and writes how far from the camera they can start.
+#define PREPASS_TILE 8
+uniform bool u_prepass;
+uniform ivec2 u_resolution;     // Of the main pass
+uniform bool u_conePrepass;     // Main pass: start rays at the distances of u_coneTex
+uniform sampler2D u_coneTex;
+
+// Temporal reprojection: the main pass stores the voxel_traversal result of each pixel in u_hitImage.
+// On the next frame, the reprojection pass moves these hits to the pixels they fall in with the new
+// camera, keeping the closest in u_reprojImage, and rays start just before the hits around them.
+#define REPROJECTION_MARGIN 1.0f
+uniform bool u_reprojectPass;
+uniform bool u_reprojection;    // Main pass: start rays at the hits of u_reprojImage, write u_hitImage
+uniform mat4 u_prevInvViewMat;  // Camera of the hits of u_hitImage
+uniform mat4 u_prevInvProjMat;
+layout(r32f) uniform image2D u_hitImage;
+layout(r32ui) uniform uimage2D u_reprojImage;   // floatBitsToUint of distances to the camera, 0xFFFFFFFF for none
+
+#define mapSize (1 << u_octreeDepth)
 
 float projectToCube(vec3 ro, vec3 rd) {
 	
@@ -76,26 +135,133 @@ float projectToCube(vec3 ro, vec3 rd) {
 	return t;
 }
 
-const int nCells = 1 << (u_octreeDepth-1);
+// Leaf leaf of the leaves packed from entry entries, palette indices sharing entries
+uint packedLeaf(int entries, int leaf) {
+	int shift = u_paletteSize == 0 ? 0 : (u_paletteSize <= COMPACT_BYTE_PALETTE_SIZE ? 2 : 1);
+	uint entry = texelFetch(u_octreeTex, entries + (leaf >> shift)).r;
+	if(shift == 0) return entry;
+	int slotBits = 32 >> shift;
+	return bitfieldExtract(entry, (leaf & ((1 << shift) - 1)) * slotBits, slotBits) | uint(value_flag);
+}
+
+// Entry child of node in the block format, whatever the format of the pool, interior children
+// being returned as address_flag with their node in next
+uint childEntry(int node, int child, out int next) {
+	if(!u_compactNodes) {
+		uint cell = texelFetch(u_octreeTex, node * 8 + child).r;
+		uint tag = cell & ~uint(address_mask);
+		if(tag == uint(address_flag)) {
+			next = node + int(cell & uint(address_mask)) - address_bias;
+			return uint(address_flag);
+		} else if(tag == uint(far_flag)) {
+			next = int(texelFetch(u_farTex, int(cell & uint(far_mask))).r);
+			return uint(address_flag);
+		}
+		return cell;
+	}
+
+	uint masks = texelFetch(u_octreeTex, node).r;
+	int children = int(texelFetch(u_octreeTex, node + 1).r);
+	uint bit = 1u << child;
+	uint leaves = (masks >> 8) & 0xFFu;
+	uint interior = masks & ~leaves & 0xFFu;
+	if((leaves & bit) != 0u) {
+		return packedLeaf(children + COMPACT_DESCRIPTOR_SIZE * bitCount(interior), bitCount(leaves & (bit - 1u)));
+	} else if((interior & bit) != 0u) {
+		next = children + COMPACT_DESCRIPTOR_SIZE * bitCount(interior & (bit - 1u));
+		return uint(address_flag);
+	}
+	return 0u;
+}
+
+// Number of leaves in the children of node before child, 0 without attributes
+uint childRank(int node, int child) {
+	return u_attributes ? texelFetch(u_rankTex, node * 8 + child).r : 0u;
+}
+
+// Colour of a leaf entry as rgb, rank being the sum of the ranks on its path
+uint leafColor(uint cell, uint rank) {
+	if(u_attributes) cell = texelFetch(u_attributeTex, int(rank)).r;
+	uint value = cell & uint(value_mask);
+	return u_paletteSize != 0 ? texelFetch(u_paletteTex, int(value)).r : value;
+}
+
+// Pre-filtered entry of an interior node, whose first leaf has the given rank
+uint lodEntry(int node, uint rank) {
+	if(u_attributes) return 0xFF000000u | leafColor(0u, rank);
+	return u_compactNodes ? texelFetch(u_octreeTex, node + 2).r : texelFetch(u_lodTex, node).r;
+}
+
+// Level of the nodes stored as bricks, -1 if there are none
+int brickLevel() {
+	return u_bricks && u_octreeDepth >= BRICK_LEVELS ? u_octreeDepth - BRICK_LEVELS : -1;
+}
+
+// Index of voxel p in its brick, from its last BRICK_LEVELS child indices
+int brickVoxel(ivec3 p) {
+	int m = 0;
+	for(int c = BRICK_LEVELS - 1; c >= 0; c--) {
+		m = (m << 3) | ((p.x >> c) & 1) | (((p.y >> c) & 1) << 1) | (((p.z >> c) & 1) << 2);
+	}
+	return m;
+}
+
+// Entry of voxel p in the brick stored from block brick, in the block format. d is set to the
+// level at which a lookup in the nodes the brick replaces would stop.
+uint brickEntry(int brick, ivec3 p, inout int d) {
+	int m = brickVoxel(p);
+	int w = m >> 5, bit = m & 31;
+	uint mask = texelFetch(u_octreeTex, brick * 8 + w).r;
+	d = u_octreeDepth - 1;
+	if(((mask >> bit) & 1u) == 0u) {
+		if(bitfieldExtract(mask, bit & 24, 8) == 0u) {
+			d--;
+			if((mask | texelFetch(u_octreeTex, brick * 8 + (w ^ 1)).r) == 0u) d--;
+		}
+		return 0u;
+	}
+	// Solid voxels before the octant, then before the voxel within it
+	int leaf = int(bitfieldExtract(texelFetch(u_octreeTex, brick * 8 + BRICK_MASK_WORDS + (w >> 2)).r, (w & 2) * 8, 16));
+	if((w & 1) != 0) leaf += bitCount(texelFetch(u_octreeTex, brick * 8 + w - 1).r);
+	leaf += bitCount(mask & ((1u << bit) - 1u));
+	return packedLeaf(brick * 8 + BRICK_HEADER_SIZE, leaf);
+}
+
+// True if the cell levels below the brick stored from block brick that holds voxel p has a solid voxel
+bool brickCellOccupied(int brick, ivec3 p, int levels) {
+	int m = brickVoxel(p);
+	int w = m >> 5, bit = m & 31;
+	uint mask = texelFetch(u_octreeTex, brick * 8 + w).r;
+	if(levels >= 3) return ((mask >> bit) & 1u) != 0u;
+	if(levels == 2) return bitfieldExtract(mask, bit & 24, 8) != 0u;
+	return (mask | texelFetch(u_octreeTex, brick * 8 + (w ^ 1)).r) != 0u;
+}
 
 Voxel sampleOctree(int x, int y, int z, inout int d) {
+	d = 0;
 	if(x < 0 || y < 0 || z < 0 || x >= 1 << u_octreeDepth || y >= 1 << u_octreeDepth || z >= 1 << u_octreeDepth) return Voxel(vec3(0.0, 0.0, 0.0), vec3(0));
 	
-	ivec3 currentCell = ivec3(0, 0, 0);
+	int node = 0;
+	uint rank = 0u;
 	for(d=0; d<u_octreeDepth; d++) {
+		if(d == brickLevel()) {
+			uint cell = brickEntry(node, ivec3(x, y, z), d);
+			uint rgb = cell != 0u ? leafColor(cell, 0u) : 0u;
+			return Voxel(vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, vec3(0));
+		}
+
 		uint c = u_octreeDepth - d - 1;
-		ivec3 localPos = ivec3((x & (1 << c)) >> c, (y & (1 << c)) >> c, (z & (1 << c)) >> c);
-		ivec3 cellPos = currentCell * 2 + localPos;
+		int child = ((x >> c) & 1) | (((y >> c) & 1) << 1) | (((z >> c) & 1) << 2);
 
-		uint cell = texture(u_octreeTex, vec3(cellPos) / float(1 << u_octreeDepth)).r;
+		int next;
+		uint cell = childEntry(node, child, next);
+		rank += childRank(node, child);
 
 		if((cell & (~value_mask)) == value_flag) {
-			return Voxel(vec3((cell & 0xFF0000) >> 16, (cell & 0xFF00) >> 8, cell & 0xFF) / 255.0f, vec3(0));
-		} else if((cell & (~address_mask)) == address_flag) {
-			int newIndex = int(cell) & address_mask;
-			currentCell.x = newIndex % nCells;
-			currentCell.y = (newIndex / nCells) % nCells;
-			currentCell.z = newIndex / (nCells * nCells);
+			uint rgb = leafColor(cell, rank);
+			return Voxel(vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, vec3(0));
+		} else if(cell == uint(address_flag)) {
+			node = next;
 		} else {
 			return Voxel(vec3(0.0, 0.0, 0.0), vec3(0));
 		}
@@ -103,6 +269,65 @@ Voxel sampleOctree(int x, int y, int z, inout int d) {
 	return Voxel(vec3(0.0, 0.0, 0.0), vec3(0));
 }
 
+// Nodes visited by the previous lookup of the ray, from the root down (OctreePath in node_pool.hpp)
+#define MAX_OCTREE_DEPTH 21
+int pathNodes[MAX_OCTREE_DEPTH];
+uint pathRanks[MAX_OCTREE_DEPTH];
+int pathLevels = 0;
+ivec3 pathVoxel;
+
+// Like sampleOctree, but starts from the deepest node of the path whose cell also contains (x, y, z),
+// and stops on interior nodes no wider than lodSize voxels, returning their pre-filtered colour.
+// coverage is set to the solid fraction of the cell returned, the occupancy of pre-filtered nodes.
+Voxel sampleOctreeFrom(int x, int y, int z, float lodSize, inout int d, inout float coverage) {
+	d = 0;
+	coverage = 1.0f;
+	if(x < 0 || y < 0 || z < 0 || x >= 1 << u_octreeDepth || y >= 1 << u_octreeDepth || z >= 1 << u_octreeDepth) return Voxel(vec3(0.0, 0.0, 0.0), vec3(0));
+
+	// Cells at level l are 2^(depth - l) wide, so both voxels share the first depth - bits levels
+	int start = 0;
+	if(pathLevels > 0) {
+		int bits = findMSB((x ^ pathVoxel.x) | (y ^ pathVoxel.y) | (z ^ pathVoxel.z)) + 1;
+		start = min(u_octreeDepth - bits, pathLevels - 1);
+	}
+	pathVoxel = ivec3(x, y, z);
+
+	int node = start > 0 ? pathNodes[start] : 0;
+	uint rank = start > 0 ? pathRanks[start] : 0u;
+	for(d=start; d<u_octreeDepth; d++) {
+		pathNodes[d] = node;
+		pathRanks[d] = rank;
+		pathLevels = d + 1;
+
+		if(d == brickLevel()) {
+			uint cell = brickEntry(node, ivec3(x, y, z), d);
+			uint rgb = cell != 0u ? leafColor(cell, 0u) : 0u;
+			return Voxel(vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, vec3(0));
+		}
+
+		uint c = u_octreeDepth - d - 1;
+		int child = ((x >> c) & 1) | (((y >> c) & 1) << 1) | (((z >> c) & 1) << 2);
+
+		int next;
+		uint cell = childEntry(node, child, next);
+		rank += childRank(node, child);
+
+		if((cell & (~value_mask)) == value_flag) {
+			uint rgb = leafColor(cell, rank);
+			return Voxel(vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f, vec3(0));
+		} else if(cell == uint(address_flag)) {
+			node = next;
+			if(float(1 << c) <= lodSize) {
+				uint entry = lodEntry(node, rank);
+				coverage = float(entry >> 24) / 255.0f;
+				return Voxel(vec3((entry & 0xFF0000) >> 16, (entry & 0xFF00) >> 8, entry & 0xFF) / 255.0f, vec3(0));
+			}
+		} else {
+			return Voxel(vec3(0.0, 0.0, 0.0), vec3(0));
+		}
+	}
+	return Voxel(vec3(0.0, 0.0, 0.0), vec3(0));
+}
 
 vec3 getDepthColor(int depth) {
 	int r = (912873911 + depth * 1239879) % 255;
@@ -112,11 +337,12 @@ vec3 getDepthColor(int depth) {
 	return normalize(vec3(r, g, b) / 255.0f);
 }
 
-float voxel_traversal(vec3 orig, vec3 direction, inout vec3 normal, inout Voxel vox, inout int mapX, inout int mapY, inout int mapZ, inout float through) {
+float voxel_traversal(vec3 orig, vec3 direction, float tMin, inout vec3 normal, inout Voxel vox, inout int mapX, inout int mapY, inout int mapZ, inout float through) {
 	through = 1;
+	pathLevels = 0;
 	vec3 origin = orig;
 	
-	float t1 = max(projectToCube(origin, direction) - 0.001f, 0);
+	float t1 = max(max(projectToCube(origin, direction), tMin) - 0.001f, 0);
 	origin += t1 * direction;
 
 	mapX = int(floor(origin.x));
@@ -162,28 +388,38 @@ float voxel_traversal(vec3 orig, vec3 direction, inout vec3 normal, inout Voxel
 	}
 
 	int step = 1;
+	bool skipped = false;
 
-	for (int i = 0; i < 1000; i++) {
+	// Every iteration moves forward on at least one axis, so this bound is never reached inside the volume
+	for (int i = 0; i < 3 * mapSize + 3; i++) {
 		if ((mapX >= mapSize && stepX > 0) || (mapY >= mapSize && stepY > 0) || (mapZ >= mapSize && stepZ > 0)) break;
 		if ((mapX < 0 && stepX < 0) || (mapY < 0 && stepY < 0) || (mapZ < 0 && stepZ < 0)) break;
 
-		if (sideDistX < sideDistY && sideDistX < sideDistZ) {
-			sideDistX += deltaDX;
-			mapX += stepX * step;
-			side = 0;
-		} else if(sideDistY < sideDistX && sideDistY < sideDistZ){
-			sideDistY += deltaDY;
-			mapY += stepY * step;
-			side = 1;
-		} else {
-			sideDistZ += deltaDZ;
-			mapZ += stepZ * step;
-			side = 2;
+		// After a skip the ray already stands in the next voxel
+		if (!skipped) {
+			if (sideDistX < sideDistY && sideDistX < sideDistZ) {
+				sideDistX += deltaDX;
+				mapX += stepX * step;
+				side = 0;
+			} else if(sideDistY < sideDistX && sideDistY < sideDistZ){
+				sideDistY += deltaDY;
+				mapY += stepY * step;
+				side = 1;
+			} else {
+				sideDistZ += deltaDZ;
+				mapZ += stepZ * step;
+				side = 2;
+			}
 		}
+		skipped = false;
+
+		if (!u_resumeLookups) pathLevels = 0;
+
+		// Width of a pixel at the distance of the voxel
+		float lodSize = u_lodFootprint > 0 ? u_lodFootprint * length(vec3(mapX, mapY, mapZ) + 0.5f - orig) : 0.0f;
 
 		int depth;
-		Voxel block = sampleOctree(mapX, mapY, mapZ, depth);
-		through *= pow(0.995f, float(depth));
+		Voxel block = sampleOctreeFrom(mapX, mapY, mapZ, lodSize, depth, through);
 		if (length(block.color) > 0) {
 			if (side == 0) {
 				perpWallDist = (mapX - origin.x + (1 - stepX * step) / 2) / direction.x + t1;
@@ -200,11 +436,193 @@ float voxel_traversal(vec3 orig, vec3 direction, inout vec3 normal, inout Voxel
 			vox = block;
 			break;
 		}
+
+		// The lookup stopped on an empty child at level depth + 1: jump over the whole cell
+		int cellSize = 1 << (u_octreeDepth - depth - 1);
+		if (u_skipEmpty && cellSize > 1 && mapX >= 0 && mapY >= 0 && mapZ >= 0 && mapX < mapSize && mapY < mapSize && mapZ < mapSize) {
+			ivec3 cellMin = ivec3(mapX, mapY, mapZ) & ~(cellSize - 1);
+
+			float exitX = ((stepX > 0 ? cellMin.x + cellSize : cellMin.x) - origin.x) / direction.x;
+			float exitY = ((stepY > 0 ? cellMin.y + cellSize : cellMin.y) - origin.y) / direction.y;
+			float exitZ = ((stepZ > 0 ? cellMin.z + cellSize : cellMin.z) - origin.z) / direction.z;
+
+			float exitT;
+			if (exitX < exitY && exitX < exitZ) {
+				exitT = exitX;
+				side = 0;
+			} else if (exitY < exitX && exitY < exitZ) {
+				exitT = exitY;
+				side = 1;
+			} else {
+				exitT = exitZ;
+				side = 2;
+			}
+
+			// Voxel where the ray leaves the cell, kept inside it on the axes it does not cross
+			vec3 exitPos = origin + exitT * direction;
+			ivec3 cellMax = cellMin + (cellSize - 1);
+			mapX = side == 0 ? (stepX > 0 ? cellMin.x + cellSize : cellMin.x - 1) : clamp(int(floor(exitPos.x)), cellMin.x, cellMax.x);
+			mapY = side == 1 ? (stepY > 0 ? cellMin.y + cellSize : cellMin.y - 1) : clamp(int(floor(exitPos.y)), cellMin.y, cellMax.y);
+			mapZ = side == 2 ? (stepZ > 0 ? cellMin.z + cellSize : cellMin.z - 1) : clamp(int(floor(exitPos.z)), cellMin.z, cellMax.z);
+
+			sideDistX = (mapX + (stepX > 0 ? 1.0 : 0.0) - origin.x) / direction.x;
+			sideDistY = (mapY + (stepY > 0 ? 1.0 : 0.0) - origin.y) / direction.y;
+			sideDistZ = (mapZ + (stepZ > 0 ? 1.0 : 0.0) - origin.z) / direction.z;
+			skipped = true;
+		}
 	}
 	return perpWallDist;
 }
 
+// True if the cell of the given level containing voxel p may hold a solid voxel
+bool cellOccupied(ivec3 p, int level, float lodSize) {
+	int node = 0;
+	for(int d=0; d<level; d++) {
+		if(d == brickLevel()) return brickCellOccupied(node, p, level - d);
+
+		uint c = u_octreeDepth - d - 1;
+		int child = ((p.x >> c) & 1) | (((p.y >> c) & 1) << 1) | (((p.z >> c) & 1) << 2);
+
+		int next;
+		uint cell = childEntry(node, child, next);
+
+		if((cell & (~value_mask)) == value_flag) {
+			return true;
+		} else if(cell == uint(address_flag)) {
+			node = next;
+			// Rays would stop on this node and take it as a whole
+			if(float(1 << c) <= lodSize) return true;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// True if no solid voxel overlaps the box [lo, hi], nodes no wider than lodSize counting as solid
+bool regionEmpty(vec3 lo, vec3 hi, float lodSize) {
+	ivec3 voxelMin = max(ivec3(floor(lo)), ivec3(0));
+	ivec3 voxelMax = min(ivec3(floor(hi)), ivec3(mapSize - 1));
+	if(any(greaterThan(voxelMin, voxelMax))) return true;
+
+	// Cells at least as wide as the box, so that it overlaps at most 2 of them along each axis
+	ivec3 extent = voxelMax - voxelMin;
+	int bits = findMSB(max(extent.x, max(extent.y, extent.z))) + 1;
+
+	ivec3 cellMin = voxelMin >> bits;
+	ivec3 cellMax = voxelMax >> bits;
+	for(int z=cellMin.z; z<=cellMax.z; z++) {
+		for(int y=cellMin.y; y<=cellMax.y; y++) {
+			for(int x=cellMin.x; x<=cellMax.x; x++) {
+				if(cellOccupied(ivec3(x, y, z) << bits, u_octreeDepth - bits, lodSize)) return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Distance from orig along axis before which no ray of the cone can hit a voxel, the directions
+// of its rays being at most spread away from axis (all unit vectors)
+float coneTrace(vec3 orig, vec3 axis, float spread) {
+	// Nothing can be hit beyond the farthest corner of the volume
+	float farthest = length(max(abs(orig), abs(orig - float(mapSize))));
+
+	// Every ray of the cone is within s * spread of the axis at a distance s, so the segment
+	// [s, s + stepSize] of all of them lies in the box around the axis grown by that radius.
+	// The step doubles while boxes are empty and halves down to the cone width when they are not.
+	float s = 0;
+	float stepSize = 1;
+	for(int i=0; i<64 && s<farthest; i++) {
+		float next = s + stepSize;
+		float radius = next * spread + 0.01f;
+		vec3 a = orig + s * axis;
+		vec3 b = orig + next * axis;
+		vec3 lo = min(a, b) - radius;
+		vec3 hi = max(a, b) + radius;
+
+		// Largest lodSize of the voxels in the box, so that rays never stop on coarser nodes
+		float lodSize = u_lodFootprint > 0 ? u_lodFootprint * (length(max(abs(lo - orig), abs(hi - orig))) + 1.0f) : 0.0f;
+
+		if(regionEmpty(lo, hi, lodSize)) {
+			s = next;
+			stepSize *= 2;
+		} else if(stepSize <= max(1.0f, s * spread)) {
+			break;
+		} else {
+			stepSize *= 0.5f;
+		}
+	}
+	return min(s, farthest);
+}
+
+// Ray of the main pass through the centre of pixel
+vec3 pixelRay(vec2 pixel) {
+	vec4 clip = vec4(pixel / vec2(u_resolution) * 2.0f - 1.0f, -1.0, 1.0);
+	vec4 eye = vec4(vec2(u_invProjMat * clip), -1.0, 0.0);
+	return vec3(u_invViewMat * eye);
+}
+
+// Prepass fragment: cone of the rays of the pixels of tile
+float tileConeDistance(ivec2 tile) {
+	// Pixel centres at the corners of the tile. Sets of rays within a given angle of the axis
+	// cross the image plane in ellipses, so the rays farthest from the axis go through corners.
+	vec2 first = vec2(tile * PREPASS_TILE) + 0.5f;
+	vec2 last = first + float(PREPASS_TILE - 1);
+	vec3 axis = normalize(pixelRay((first + last) * 0.5f));
+
+	float spread = 0;
+	for(int corner=0; corner<4; corner++) {
+		vec2 pixel = vec2((corner & 1) != 0 ? last.x : first.x, (corner & 2) != 0 ? last.y : first.y);
+		spread = max(spread, length(normalize(pixelRay(pixel)) - axis));
+	}
+	return coneTrace(u_invViewMat[3].xyz, axis, spread);
+}
+
+// Reprojection pass fragment: hit of pixel in the previous frame, seen from the current camera
+void reprojectHit(ivec2 pixel) {
+	float t = imageLoad(u_hitImage, pixel).r;
+	if(t <= 0) return;
+	vec2 size = vec2(u_resolution);
+	vec4 clip = vec4((vec2(pixel) + 0.5f) / size * 2.0f - 1.0f, -1.0, 1.0);
+	vec4 eye = vec4(vec2(u_prevInvProjMat * clip), -1.0, 0.0);
+	vec3 hit = u_prevInvViewMat[3].xyz + t * vec3(u_prevInvViewMat * eye);
+
+	vec4 projected = u_projMat * u_viewMat * vec4(hit, 1.0);
+	if(projected.w <= 0) return;
+	vec2 target = (projected.xy / projected.w * 0.5f + 0.5f) * size;
+	if(any(lessThan(target, vec2(0))) || any(greaterThanEqual(target, size))) return;
+	// Positive floats compare like their bits as unsigned integers
+	imageAtomicMin(u_reprojImage, ivec2(target), floatBitsToUint(length(hit - u_invViewMat[3].xyz)));
+}
+
+// Distance from the camera before which the ray of pixel is expected to hit nothing, 0 to trace it whole
+float reprojectedDistance(ivec2 pixel) {
+	// The surface seen by the ray lies between the hits of the neighbouring pixels. If one of them has
+	// none, it was hidden or out of view in the previous frame, or the ray may pass an edge.
+	if(any(equal(pixel, ivec2(0))) || any(equal(pixel, u_resolution - 1))) return 0;
+	uint closest = 0xFFFFFFFFu;
+	for(int y=-1; y<=1; y++) {
+		for(int x=-1; x<=1; x++) {
+			uint hit = imageLoad(u_reprojImage, pixel + ivec2(x, y)).r;
+			if(hit == 0xFFFFFFFFu) return 0;
+			closest = min(closest, hit);
+		}
+	}
+	float distance = uintBitsToFloat(closest);
+	// Nodes rays stop on for the level of detail are up to u_lodFootprint * distance wide
+	return max(distance - REPROJECTION_MARGIN - 2.0f * u_lodFootprint * distance, 0);
+}
+
 void main() {
+	if(u_reprojectPass) {
+		reprojectHit(ivec2(gl_FragCoord.xy));
+		return;
+	}
+	if(u_prepass) {
+		outColor = vec4(tileConeDistance(ivec2(gl_FragCoord.xy)), 0, 0, 1);
+		return;
+	}
+
 	vec2 uv = screenPos;// * 2.0f - 1.0f;
 
 	vec4 clip = vec4(uv, -1.0, 1.0);
@@ -220,7 +638,10 @@ void main() {
 	vec3 normal;
 
 	float through;
-	float t = voxel_traversal(rayOrigin, rayDir, normal, vox, mapX, mapY, mapZ, through);
+	float startDistance = u_conePrepass ? texelFetch(u_coneTex, ivec2(gl_FragCoord.xy) / PREPASS_TILE, 0).r : 0;
+	if(u_reprojection) startDistance = max(startDistance, reprojectedDistance(ivec2(gl_FragCoord.xy)));
+	float t = voxel_traversal(rayOrigin, rayDir, startDistance / length(rayDir), normal, vox, mapX, mapY, mapZ, through);
+	if(u_reprojection) imageStore(u_hitImage, ivec2(gl_FragCoord.xy), vec4(t));
 	if (t > 0) {
 		ray.hit = true;
 		ray.t = t;
@@ -241,12 +662,12 @@ void main() {
 		ray.surfaceColor = ambient + diffuse + specular;
 	}
 	if(ray.hit) {
-		outColor = vec4(ray.surfaceColor, 1.0f);
+		// A pre-filtered node covers only part of the pixel, the background shows through the rest
+		outColor = vec4(mix(rayDir, ray.surfaceColor, through), 1.0f);
 	} else {
 		outColor = vec4(rayDir, 1.0f);
 	}
 	outColor.r = min(outColor.r, 1.0f);
 	outColor.g = min(outColor.g, 1.0f);
 	outColor.b = min(outColor.b, 1.0f);
-	outColor.rgb *= 1 - pow(1-through, 1.9f);
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+/*
+    tests/test_attributes.cpp
+    author: Telo PHILIPPE
+
+    Attribute streams: the ranks summed on the way down to each leaf give its index in the
+    stream, every leaf in depth-first order, and the value found there is the one of the same
+    leaf in the plain block pool, in the compact pool and in the bricks of the same tree, also
+    after edits, and when subtrees are shared in a DAG.
+*/
+
+#include "test_common.hpp"
+#include "octree.hpp"
+
+// Entry of the leaf holding voxel (x, y, z) and the sum of the ranks on its path, false when empty
+static bool findLeaf(const NodePool& pool, int x, int y, int z, GLuint& cell, GLuint& rank) {
+    GLuint node = 0;
+    uint64_t fetches = 0;
+    rank = 0;
+    for (int d = 0; d < pool.depth; d++) {
+        int c = pool.depth - d - 1;
+        int child = ((x >> c) & 1) | (((y >> c) & 1) << 1) | (((z >> c) & 1) << 2);
+        GLuint next;
+        cell = childEntry(pool, node, child, next, fetches);
+        rank += childRank(pool, node, child, fetches);
+        if ((cell & ~value_mask) == (GLuint)value_flag) {
+            return true;
+        } else if (cell != (GLuint)address_flag) {
+            return false;
+        }
+        node = next;
+    }
+    return false;
+}
+
+static glm::vec3 color(GLuint rgb) {
+    return glm::vec3((rgb & 0xFF0000) >> 16, (rgb & 0xFF00) >> 8, rgb & 0xFF) / 255.0f;
+}
+
+// Builds the same tree in every layout, so that edits can be replayed on each
+struct Layouts {
+    Octree stream, blocks, compact, bricks;
+
+    Layouts(const std::string& scene, int depth, bool collapsed, bool palette, bool dag)
+        : stream(depth), blocks(depth), compact(depth), bricks(depth) {
+        std::vector<MortonVoxel> voxels = testSceneVoxels(scene, depth);
+        Octree* trees[] = { &stream, &blocks, &compact, &bricks };
+        for (Octree* tree : trees) {
+            tree->build(voxels);
+            if (collapsed) tree->collapse();
+            if (palette) tree->buildPalette(4);
+            if (dag) tree->reduceToDAG();
+        }
+        stream.setAttributeStream(true);
+        compact.setNodeFormat(NodeFormat::Compact);
+        bricks.setBricks(true);
+        for (Octree* tree : trees) {
+            tree->writeData();
+        }
+    }
+
+    void set(int x, int y, int z, int value) {
+        stream.set(x, y, z, value);
+        blocks.set(x, y, z, value);
+        compact.set(x, y, z, value);
+        bricks.set(x, y, z, value);
+    }
+
+    void erase(int x, int y, int z) {
+        stream.erase(x, y, z);
+        blocks.erase(x, y, z);
+        compact.erase(x, y, z);
+        bricks.erase(x, y, z);
+    }
+};
+
+// Number of voxels whose lookup in the attribute stream disagrees with the other layouts
+static int countMismatches(const Layouts& layouts, int depth) {
+    const NodePool stream = layouts.stream.nodePool();
+    const NodePool blocks = layouts.blocks.nodePool();
+    const NodePool compact = layouts.compact.nodePool();
+    const NodePool bricks = layouts.bricks.nodePool();
+    CHECK(stream.ranks != nullptr && stream.attributes != nullptr);
+    CHECK(compact.format == NodeFormat::Compact);
+    CHECK(bricks.bricks);
+
+    // Voxels in Morton order visit the leaves in depth-first order: their indices in the stream
+    // follow each other, and reach every attribute
+    int mismatches = 0;
+    GLuint expectedRank = 0;
+    bool previousLeaf = false;
+    GLuint previousRank = 0;
+    const uint64_t voxelCount = 1ull << (3 * depth);
+    for (uint64_t code = 0; code < voxelCount; code++) {
+        uint32_t x, y, z;
+        mortonDecode(code, x, y, z);
+        GLuint streamCell, rank, blockCell, blockRank;
+        bool leaf = findLeaf(stream, x, y, z, streamCell, rank);
+        bool blockLeaf = findLeaf(blocks, x, y, z, blockCell, blockRank);
+        int d;
+        if (leaf != blockLeaf) {
+            mismatches++;
+            continue;
+        }
+        if (!leaf) {
+            if (sampleOctree(compact, x, y, z, d).color != glm::vec3(0.0f) || sampleOctree(bricks, x, y, z, d).color != glm::vec3(0.0f)) {
+                mismatches++;
+            }
+            continue;
+        }
+
+        // Voxels of a collapsed leaf share its index
+        if (!previousLeaf || rank != previousRank) {
+            if (rank != expectedRank) mismatches++;
+            expectedRank = rank + 1;
+        }
+        previousLeaf = true;
+        previousRank = rank;
+        if (rank >= stream.attributeCount) {
+            mismatches++;
+            continue;
+        }
+
+        GLuint value = stream.attributes[rank];
+        glm::vec3 rgb = color(leafColor(stream.palette, value));
+        if (value != (blockCell & value_mask) || rgb != sampleOctree(compact, x, y, z, d).color
+            || rgb != sampleOctree(bricks, x, y, z, d).color || rgb != color(layouts.blocks.get(x, y, z))) {
+            mismatches++;
+        }
+    }
+    CHECK_EQUAL(expectedRank, stream.attributeCount);
+    return mismatches;
+}
+
+static void checkStream(const std::string& scene, int depth, bool collapsed, bool palette, bool dag) {
+    Layouts layouts(scene, depth, collapsed, palette, dag);
+    int mismatches = countMismatches(layouts, depth);
+
+    const int size = 1 << depth;
+    TestRandom random = { 88172645u };
+    for (int i = 0; i < 300; i++) {
+        int x = random.below(size), y = random.below(size), z = random.below(size);
+        if (i % 3) {
+            layouts.set(x, y, z, testColor(random.below(256), 60, 140));
+        } else {
+            layouts.erase(x, y, z);
+        }
+    }
+    mismatches += countMismatches(layouts, depth);
+    // The *_far build keeps only the nearest blocks in reach of an address offset
+    if (near_range < address_bias) {
+        CHECK(layouts.stream.blockPool().farCount > 0);
+        CHECK(layouts.blocks.blockPool().farCount > 0);
+        CHECK(layouts.bricks.blockPool().farCount > 0);
+    }
+
+    if (mismatches) {
+        std::cerr << scene << (collapsed ? " collapsed" : "") << (palette ? " palette" : "") << (dag ? " dag" : "") << ": " << mismatches << " voxels differ" << std::endl;
+    }
+    CHECK_EQUAL(mismatches, 0);
+}
+
+int main() {
+    const int depth = 5;
+    for (const std::string& scene : testScenes()) {
+        for (int collapsed = 0; collapsed < 2; collapsed++) {
+            checkStream(scene, depth, collapsed != 0, false, false);
+            checkStream(scene, depth, collapsed != 0, true, false);
+            checkStream(scene, depth, collapsed != 0, false, true);
+        }
+    }
+    return testResult("test_attributes");
+}
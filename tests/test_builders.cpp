@@ -0,0 +1,164 @@
+/*
+    tests/test_builders.cpp
+    author: Telo PHILIPPE
+
+    The builders that never hold the whole volume: Octree::buildImplicit, from conservative
+    bounds of a cube of voxels, and Octree::buildChunked, one chunk of voxels at a time, give
+    the same voxels and the same collapsed tree as Octree::build on the dense volume. So does
+    Octree::insert, one voxel at a time in any order.
+*/
+
+#include "test_common.hpp"
+#include "voxel_array.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+// Number of voxels of the whole volume whose colour differs between a and b
+static uint64_t countMismatches(const Octree& a, const Octree& b, int depth) {
+    const int size = 1 << depth;
+    uint64_t mismatches = 0;
+    for (int z = 0; z < size; z++) {
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                if (a.get(x, y, z) != b.get(x, y, z)) mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+// The VoxelArray shell, built from its dense array and from shellBounds or in chunks
+static void checkVoxelArray(int depth, VoxelStorage storage, const char* name) {
+    VoxelArray dense(depth, false, VoxelStorage::Dense);
+    VoxelArray built(depth, false, storage);
+    uint64_t mismatches = countMismatches(*dense.octree, *built.octree, depth);
+    if (mismatches) std::cerr << name << " depth " << depth << ": " << mismatches << " voxels differ" << std::endl;
+    CHECK_EQUAL(mismatches, 0u);
+    CHECK_EQUAL(dense.octree->nodeCount(), built.octree->nodeCount());
+}
+
+// Conservative bounds of the terrain test scene: its height moves by less than 0.9 voxels
+// per voxel along x and 0.75 along z, plus one voxel for the single precision of testVoxel
+static CellBounds terrainBounds(int x, int y, int z, int cellSize, int size) {
+    const float half = (cellSize - 1) * 0.5f;
+    const float cx = x + half, cz = z + half;
+    const float height = (0.4f + 0.15f * std::sin(cx * 6.0f / size) * std::cos(cz * 5.0f / size)) * size;
+    const float slack = 0.9f * half + 0.75f * half + 1.0f;
+    if (y > height + slack) {
+        return CellBounds { CellBounds::Empty, 0 };
+    }
+    if (y + cellSize - 1 + 2 <= height - slack) {
+        return CellBounds { CellBounds::Uniform, testColor(120, 100, 80) };
+    }
+    return CellBounds { CellBounds::Mixed, 0 };
+}
+
+// The terrain from its bounds, whose Uniform cells become leaves without any sample, against
+// build and collapse on the same voxels
+static void checkTerrain(int depth) {
+    const int size = 1 << depth;
+    std::atomic<int> uniformCells(0), uniformUpperCells(0);
+    Octree implicit(depth);
+    implicit.buildImplicit([&](int x, int y, int z, int cellSize) {
+        CellBounds cell = terrainBounds(x, y, z, cellSize, size);
+        if (cell.kind == CellBounds::Uniform) {
+            uniformCells++;
+            if (cellSize > 1 << implicit_task_depth) uniformUpperCells++;
+        }
+        return cell;
+    }, [&](int x, int y, int z) {
+        int value = testVoxel("terrain", x, y, z, size);
+        return value ? 0xFF000000u | static_cast<GLuint>(value) : 0u;
+    });
+    // Both in the cells left to the tasks and in the levels above them
+    CHECK(uniformCells > 0);
+    CHECK(uniformUpperCells > 0);
+
+    Octree built(depth);
+    built.build(testSceneVoxels("terrain", depth));
+    built.collapse();
+    CHECK_EQUAL(built.nodeCount(), implicit.nodeCount());
+    // Too many voxels to look up each of them: the same tree flattens to the same pool
+    built.writeData();
+    implicit.writeData();
+    NodePool a = built.blockPool(), b = implicit.blockPool();
+    CHECK_EQUAL(a.size, b.size);
+    CHECK(a.size == b.size && std::equal(a.data, a.data + a.size, b.data));
+}
+
+// The terrain in chunks of 2^chunkDepth voxels per side, against build and collapse
+static void checkChunks(int depth, int chunkDepth) {
+    const int size = 1 << depth;
+    Octree chunked(depth);
+    chunked.buildChunked(chunkDepth, [&](int x0, int y0, int z0, std::vector<MortonVoxel>& voxels) {
+        const int chunkSize = std::min(size, 1 << chunkDepth);
+        for (int z = 0; z < chunkSize; z++) {
+            for (int y = 0; y < chunkSize; y++) {
+                for (int x = 0; x < chunkSize; x++) {
+                    int value = testVoxel("terrain", x0 + x, y0 + y, z0 + z, size);
+                    if (value) voxels.push_back({ mortonEncode(x, y, z), value });
+                }
+            }
+        }
+    });
+
+    Octree built(depth);
+    built.build(testSceneVoxels("terrain", depth));
+    built.collapse();
+    uint64_t mismatches = countMismatches(built, chunked, depth);
+    if (mismatches) std::cerr << "terrain chunks of depth " << chunkDepth << ": " << mismatches << " voxels differ" << std::endl;
+    CHECK_EQUAL(mismatches, 0u);
+    CHECK_EQUAL(built.nodeCount(), chunked.nodeCount());
+}
+
+// The voxels of scene inserted one by one in a shuffled order, against build on the same voxels
+static void checkInsert(const std::string& scene, int depth) {
+    std::vector<MortonVoxel> voxels = testSceneVoxels(scene, depth);
+    Octree built(depth);
+    built.build(voxels);
+
+    TestRandom random = { 2166136261u };
+    for (size_t i = voxels.size(); i > 1; i--) {
+        std::swap(voxels[i - 1], voxels[random.below(static_cast<int>(i))]);
+    }
+    Octree inserted(depth);
+    for (const MortonVoxel& voxel : voxels) {
+        uint32_t x, y, z;
+        mortonDecode(voxel.code, x, y, z);
+        inserted.insert(x, y, z, voxel.value);
+    }
+
+    CHECK_EQUAL(built.nodeCount(), inserted.nodeCount());
+    uint64_t mismatches = countMismatches(built, inserted, depth);
+    if (mismatches) std::cerr << scene << " inserted: " << mismatches << " voxels differ" << std::endl;
+    CHECK_EQUAL(mismatches, 0u);
+
+    // Nodes allocated in another order, the same tree all the same
+    built.collapse();
+    inserted.collapse();
+    built.writeData();
+    inserted.writeData();
+    NodePool a = built.blockPool(), b = inserted.blockPool();
+    CHECK_EQUAL(a.size, b.size);
+    CHECK(a.size == b.size && std::equal(a.data, a.data + a.size, b.data));
+}
+
+int main() {
+    // Below, at and above implicit_task_depth
+    for (int depth = 4; depth <= 7; depth++) {
+        checkVoxelArray(depth, VoxelStorage::Implicit, "implicit");
+    }
+    // A single chunk smaller than voxel_chunk_depth, exactly one chunk, then 8 of them
+    for (int depth = 4; depth <= voxel_chunk_depth + 1; depth++) {
+        checkVoxelArray(depth, VoxelStorage::Streamed, "streamed");
+    }
+    checkTerrain(8);
+    for (int chunkDepth = 1; chunkDepth <= 6; chunkDepth += 2) {
+        checkChunks(6, chunkDepth);
+    }
+    for (const std::string& scene : testScenes()) {
+        checkInsert(scene, 6);
+    }
+    return testResult("test_builders");
+}
@@ -0,0 +1,113 @@
+/*
+    tests/test_common.hpp
+    author: Telo PHILIPPE
+
+    Checks and scenes shared by the tests. Every test is an executable registered with
+    ctest, which fails when any of its checks does.
+*/
+
+#ifndef TEST_COMMON_HPP
+#define TEST_COMMON_HPP
+
+#include "gl_includes.hpp"
+#include "morton.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static int g_failures = 0;
+
+// Reports a failed condition without stopping the test, so that one run shows every failure
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            g_failures++; \
+        } \
+    } while (0)
+
+// Like CHECK, reporting both values when they differ
+#define CHECK_EQUAL(a, b) \
+    do { \
+        if (!((a) == (b))) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #a " == " #b " (" << (a) << " vs " << (b) << ")" << std::endl; \
+            g_failures++; \
+        } \
+    } while (0)
+
+// Exit status of the test
+inline int testResult(const char* name) {
+    if (g_failures) {
+        std::cerr << name << ": " << g_failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << name << ": passed" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// Deterministic generator, so that failures can be reproduced
+struct TestRandom {
+    uint32_t state;
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    int below(int n) {
+        return static_cast<int>(next() % static_cast<uint32_t>(n));
+    }
+};
+
+inline int testColor(int r, int g, int b) {
+    return r << 16 | g << 8 | b;
+}
+
+// Voxel (x, y, z) of the test scenes in a cube of size voxels, 0 when empty. The shell has
+// smooth colours, noise isolated voxels of few colours, the terrain large uniform regions
+// that collapse into leaves above the voxels.
+inline int testVoxel(const std::string& scene, int x, int y, int z, int size) {
+    if (scene == "shell") {
+        glm::vec3 p = glm::vec3(x, y, z) / glm::vec3(size) * 2.0f - 1.0f;
+        float l = glm::length(p);
+        if (l >= 1.0f || l <= 0.8f) return 0;
+        return testColor(x * 255 / size, y * 255 / size, 128);
+    } else if (scene == "noise") {
+        uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+        h ^= h >> 13;
+        h *= 0x5bd1e995u;
+        h ^= h >> 15;
+        return h % 7 == 0 ? testColor(200, 40 * (h % 4), 60) : 0;
+    }
+    float height = (0.4f + 0.15f * std::sin(x * 6.0f / size) * std::cos(z * 5.0f / size)) * size;
+    if (y > height) return 0;
+    return y + 2 > height ? testColor(70, 180, 50) : testColor(120, 100, 80);
+}
+
+inline std::vector<std::string> testScenes() {
+    return std::vector<std::string> { "shell", "noise", "terrain" };
+}
+
+// Solid voxels of a test scene, sorted by Morton code
+inline std::vector<MortonVoxel> testSceneVoxels(const std::string& scene, int depth) {
+    const int size = 1 << depth;
+    std::vector<MortonVoxel> voxels;
+    for (int z = 0; z < size; z++) {
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                int value = testVoxel(scene, x, y, z, size);
+                if (value) voxels.push_back({ mortonEncode(x, y, z), value });
+            }
+        }
+    }
+    sortMortonVoxels(voxels, 3 * depth);
+    return voxels;
+}
+
+#endif  // TEST_COMMON_HPP
@@ -0,0 +1,81 @@
+/*
+    tests/test_dag.cpp
+    author: Telo PHILIPPE
+
+    Octree::reduceToDAG: reference counts match the parents of every node after merging and
+    after copy-on-write edits, no node leaks, and the DAG holds the same voxels as the tree.
+*/
+
+#include "test_common.hpp"
+#include "octree.hpp"
+
+static bool sameVoxels(const NodePool& a, const NodePool& b, TestRandom& random, int samples) {
+    const int size = 1 << a.depth;
+    for (int i = 0; i < samples; i++) {
+        int x = random.below(size), y = random.below(size), z = random.below(size), da, db;
+        if (sampleOctree(a, x, y, z, da).color != sampleOctree(b, x, y, z, db).color) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    const int depth = 6;
+    const int size = 1 << depth;
+    for (const std::string& scene : testScenes()) {
+        for (int collapsed = 0; collapsed < 2; collapsed++) {
+            std::vector<MortonVoxel> voxels = testSceneVoxels(scene, depth);
+            Octree tree(depth), dag(depth);
+            tree.build(voxels);
+            dag.build(voxels);
+            if (collapsed) {
+                tree.collapse();
+                dag.collapse();
+            }
+            CHECK(dag.checkRefCounts());
+
+            DAGStats stats = dag.reduceToDAG();
+            CHECK(dag.checkRefCounts());
+            CHECK_EQUAL(dag.nodeCount(), stats.nodesAfter);
+            CHECK(stats.nodesAfter < stats.nodesBefore);
+
+            // Edits copy the shared nodes on their path, and free the ones no longer used
+            tree.writeData();
+            dag.writeData();
+            TestRandom random = { 12345u };
+            for (int i = 0; i < 400; i++) {
+                int x = random.below(size), y = random.below(size), z = random.below(size);
+                if (i % 3) {
+                    int value = testColor(random.below(256), 0, 255);
+                    tree.set(x, y, z, value);
+                    dag.set(x, y, z, value);
+                } else {
+                    tree.erase(x, y, z);
+                    dag.erase(x, y, z);
+                }
+                if (i % 50 == 0) CHECK(dag.checkRefCounts());
+            }
+            CHECK(dag.checkRefCounts());
+            CHECK(sameVoxels(tree.blockPool(), dag.blockPool(), random, 20000));
+            // The *_far build keeps only the nearest blocks in reach of an address offset
+            if (near_range < address_bias) {
+                CHECK(tree.blockPool().farCount > 0);
+                CHECK(dag.blockPool().farCount > 0);
+            }
+
+            // Erasing a whole octant releases every node below it
+            GLuint before = dag.nodeCount();
+            for (int z = 0; z < size / 2; z++) {
+                for (int y = 0; y < size / 2; y++) {
+                    for (int x = 0; x < size / 2; x++) {
+                        dag.erase(x, y, z);
+                    }
+                }
+            }
+            CHECK(dag.checkRefCounts());
+            CHECK(dag.nodeCount() <= before);
+        }
+    }
+    return testResult("test_dag");
+}
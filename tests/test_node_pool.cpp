@@ -0,0 +1,90 @@
+/*
+    tests/test_node_pool.cpp
+    author: Telo PHILIPPE
+
+    sampleOctree on the flattened pools: every layout (blocks, compact descriptors, palette,
+    attribute stream, bricks) returns the colour Octree::get finds in the node tree, also
+    after edits.
+*/
+
+#include "test_common.hpp"
+#include "octree.hpp"
+
+static glm::vec3 expectedColor(int value) {
+    return glm::vec3((value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF) / 255.0f;
+}
+
+// Number of random voxels whose colour in pool differs from the node tree
+static int countMismatches(const Octree& tree, const NodePool& pool, TestRandom& random, int samples) {
+    const int size = 1 << pool.depth;
+    int mismatches = 0;
+    for (int i = 0; i < samples; i++) {
+        int x = random.below(size), y = random.below(size), z = random.below(size), d;
+        if (sampleOctree(pool, x, y, z, d).color != expectedColor(tree.get(x, y, z))) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+static void checkLayout(const std::string& scene, int depth, NodeFormat format, bool palette, bool attributes, bool bricks, bool collapsed) {
+    std::vector<MortonVoxel> voxels = testSceneVoxels(scene, depth);
+    Octree tree(depth);
+    tree.build(voxels);
+    if (collapsed) tree.collapse();
+    if (palette) tree.buildPalette(4);
+    tree.setNodeFormat(format);
+    tree.setAttributeStream(attributes);
+    tree.setBricks(bricks);
+    tree.writeData();
+    // The *_far build keeps only the nearest blocks in reach of an address offset
+    if (near_range < address_bias) CHECK(tree.blockPool().farCount > 0);
+
+    // The voxels themselves, then random ones, most of them empty
+    const int size = 1 << depth;
+    int mismatches = 0;
+    NodePool pool = tree.nodePool();
+    for (size_t i = 0; i < voxels.size(); i += 7) {
+        uint32_t x, y, z;
+        int d;
+        mortonDecode(voxels[i].code, x, y, z);
+        if (sampleOctree(pool, x, y, z, d).color != expectedColor(tree.get(x, y, z))) {
+            mismatches++;
+        }
+    }
+    TestRandom random = { 2463534242u };
+    mismatches += countMismatches(tree, tree.nodePool(), random, 20000);
+
+    for (int i = 0; i < 300; i++) {
+        int x = random.below(size), y = random.below(size), z = random.below(size);
+        if (i % 4) {
+            tree.set(x, y, z, testColor(random.below(256), 90, 200));
+        } else {
+            tree.erase(x, y, z);
+        }
+    }
+    mismatches += countMismatches(tree, tree.nodePool(), random, 20000);
+    if (near_range < address_bias) CHECK(tree.blockPool().farCount > 0);
+
+    if (mismatches) {
+        std::cerr << scene << (format == NodeFormat::Compact ? " compact" : " blocks") << (palette ? " palette" : "")
+                  << (attributes ? " attributes" : "") << (bricks ? " bricks" : "") << (collapsed ? " collapsed" : "") << std::endl;
+    }
+    CHECK_EQUAL(mismatches, 0);
+}
+
+int main() {
+    const int depth = 6;
+    for (const std::string& scene : testScenes()) {
+        for (int collapsed = 0; collapsed < 2; collapsed++) {
+            checkLayout(scene, depth, NodeFormat::Blocks, false, false, false, collapsed != 0);
+            checkLayout(scene, depth, NodeFormat::Compact, false, false, false, collapsed != 0);
+            checkLayout(scene, depth, NodeFormat::Blocks, true, false, false, collapsed != 0);
+            checkLayout(scene, depth, NodeFormat::Compact, true, false, false, collapsed != 0);
+            checkLayout(scene, depth, NodeFormat::Blocks, false, true, false, collapsed != 0);
+            checkLayout(scene, depth, NodeFormat::Blocks, false, false, true, collapsed != 0);
+            checkLayout(scene, depth, NodeFormat::Blocks, true, false, true, collapsed != 0);
+        }
+    }
+    return testResult("test_node_pool");
+}
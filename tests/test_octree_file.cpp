@@ -0,0 +1,87 @@
+/*
+    tests/test_octree_file.cpp
+    author: Telo PHILIPPE
+
+    .vxo files: saved pools map back identical, level of detail entries included, and
+    headers that do not describe the data that follows are rejected.
+*/
+
+#include "test_common.hpp"
+#include "octree.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+static bool sameArray(const GLuint* a, const GLuint* b, size_t count) {
+    return count == 0 || (a && b && std::memcmp(a, b, count * sizeof(GLuint)) == 0);
+}
+
+static void checkRoundTrip(const std::string& scene, bool palette, bool attributes, bool bricks, const std::string& filename) {
+    Octree tree(6);
+    tree.build(testSceneVoxels(scene, 6));
+    tree.collapse();
+    if (palette) tree.buildPalette(4);
+    tree.setAttributeStream(attributes);
+    tree.setBricks(bricks);
+    tree.writeData();
+    CHECK(tree.save(filename));
+
+    std::shared_ptr<Octree> loaded = Octree::load(filename);
+    CHECK(loaded != nullptr);
+    if (!loaded) return;
+    NodePool a = tree.blockPool(), b = loaded->blockPool();
+    CHECK_EQUAL(a.size, b.size);
+    CHECK_EQUAL(a.depth, b.depth);
+    CHECK_EQUAL(a.bricks, b.bricks);
+    CHECK(sameArray(a.data, b.data, a.size));
+    CHECK(sameArray(a.far, b.far, a.farCount));
+    // The *_far build keeps only the nearest blocks in reach of an address offset
+    if (near_range < address_bias) CHECK(a.farCount > 0);
+    CHECK(sameArray(a.palette, b.palette, a.paletteSize));
+    CHECK(sameArray(a.ranks, b.ranks, a.ranks ? a.size : 0));
+    CHECK(sameArray(a.attributes, b.attributes, a.attributeCount));
+    // The mapped entries are the ones the tree computed while flattening
+    CHECK_EQUAL(a.lod == nullptr, b.lod == nullptr);
+    CHECK(sameArray(a.lod, b.lod, a.lod ? a.size / 8 : 0));
+}
+
+// Writes the file saved as filename with its header changed by edit, and tries to map it
+template <typename Edit>
+static bool openEdited(const std::string& filename, const std::string& edited, Edit edit) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    edit(*reinterpret_cast<OctreeFileHeader*>(bytes.data()));
+    std::ofstream out(edited.c_str(), std::ios::binary);
+    out.write(bytes.data(), bytes.size());
+    out.close();
+    MappedOctreeFile file;
+    return file.open(edited, false);
+}
+
+int main() {
+    // Names of their own for the *_far build, which may run at the same time
+    const std::string name = near_range < address_bias ? "test_octree_file_far" : "test_octree_file";
+    const std::string filename = name + ".vxo", edited = name + "_edited.vxo";
+    for (const std::string& scene : testScenes()) {
+        checkRoundTrip(scene, false, false, false, filename);
+        checkRoundTrip(scene, true, false, false, filename);
+        checkRoundTrip(scene, false, true, false, filename);
+        checkRoundTrip(scene, false, false, true, filename);
+    }
+
+    checkRoundTrip("shell", false, false, false, filename);
+    CHECK(openEdited(filename, edited, [](OctreeFileHeader&) {}));
+    CHECK(!openEdited(filename, edited, [](OctreeFileHeader& h) { h.depth = max_octree_depth + 1; }));
+    CHECK(!openEdited(filename, edited, [](OctreeFileHeader& h) { h.entryCount -= 4; }));
+    CHECK(!openEdited(filename, edited, [](OctreeFileHeader& h) { h.lodCount--; }));
+    CHECK(!openEdited(filename, edited, [](OctreeFileHeader& h) { h.entryCount += 8; h.lodCount++; }));
+    // Sizes whose sum or product wraps around to a small value
+    CHECK(!openEdited(filename, edited, [](OctreeFileHeader& h) { h.farCount = 0x4000000000000000ull; }));
+    CHECK(!openEdited(filename, edited, [](OctreeFileHeader& h) { h.paletteSize = 0xFFFFFFFFFFFFFFFFull; }));
+    CHECK(!openEdited(filename, edited, [](OctreeFileHeader& h) { h.attributeCount = 0xC000000000000000ull; }));
+
+    std::remove(filename.c_str());
+    std::remove(edited.c_str());
+    return testResult("test_octree_file");
+}
@@ -0,0 +1,234 @@
+/*
+    tests/test_renderers.cpp
+    author: Telo PHILIPPE
+
+    The CPU renderers agree: the packet kernels return the hits of voxelTraversal for each of
+    their rays, and the tiled renderer draws the image of renderReference, on the scalar path
+    and with every packet kernel the processor supports. Hits reprojected from before an edit
+    are dropped. The traversal shortcuts leave the image unchanged.
+*/
+
+#include "test_common.hpp"
+#include "octree.hpp"
+#include "benchmark.hpp"
+#include "cpu_packet.hpp"
+#include "cpu_raycaster.hpp"
+#include "cpu_renderer.hpp"
+
+const int image_width = 96;
+const int image_height = 64;
+
+// Channels may differ by this much, from the different orders of the float operations
+const int color_tolerance = 2;
+
+static std::vector<SimdLevel> packetLevels() {
+    std::vector<SimdLevel> levels;
+    const SimdLevel candidates[] = { SimdLevel::SSE4, SimdLevel::AVX2, SimdLevel::AVX512 };
+    for (SimdLevel level : candidates) {
+        if (packetTracer(level).level == level) levels.push_back(level);
+    }
+    return levels;
+}
+
+static GLuint packColor(glm::vec3 color) {
+    glm::uvec3 c = glm::uvec3(glm::round(color * 255.0f));
+    return c.r << 16 | c.g << 8 | c.b;
+}
+
+// Traces every pixel of the view in packets and checks each lane against voxelTraversal
+static void checkKernel(const NodePool& pool, const TraceSettings& settings, const Camera& camera, const PacketTracer& tracer) {
+    const glm::mat4 invViewMat = glm::inverse(camera.computeViewMatrix());
+    const glm::mat4 invProjMat = glm::inverse(camera.computeProjectionMatrix());
+    const float footprint = lodFootprint(settings, camera, image_height);
+    TraversalStats stats;
+    RayPacket packet;
+    PacketHits hits;
+    int mismatches = 0;
+    for (int py = 0; py < image_height; py += tracer.height) {
+        for (int px = 0; px < image_width; px += tracer.width) {
+            packet.lanes = 0;
+            glm::vec3 dirs[max_packet_lanes];
+            for (int lane = 0; lane < tracer.width * tracer.height; lane++) {
+                glm::vec2 screenPos((px + lane % tracer.width + 0.5f) / image_width * 2.0f - 1.0f,
+                                    (py + lane / tracer.width + 0.5f) / image_height * 2.0f - 1.0f);
+                primaryRay(invViewMat, invProjMat, screenPos, packet.origin, dirs[lane]);
+                packet.dirX[lane] = dirs[lane].x;
+                packet.dirY[lane] = dirs[lane].y;
+                packet.dirZ[lane] = dirs[lane].z;
+                packet.tMin[lane] = 0.0f;
+                packet.lanes |= 1u << lane;
+            }
+            tracer.trace(pool, settings, footprint, packet, hits, stats);
+
+            for (int lane = 0; lane < tracer.width * tracer.height; lane++) {
+                glm::vec3 normal;
+                Voxel vox;
+                int mapX, mapY, mapZ;
+                float through;
+                float t = voxelTraversal(pool, settings, footprint, packet.origin, dirs[lane], 0.0f, normal, vox, mapX, mapY, mapZ, through);
+                bool same = (t < 0) == (hits.t[lane] < 0);
+                if (same && t >= 0) {
+                    same = std::abs(t - hits.t[lane]) <= 1e-4f * (1.0f + t) && packColor(vox.color) == hits.color[lane]
+                           && mapX == hits.mapX[lane] && mapY == hits.mapY[lane] && mapZ == hits.mapZ[lane];
+                }
+                if (!same) mismatches++;
+            }
+        }
+    }
+    if (mismatches) std::cerr << simdLevelName(tracer.level) << ": " << mismatches << " rays differ from voxelTraversal" << std::endl;
+    CHECK_EQUAL(mismatches, 0);
+}
+
+// Pixels of a and b whose channels differ by more than color_tolerance
+static int differentPixels(const Image& a, const Image& b) {
+    int different = 0;
+    for (size_t i = 0; i < a.pixels.size(); i += 4) {
+        for (size_t c = 0; c < 3; c++) {
+            if (std::abs(static_cast<int>(a.pixels[i + c]) - static_cast<int>(b.pixels[i + c])) > color_tolerance) {
+                different++;
+                break;
+            }
+        }
+    }
+    return different;
+}
+
+static void checkRenderers(const std::string& name, const NodePool& pool, int depth) {
+    TraceSettings settings;
+    settings.temporalReprojection = false;
+    CPURenderer renderer(2);
+    renderer.settings = settings;
+    const std::vector<SimdLevel> levels = packetLevels();
+
+    for (int frame = 0; frame < 3; frame++) {
+        Camera camera;
+        camera.setAspectRatio(static_cast<float>(image_width) / image_height);
+        orbitCamera(camera, depth, frame, 3);
+
+        Image reference, tiled;
+        reference.resize(image_width, image_height);
+        tiled.resize(image_width, image_height);
+        renderReference(pool, settings, camera, reference);
+
+        renderer.simd = SimdLevel::Scalar;
+        renderer.render(pool, camera, tiled);
+        int different = differentPixels(reference, tiled);
+        if (different) std::cerr << name << " frame " << frame << " scalar: " << different << " pixels differ" << std::endl;
+        CHECK_EQUAL(different, 0);
+
+        for (SimdLevel level : levels) {
+            checkKernel(pool, settings, camera, packetTracer(level));
+            renderer.simd = level;
+            renderer.render(pool, camera, tiled);
+            different = differentPixels(reference, tiled);
+            if (different) std::cerr << name << " frame " << frame << " " << simdLevelName(level) << ": " << different << " pixels differ" << std::endl;
+            CHECK_EQUAL(different, 0);
+        }
+    }
+}
+
+// renderReference with one traversal shortcut turned off draws the image of the default
+// settings, the level of detail being off so that every ray reaches the voxels
+static void checkShortcut(const std::string& name, const NodePool& pool, int depth, bool TraceSettings::*shortcut, const char* shortcutName) {
+    TraceSettings settings;
+    settings.levelOfDetail = false;
+    TraceSettings without = settings;
+    without.*shortcut = false;
+    const std::vector<SimdLevel> levels = packetLevels();
+
+    for (int frame = 0; frame < 3; frame++) {
+        Camera camera;
+        camera.setAspectRatio(static_cast<float>(image_width) / image_height);
+        orbitCamera(camera, depth, frame, 3);
+
+        Image reference, image;
+        reference.resize(image_width, image_height);
+        image.resize(image_width, image_height);
+        renderReference(pool, settings, camera, reference);
+        renderReference(pool, without, camera, image);
+        int different = differentPixels(reference, image);
+        if (different) std::cerr << name << " frame " << frame << " without " << shortcutName << ": " << different << " pixels differ" << std::endl;
+        CHECK_EQUAL(different, 0);
+
+        for (SimdLevel level : levels) {
+            checkKernel(pool, without, camera, packetTracer(level));
+        }
+    }
+}
+
+// Voxels added in front of the hits of the last frame are seen once the renderer drops them
+static void checkEditedReprojection(const std::string& scene, int depth) {
+    const int size = 1 << depth;
+    Octree tree(depth);
+    tree.build(testSceneVoxels(scene, depth));
+    tree.writeData();
+    // The octant facing the camera of the first orbit frame, empty then filled
+    for (int z = size / 2; z < size; z++) {
+        for (int y = size / 2; y < size; y++) {
+            for (int x = size / 2; x < size; x++) {
+                tree.erase(x, y, z);
+            }
+        }
+    }
+
+    Camera camera;
+    camera.setAspectRatio(static_cast<float>(image_width) / image_height);
+    orbitCamera(camera, depth, 0, 3);
+    CPURenderer renderer(2);
+    renderer.settings.temporalReprojection = true;
+    Image reference, tiled;
+    reference.resize(image_width, image_height);
+    tiled.resize(image_width, image_height);
+    renderer.render(tree.blockPool(), camera, tiled);
+
+    for (int z = size / 2; z < size; z++) {
+        for (int y = size / 2; y < size; y++) {
+            for (int x = size / 2; x < size; x++) {
+                tree.set(x, y, z, testColor(x + y + z, 90, 200));
+            }
+        }
+    }
+    renderer.invalidateHits();
+    renderer.render(tree.blockPool(), camera, tiled);
+    renderReference(tree.blockPool(), renderer.settings, camera, reference);
+    int different = differentPixels(reference, tiled);
+    if (different) std::cerr << scene << " edited after reprojection: " << different << " pixels differ" << std::endl;
+    CHECK_EQUAL(different, 0);
+}
+
+int main() {
+    const int depth = 6;
+    for (const std::string& scene : testScenes()) {
+        Octree tree(depth);
+        tree.build(testSceneVoxels(scene, depth));
+        tree.collapse();
+        tree.writeData();
+        // The *_far build keeps only the nearest blocks in reach of an address offset
+        if (near_range < address_bias) CHECK(tree.blockPool().farCount > 0);
+        checkRenderers(scene, tree.blockPool(), depth);
+        checkShortcut(scene, tree.blockPool(), depth, &TraceSettings::skipEmpty, "skipEmpty");
+        checkShortcut(scene, tree.blockPool(), depth, &TraceSettings::resumeLookups, "resumeLookups");
+        checkShortcut(scene, tree.blockPool(), depth, &TraceSettings::conePrepass, "conePrepass");
+
+        tree.setBricks(true);
+        checkRenderers(scene + " bricks", tree.blockPool(), depth);
+        tree.setBricks(false);
+        tree.setAttributeStream(true);
+        checkRenderers(scene + " attributes", tree.blockPool(), depth);
+        tree.setAttributeStream(false);
+
+        // Palette indices packed two (more than 256 colours) or four per entry
+        for (int bits = 9; bits >= 4; bits -= 5) {
+            tree.buildPalette(bits);
+            tree.setNodeFormat(NodeFormat::Compact);
+            tree.writeData();
+            checkRenderers(scene + " palette compact", tree.nodePool(), depth);
+            tree.setNodeFormat(NodeFormat::Blocks);
+            tree.setBricks(true);
+            checkRenderers(scene + " palette bricks", tree.blockPool(), depth);
+            tree.setBricks(false);
+        }
+        checkEditedReprojection(scene, depth);
+    }
+    return testResult("test_renderers");
+}
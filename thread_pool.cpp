@@ -0,0 +1,106 @@
+/*
+    thread_pool.cpp
+    author: Telo PHILIPPE
+
+    Implementation of the work-stealing thread pool.
+*/
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+    threadCount = std::max(1u, threadCount);
+    for (unsigned int i = 0; i < threadCount; i++) {
+        m_queues.emplace_back(new Queue());
+    }
+    for (unsigned int i = 0; i < threadCount; i++) {
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)>& task) {
+    if (count == 0) {
+        return;
+    }
+
+    Job job;
+    job.task = &task;
+    job.remaining = count;
+
+    // Deal contiguous ranges to the workers, stealing evens out the rest
+    size_t workers = m_queues.size();
+    for (size_t w = 0; w < workers; w++) {
+        size_t begin = count * w / workers;
+        size_t end = count * (w + 1) / workers;
+        std::lock_guard<std::mutex> lock(m_queues[w]->mutex);
+        for (size_t i = begin; i < end; i++) {
+            m_queues[w]->tasks.push_back(Task { &job, i });
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_generation++;
+    m_wake.notify_all();
+    m_done.wait(lock, [&job] { return job.remaining == 0; });
+}
+
+bool ThreadPool::pop(unsigned int worker, Task& task) {
+    Queue& queue = *m_queues[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    // Take the task after the one just done, which is the nearest in memory
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(unsigned int worker, Task& task) {
+    for (size_t offset = 1; offset < m_queues.size(); offset++) {
+        Queue& queue = *m_queues[(worker + offset) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            // Steal from the opposite end to the owner to avoid fighting over the same tasks
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned int worker) {
+    size_t generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stopping || m_generation != generation; });
+            if (m_stopping) {
+                return;
+            }
+            generation = m_generation;
+        }
+
+        Task task;
+        while (pop(worker, task) || steal(worker, task)) {
+            (*task.job->task)(task.index);
+            if (--task.job->remaining == 0) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done.notify_all();
+            }
+        }
+    }
+}
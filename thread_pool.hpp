@@ -0,0 +1,67 @@
+/*
+    thread_pool.hpp
+    author: Telo PHILIPPE
+
+    Persistent worker threads with work stealing. Each worker owns a queue of tasks that
+    it works through front to back; once it runs dry it steals from the back of the other
+    queues, so uneven tasks (like image tiles) stay balanced.
+*/
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs task(i) for every i in [0, count) on the workers and returns once all are done.
+    // Consecutive indices start on the same worker.
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+    unsigned int size() const { return static_cast<unsigned int>(m_threads.size()); }
+
+private:
+    struct Job {
+        const std::function<void(size_t)>* task;
+        std::atomic<size_t> remaining;
+    };
+
+    struct Task {
+        Job* job;
+        size_t index;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(unsigned int worker);
+    bool pop(unsigned int worker, Task& task);
+    bool steal(unsigned int worker, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    size_t m_generation = 0;
+    bool m_stopping = false;
+};
+
+#endif  // THREAD_POOL_HPP
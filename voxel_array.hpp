@@ -3,66 +3,171 @@
 
 #include "gl_includes.hpp"
 #include "octree.hpp"
+#include "morton.hpp"
+#include "parallel.hpp"
 
+#include <cmath>
 #include <random>
 #include <iostream>
 #include <memory>
 
 
+// How the generated volume reaches the octree builder
+enum class VoxelStorage {
+    Dense,      // Packed colour of every voxel, kept after the build (4 bytes per voxel)
+    Streamed,   // Generated chunk by chunk straight into the builder, nothing dense is kept
+    Implicit,   // Built top-down, only the cells crossing the shell are sampled
+};
+
+// Voxels of a streamed build generated at once: 64^3, a few MB of MortonVoxel at most
+const int voxel_chunk_depth = 6;
+
 class VoxelArray {
 private:
 public:
     GLuint size;
     int depth;
-    glm::vec3* colorData;
+    bool useDAG;
+    int paletteBits;    // Leaves index a palette of 2^paletteBits colours, 0 to keep their colours
+    VoxelStorage storage;
+    GLuint* colorData;  // 0xAARRGGBB per voxel, alpha 0 for empty voxels. Null when streamed.
 
     std::shared_ptr<Octree> octree;
 
 public:
-    VoxelArray(GLuint depth) {
+    VoxelArray(GLuint depth, bool useDAG = false, VoxelStorage storage = VoxelStorage::Implicit, int paletteBits = 0) {
         this->depth = depth;
+        this->useDAG = useDAG;
+        this->paletteBits = paletteBits;
+        this->storage = storage;
         size = 1 << depth;
-        colorData = new glm::vec3[size * size * size];
+        colorData = nullptr;
 
-        generateVoxelData();
+        if(storage == VoxelStorage::Dense) {
+            generateVoxelData();
+        }
         generateOctree();
 
     }
 
+    // Colour of voxel (x, y, z) packed as 0xAARRGGBB, 0 if the voxel is empty
+    GLuint sampleVoxel(GLuint x, GLuint y, GLuint z) const {
+        glm::vec3 normalizedPos = glm::vec3(x, y, z) / glm::vec3(size, size, size) * 2.0f - 1.0f;
+
+        if(glm::length(normalizedPos) < 1.0f && glm::length(normalizedPos) > 0.95f) {
+            float red   = sin((normalizedPos.x + normalizedPos.y + normalizedPos.z)*10.0f) * 0.4f + 0.6f;
+            float green = sin((normalizedPos.x + normalizedPos.y + normalizedPos.z)*10.0f + 2.0f) * 0.4f + 0.6f;
+            float blue  = sin((normalizedPos.x + normalizedPos.y + normalizedPos.z)*10.0f + 4.0f) * 0.4f + 0.6f;
+            unsigned int r = red * 255.0f;
+            unsigned int g = green * 255.0f;
+            unsigned int b = blue * 255.0f;
+            return 0xFF000000 | r << 16 | g << 8 | b;
+        }
+        return 0;
+    }
+
+    // Conservative bounds of sampleVoxel over the cube of cellSize voxels whose first voxel is (x, y, z),
+    // in a volume of size voxels per side
+    static CellBounds shellBounds(GLuint x, GLuint y, GLuint z, GLuint cellSize, GLuint size) {
+        // Distances from the centre of the volume to the closest and farthest voxels of the cube
+        const double half = size * 0.5;
+        double lo[3] = { x - half, y - half, z - half };
+        double nearest = 0.0, farthest = 0.0;
+        for(double l : lo) {
+            double h = l + cellSize - 1;
+            double n = l > 0.0 ? l : (h < 0.0 ? -h : 0.0);
+            double f = std::max(std::abs(l), std::abs(h));
+            nearest += n * n;
+            farthest += f * f;
+        }
+        nearest = std::sqrt(nearest) / half;
+        farthest = std::sqrt(farthest) / half;
+
+        // With some margin for the single precision of sampleVoxel
+        const double epsilon = 1e-5;
+        if(farthest < 0.95 - epsilon || nearest > 1.0 + epsilon) {
+            return CellBounds { CellBounds::Empty, 0 };
+        }
+        return CellBounds { CellBounds::Mixed, 0 };
+    }
+
+    // Fills the dense array, allocating it if needed
     void generateVoxelData() {
-        for (int i = 0; i < size * size * size; i++) {
-            GLuint x =  i % size;
-            GLuint y = (i / size) % size;
-            GLuint z =  i / (size * size);
-
-            glm::vec3 normalizedPos = glm::vec3(x, y, z) / glm::vec3(size, size, size) * 2.0f - 1.0f;
-
-            colorData[i] = glm::vec3(0.0f);
-            if(glm::length(normalizedPos) < 1.0f && glm::length(normalizedPos) > 0.95f) {
-                float red   = sin((normalizedPos.x + normalizedPos.y + normalizedPos.z)*10.0f) * 0.4f + 0.6f;
-                float green = sin((normalizedPos.x + normalizedPos.y + normalizedPos.z)*10.0f + 2.0f) * 0.4f + 0.6f;
-                float blue  = sin((normalizedPos.x + normalizedPos.y + normalizedPos.z)*10.0f + 4.0f) * 0.4f + 0.6f;
-                colorData[i] = glm::vec3(red, green, blue);
-            }
+        if(!colorData) {
+            colorData = new GLuint[size_t(size) * size * size];
         }
+        parallelFor(size, [&](size_t k) {
+            for(GLuint j=0; j<size; j++) {
+                for(GLuint i=0; i<size; i++) {
+                    colorData[i + j * size + k * size * size] = sampleVoxel(i, j, k);
+                }
+            }
+        }, 1);
     }
 
     void generateOctree() {
         octree = std::make_shared<Octree>(depth);
-        for(int i=0; i<size; i++) {
-            for(int j=0; j<size; j++) {
-                for(int k=0; k<size; k++) {
-                    glm::vec3 color = colorData[i + j * size + k * size * size];
-                    if(glm::length(color) > 0.0f) {
-                        unsigned int r = color.x * 255.0f;
-                        unsigned int g = color.y * 255.0f;
-                        unsigned int b = color.z * 255.0f;
-                        octree->insert(i, j, k, r << 16 | g << 8 | b);
+        GLuint collapsed;
+        if(colorData) {
+            // Gather the solid voxels one z slice at a time on every worker
+            std::vector<std::vector<MortonVoxel>> slices(size);
+            parallelFor(size, [&](size_t k) {
+                for(GLuint j=0; j<size; j++) {
+                    for(GLuint i=0; i<size; i++) {
+                        GLuint color = colorData[i + j * size + k * size * size];
+                        if(color >> 24) {
+                            slices[k].push_back({ mortonEncode(i, j, k), (int)(color & 0x00FFFFFF) });
+                        }
                     }
                 }
+            }, 1);
+
+            std::vector<MortonVoxel> voxels;
+            for(std::vector<MortonVoxel>& slice : slices) {
+                voxels.insert(voxels.end(), slice.begin(), slice.end());
+                std::vector<MortonVoxel>().swap(slice);
             }
+            sortMortonVoxels(voxels, 3 * depth);
+
+            octree->build(voxels);
+            collapsed = octree->collapse();
+        } else if(storage == VoxelStorage::Implicit) {
+            collapsed = octree->buildImplicit(
+                [&](GLuint x, GLuint y, GLuint z, GLuint cellSize) { return shellBounds(x, y, z, cellSize, size); },
+                [&](GLuint x, GLuint y, GLuint z) { return sampleVoxel(x, y, z); });
+        } else {
+            collapsed = octree->buildChunked(voxel_chunk_depth, [&](int x0, int y0, int z0, std::vector<MortonVoxel>& voxels) {
+                const GLuint chunkSize = std::min<GLuint>(size, 1 << voxel_chunk_depth);
+                std::vector<std::vector<MortonVoxel>> slices(chunkSize);
+                parallelFor(chunkSize, [&](size_t k) {
+                    for(GLuint j=0; j<chunkSize; j++) {
+                        for(GLuint i=0; i<chunkSize; i++) {
+                            GLuint color = sampleVoxel(x0 + i, y0 + j, z0 + k);
+                            if(color >> 24) {
+                                slices[k].push_back({ mortonEncode(i, j, k), (int)(color & 0x00FFFFFF) });
+                            }
+                        }
+                    }
+                }, 1);
+                for(std::vector<MortonVoxel>& slice : slices) {
+                    voxels.insert(voxels.end(), slice.begin(), slice.end());
+                }
+            });
+        }
+        std::cout << "Collapsed uniform subtrees: " << octree->nodeCount() + collapsed << " -> " << octree->nodeCount() << " nodes" << std::endl;
+        // Before the DAG reduction, which finds more identical subtrees once colours are shared
+        if(paletteBits > 0) {
+            GLuint merged = octree->buildPalette(paletteBits);
+            std::cout << "Palette: " << octree->colorPalette().colors.size() << " colours (" << paletteBits << " bits), "
+                      << merged << " more nodes collapsed" << std::endl;
+        }
+        if(useDAG) {
+            DAGStats stats = octree->reduceToDAG();
+            std::cout << "DAG reduction: " << stats.nodesBefore << " -> " << stats.nodesAfter << " nodes, "
+                      << stats.interiorBefore << " -> " << stats.interiorAfter << " node blocks ("
+                      << stats.compressionRatio() << "x)" << std::endl;
         }
-        octree->generateTexture();
+        octree->writeData();
     }
 
     ~VoxelArray() {